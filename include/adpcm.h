@@ -0,0 +1,235 @@
+#ifndef ADPCM_H
+#define ADPCM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * IMA-ADPCM sound assets
+ *
+ * Every 16-bit sample is stored as a 4-bit step relative to a prediction, which makes a sound four
+ * times smaller than the same WAV file: all of them fit in the sound cache, and a streamed one
+ * needs a quarter of the SD card reads. An asset (.adp, made by scripts/wav_to_adpcm.py) is a
+ * header followed by independent mono blocks, laid out like the blocks of IMA-ADPCM WAV files:
+ *
+ *   header: ADPCM_MAGIC, version, channels (1), block size (u16), sample rate (u32), sample count (u32)
+ *   block:  first sample (i16), step index (u8), 0, then two samples per byte, low nibble first
+ *
+ * All the numbers are little-endian. A block starts from the predictor stored in its header, so it
+ * decodes without the ones before it, and the decoder turns a whole block into samples at once.
+ * The codec has no dependencies, so it can be built, checked and benchmarked on the host.
+ */
+
+#define ADPCM_MAGIC "ADPC"
+#define ADPCM_MAGIC_SIZE 4
+#define ADPCM_VERSION 1
+
+/* the size of the header of an asset */
+#define ADPCM_HEADER_SIZE 16
+
+/* the size of the header of a block: the first sample and the step index */
+#define ADPCM_BLOCK_HEADER_SIZE 4
+
+/* the block size used by the converter, and the largest one the car plays (in bytes) */
+#define ADPCM_BLOCK_SIZE 256
+#define ADPCM_MAX_BLOCK_SIZE 512
+
+/* the number of samples in a block of a given size (in bytes) */
+#define ADPCM_BLOCK_SAMPLES(blockSize) (1 + 2 * ((blockSize) - ADPCM_BLOCK_HEADER_SIZE))
+
+/* the highest step index */
+#define ADPCM_MAX_STEP_INDEX 88
+
+/* the quantizer step for every step index */
+constexpr int16_t ADPCM_STEPS[ADPCM_MAX_STEP_INDEX + 1] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97,
+  107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+  876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428,
+  4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350,
+  22385, 24623, 27086, 29794, 32767
+};
+
+/* the change of the step index after every code (the sign bit doesn't matter) */
+constexpr int8_t ADPCM_INDEX_CHANGES[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+
+/* the description of an asset, stored in its header */
+struct AdpcmHeader {
+  uint16_t blockSize;   // the size of a block (in bytes), the last one may be shorter
+  uint32_t sampleRate;  // in hertz
+  uint32_t sampleCount; // the number of samples of the sound
+};
+
+/* the state of the codec between two samples */
+struct AdpcmState {
+  int32_t predictor; // the last sample decoded
+  uint8_t index;     // the step index
+};
+
+/*
+ * Function that writes the header of an asset
+ *
+ * @param data - where to write it, at least ADPCM_HEADER_SIZE bytes
+ * @param header - the description of the asset
+ * @return the size of the header
+ */
+inline size_t writeAdpcmHeader(uint8_t *data, const AdpcmHeader &header) {
+  memcpy(data, ADPCM_MAGIC, ADPCM_MAGIC_SIZE);
+  data[4] = ADPCM_VERSION;
+  data[5] = 1;
+  data[6] = header.blockSize & 0xFF;
+  data[7] = header.blockSize >> 8;
+  for (uint8_t i = 0; i < 4; i++) {
+    data[8 + i] = (header.sampleRate >> (8 * i)) & 0xFF;
+    data[12 + i] = (header.sampleCount >> (8 * i)) & 0xFF;
+  }
+  return ADPCM_HEADER_SIZE;
+}
+
+/*
+ * Function that reads the header of an asset
+ *
+ * @param data - the start of the asset
+ * @param length - the number of bytes available
+ * @param header - where to store the description of the asset
+ * @return whether it is a mono asset in a version and with a block size the decoder supports
+ */
+inline bool readAdpcmHeader(const uint8_t *data, size_t length, AdpcmHeader &header) {
+  if (length < ADPCM_HEADER_SIZE || memcmp(data, ADPCM_MAGIC, ADPCM_MAGIC_SIZE) != 0 || data[4] != ADPCM_VERSION ||
+      data[5] != 1) {
+    return false;
+  }
+
+  header.blockSize = data[6] | (data[7] << 8);
+  header.sampleRate = 0;
+  header.sampleCount = 0;
+  for (uint8_t i = 0; i < 4; i++) {
+    header.sampleRate |= (uint32_t)data[8 + i] << (8 * i);
+    header.sampleCount |= (uint32_t)data[12 + i] << (8 * i);
+  }
+  return header.blockSize > ADPCM_BLOCK_HEADER_SIZE && header.blockSize <= ADPCM_MAX_BLOCK_SIZE && header.sampleRate > 0;
+}
+
+/*
+ * Function that decodes one code, updating the state of the codec
+ *
+ * @param state - the state of the codec
+ * @param code - the 4-bit code
+ * @return the decoded sample
+ */
+inline int16_t adpcmDecodeSample(AdpcmState &state, uint8_t code) {
+  int32_t step = ADPCM_STEPS[state.index];
+
+  /* (code magnitude + 0.5) * step / 4, in shifts so it rounds like every other IMA decoder */
+  int32_t difference = step >> 3;
+  if (code & 4) {
+    difference += step;
+  }
+  if (code & 2) {
+    difference += step >> 1;
+  }
+  if (code & 1) {
+    difference += step >> 2;
+  }
+
+  int32_t predictor = (code & 8) ? state.predictor - difference : state.predictor + difference;
+  state.predictor = predictor > INT16_MAX ? INT16_MAX : predictor < INT16_MIN ? INT16_MIN : predictor;
+
+  int32_t index = state.index + ADPCM_INDEX_CHANGES[code];
+  state.index = index < 0 ? 0 : index > ADPCM_MAX_STEP_INDEX ? ADPCM_MAX_STEP_INDEX : index;
+
+  return (int16_t)state.predictor;
+}
+
+/*
+ * Function that encodes one sample as the code that gets the decoder closest to it, updating the
+ * state of the codec the same way the decoder will
+ *
+ * @param state - the state of the codec
+ * @param sample - the sample to encode
+ * @return the 4-bit code
+ */
+inline uint8_t adpcmEncodeSample(AdpcmState &state, int16_t sample) {
+  int32_t step = ADPCM_STEPS[state.index];
+  int32_t difference = sample - state.predictor;
+  uint8_t code = 0;
+
+  if (difference < 0) {
+    code = 8;
+    difference = -difference;
+  }
+  if (difference >= step) {
+    code |= 4;
+    difference -= step;
+  }
+  if (difference >= step >> 1) {
+    code |= 2;
+    difference -= step >> 1;
+  }
+  if (difference >= step >> 2) {
+    code |= 1;
+  }
+
+  adpcmDecodeSample(state, code);
+  return code;
+}
+
+/*
+ * Function that decodes a block
+ *
+ * @param block - the block
+ * @param length - the size of the block (in bytes), shorter than the block size for the last one
+ * @param samples - where to store the samples, room for ADPCM_BLOCK_SAMPLES(length)
+ * @return the number of samples decoded, 0 if the block is too short to have a header
+ */
+inline uint16_t adpcmDecodeBlock(const uint8_t *block, size_t length, int16_t *samples) {
+  if (length < ADPCM_BLOCK_HEADER_SIZE) {
+    return 0;
+  }
+
+  AdpcmState state = { (int16_t)(block[0] | (block[1] << 8)), block[2] };
+  if (state.index > ADPCM_MAX_STEP_INDEX) {
+    state.index = ADPCM_MAX_STEP_INDEX; // a corrupted block must not read past the step table
+  }
+
+  int16_t *sample = samples;
+  *sample++ = (int16_t)state.predictor;
+  for (size_t i = ADPCM_BLOCK_HEADER_SIZE; i < length; i++) {
+    *sample++ = adpcmDecodeSample(state, block[i] & 0x0F);
+    *sample++ = adpcmDecodeSample(state, block[i] >> 4);
+  }
+  return sample - samples;
+}
+
+/*
+ * Function that encodes a block, starting from the step index the previous block ended with
+ *
+ * @param samples - the samples, at most ADPCM_BLOCK_SAMPLES of the block size
+ * @param count - the number of samples
+ * @param index - the step index, updated to the one the block ends with
+ * @param block - where to store the block
+ * @return the size of the block (in bytes), a last odd sample is padded with a 0 code
+ */
+inline size_t adpcmEncodeBlock(const int16_t *samples, uint16_t count, uint8_t &index, uint8_t *block) {
+  if (count == 0) {
+    return 0;
+  }
+
+  AdpcmState state = { samples[0], index };
+  block[0] = (uint16_t)samples[0] & 0xFF;
+  block[1] = (uint16_t)samples[0] >> 8;
+  block[2] = index;
+  block[3] = 0;
+
+  size_t length = ADPCM_BLOCK_HEADER_SIZE;
+  for (uint16_t i = 1; i < count; i += 2) {
+    uint8_t low = adpcmEncodeSample(state, samples[i]);
+    uint8_t high = i + 1 < count ? adpcmEncodeSample(state, samples[i + 1]) : 0;
+    block[length++] = low | (high << 4);
+  }
+
+  index = state.index;
+  return length;
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef AVOIDANCE_H
+#define AVOIDANCE_H
+
+#include <stdint.h>
+
+/*
+ * Time-to-collision obstacle avoidance
+ *
+ * The closing speed towards an obstacle is estimated from the recent filtered distances (a
+ * least-squares slope) and from the speed the motors are driven at, whichever is higher: the
+ * first one sees obstacles that move, the second one reacts before the history has caught up with
+ * a car that just accelerated. From the closing speed, the time the car needs to stop (the
+ * reaction time of the sensor and the slow-down of the motors) gives the distance at which it
+ * would come to rest if it started braking now:
+ *
+ *   stop distance = distance - closing speed * stopping time
+ *
+ * The car brakes when that distance falls below AVOID_BRAKE_DISTANCE, and reverses when it falls
+ * below AVOID_DISTANCE_MIN, with an effort that grows with the shortfall. Both only apply while the
+ * car closes in, so it can still turn or back away near an obstacle. An obstacle already closer
+ * than AVOID_DISTANCE_MIN gets the full effort, whatever the speed.
+ */
+
+/* the number of distances the closing speed is estimated from */
+#define AVOID_HISTORY_SIZE 4
+
+/* beyond this distance (in cm) the sensor's readings are too coarse to estimate a speed from */
+#define AVOID_RANGE_MAX 80
+
+/* the car brakes when it would stop closer than this to the obstacle (in cm) */
+#define AVOID_BRAKE_DISTANCE 20
+
+/* the car reverses when it would stop closer than this to the obstacle, or already is (in cm) */
+#define AVOID_DISTANCE_MIN 15
+
+/* the shortfall (in cm) below AVOID_DISTANCE_MIN from which the car reverses with the full effort */
+#define AVOID_FULL_EFFORT_SHORTFALL 10
+
+/* the full reversing effort */
+#define AVOID_EFFORT_MAX 1000
+
+/* what the car does about an obstacle */
+enum AvoidanceAction : uint8_t {
+  AVOID_NONE,
+  AVOID_BRAKE,   // slow down to a stop
+  AVOID_REVERSE  // back away, with the effort of the plan
+};
+
+/* the recent filtered distances to the obstacle, oldest first */
+struct DistanceHistory {
+  uint8_t distances[AVOID_HISTORY_SIZE];
+  uint8_t count;
+};
+
+/* the reaction to an obstacle */
+struct AvoidancePlan {
+  AvoidanceAction action;
+  int32_t closingSpeed;   // the speed the car closes in on the obstacle at (in cm/s)
+  uint32_t timeToCollision; // the time left before reaching the obstacle at that speed (in milliseconds)
+  int32_t stopDistance;   // the distance the car would stop at if it braked now (in cm)
+  uint16_t effort;        // the reversing effort (0 - AVOID_EFFORT_MAX)
+};
+
+/*
+ * Function that adds a distance to the history, dropping the oldest one when it is full
+ *
+ * @param history - the history
+ * @param distance - the filtered distance (in cm)
+ */
+inline void addDistance(DistanceHistory &history, uint8_t distance) {
+  if (history.count == AVOID_HISTORY_SIZE) {
+    for (uint8_t i = 1; i < AVOID_HISTORY_SIZE; i++) {
+      history.distances[i - 1] = history.distances[i];
+    }
+    history.count--;
+  }
+  history.distances[history.count++] = distance;
+}
+
+/*
+ * Function that estimates the speed the distance decreases at, as the least-squares slope of
+ * the history
+ *
+ * @param history - the distances, sampled at a fixed interval
+ * @param interval - the interval between two distances (in milliseconds)
+ * @return the closing speed (in cm/s), negative when the obstacle gets farther
+ */
+inline int32_t measureClosingSpeed(const DistanceHistory &history, uint32_t interval) {
+  int32_t n = history.count;
+  if (n < 2) {
+    return 0;
+  }
+
+  int32_t sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+  for (int32_t x = 0; x < n; x++) {
+    int32_t y = history.distances[x];
+    sumX += x;
+    sumY += y;
+    sumXX += x * x;
+    sumXY += x * y;
+  }
+
+  /* slope in cm per sample, scaled to cm/s; the distance decreasing is a positive closing speed */
+  return -(n * sumXY - sumX * sumY) * 1000 / ((n * sumXX - sumX * sumX) * (int32_t)interval);
+}
+
+/*
+ * Function that decides the reaction to an obstacle
+ *
+ * @param distance - the filtered distance to the obstacle (in cm)
+ * @param closingSpeed - the speed the car closes in on it at (in cm/s)
+ * @param stoppingTime - the time the car needs to stop, from the reading to being at rest, as
+ *                       the time it would take at a constant closing speed (in milliseconds)
+ */
+inline AvoidancePlan planAvoidance(uint8_t distance, int32_t closingSpeed, uint32_t stoppingTime) {
+  AvoidancePlan plan = { AVOID_NONE, closingSpeed, UINT32_MAX, distance, 0 };
+
+  if (closingSpeed > 0) {
+    plan.timeToCollision = (uint32_t)distance * 1000 / closingSpeed;
+    plan.stopDistance = distance - (int32_t)(closingSpeed * stoppingTime / 1000);
+  }
+
+  if (distance <= AVOID_DISTANCE_MIN) {
+    plan.action = AVOID_REVERSE;
+    plan.effort = AVOID_EFFORT_MAX;
+  } else if (closingSpeed <= 0) {
+    /* standing still, turning or moving away: there is nothing to stop short of */
+  } else if (plan.stopDistance < AVOID_DISTANCE_MIN) {
+    int32_t shortfall = AVOID_DISTANCE_MIN - plan.stopDistance;
+    plan.action = AVOID_REVERSE;
+    plan.effort = shortfall >= AVOID_FULL_EFFORT_SHORTFALL ? AVOID_EFFORT_MAX
+                                                          : shortfall * AVOID_EFFORT_MAX / AVOID_FULL_EFFORT_SHORTFALL;
+  } else if (plan.stopDistance < AVOID_BRAKE_DISTANCE) {
+    plan.action = AVOID_BRAKE;
+  }
+
+  return plan;
+}
+
+#endif
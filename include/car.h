@@ -0,0 +1,259 @@
+#ifndef CAR_H
+#define CAR_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include "hal.h"
+#include "protocol.h"
+#include "command_queue.h"
+#include "ir_sensor.h"
+#include "histogram.h"
+#include "telemetry.h"
+#include "motor_ramp.h"
+#include "recorder.h"
+#include "drive_state.h"
+#include "drive_mixer.h"
+#include "avoidance.h"
+#include "log.h"
+#include "power.h"
+
+/*
+ * Car logic: motors, lights, obstacle avoidance, sound requests and the handling of the commands
+ * received from the clients
+ *
+ * Everything here reaches the hardware through the HAL (see hal.h), so it builds both for the
+ * ESP32 and for the host ([env:native]). main.cpp wires it to the Wi-Fi, the web server, the
+ * audio output and the control task.
+ */
+
+/* flags related to the commands given to the car */
+#define STOP_WHEELS 0
+#define MOVE_FORWARD 1
+#define MOVE_LEFT 2
+#define MOVE_RIGHT 3
+#define MOVE_BACKWARDS 4
+#define ACTIVATE_HORN 1
+#define TOGGLE_OBSTACLE_AVOIDANCE 1
+#define TOGGLE_HEADLIGHTS 2
+
+/* motors identifiers */
+#define LEFT_MOTORS 0
+#define RIGHT_MOTORS 1
+
+/* pins used by the motors */
+#define LEFT_MOTORS_EN 32
+#define LEFT_MOTORS_IN1 13
+#define LEFT_MOTORS_IN2 27
+#define RIGHT_MOTORS_IN3 14
+#define RIGHT_MOTORS_IN4 12
+#define RIGHT_MOTORS_EN 33
+
+/* settings of the PWM signals driving the motors' enable pins (LEDC peripheral) */
+#define LEFT_MOTORS_PWM_CHANNEL 0
+#define RIGHT_MOTORS_PWM_CHANNEL 1
+#define MOTOR_PWM_FREQUENCY 20000
+#define MOTOR_PWM_RESOLUTION 10
+#define MOTOR_DUTY_MAX ((1 << MOTOR_PWM_RESOLUTION) - 1)
+
+/* the time for the motors to ramp from stopped to full speed, and from full speed to stopped (in milliseconds) */
+#define MOTOR_ACCELERATION_TIME 200
+#define MOTOR_DECELERATION_TIME 80
+
+/* pin used by the infrared distance sensor */
+#define IR_SENSOR 35
+
+/* the time period for the infrared sensor to read data */
+#define IR_SENSOR_READ_INTERVAL 25
+
+/* the period of the control tick (in microseconds), driven by a hardware timer */
+#define CONTROL_TICK_INTERVAL 5000
+
+/* the number of control ticks between two infrared sensor readings */
+#define IR_SENSOR_READ_TICKS (IR_SENSOR_READ_INTERVAL * 1000 / CONTROL_TICK_INTERVAL)
+
+/* the largest change of the motors' duty in one control tick */
+#define MOTOR_ACCELERATION_STEP ((int32_t)MOTOR_DUTY_MAX * CONTROL_TICK_INTERVAL / (MOTOR_ACCELERATION_TIME * 1000))
+#define MOTOR_DECELERATION_STEP ((int32_t)MOTOR_DUTY_MAX * CONTROL_TICK_INTERVAL / (MOTOR_DECELERATION_TIME * 1000))
+
+/* frequency of the CPU at full clock, used to express the cycle-counter probe buckets in microseconds */
+#define CPU_FREQUENCY_MHZ 240
+#define US_TO_CYCLES(us) ((us) * CPU_FREQUENCY_MHZ)
+
+/* the duration of car reversing when avoiding an obstacle with the full effort */
+#define REVERSING_TIME 250
+
+/* the approximate ground speed of the car at full duty (in cm/s), used to predict its stopping distance */
+#define CAR_MAX_SPEED 100
+
+/* the age of the distance an avoidance reacts to: up to a sensor period, plus the lag of the moving average */
+#define AVOID_REACTION_TIME (2 * IR_SENSOR_READ_INTERVAL)
+
+/* pins assigned to the LEDs for headlights and taillights */
+#define HEADLIGHTS 17
+#define TAILLIGHTS 16
+
+/* the bit of a pin (0-31) in the masks of output pins (see halGpioWrite) */
+#define PIN_BIT(pin) (1UL << (pin))
+
+/* the output pins driven by the car logic, all written together at every control tick */
+#define MOTOR_PINS (PIN_BIT(LEFT_MOTORS_IN1) | PIN_BIT(LEFT_MOTORS_IN2) | PIN_BIT(RIGHT_MOTORS_IN3) | PIN_BIT(RIGHT_MOTORS_IN4))
+#define OUTPUT_PINS (MOTOR_PINS | PIN_BIT(HEADLIGHTS) | PIN_BIT(TAILLIGHTS))
+
+/* the maximum number of WebSocket clients connected at the same time */
+#define MAX_CLIENTS 4
+
+/* sounds that can be requested from the audio task, ordered by increasing priority */
+#define SOUND_ACCELERATION 0
+#define SOUND_REVERSING 1
+#define SOUND_HORN 2
+#define SOUND_COUNT 3
+
+/* the bit of a sound in the mask of requested sounds */
+#define SOUND_BIT(sound) (1 << (sound))
+
+/* the motors are stopped when no frame has been received for this long (in milliseconds) */
+#define DEADMAN_TIMEOUT 400
+
+/* the driver lease can be taken over when the driver hasn't sent a frame for this long (in milliseconds) */
+#define LEASE_TIMEOUT 2000
+
+/* the number of control ticks between two hand-overs of the recorder's buffer to the storage */
+#define RECORDER_HANDOVER_TICKS (1000000 / CONTROL_TICK_INTERVAL)
+
+/* the number of bounds of the timing and probe histograms */
+#define TIMING_BUCKET_COUNT 10
+#define CYCLE_BUCKET_COUNT 10
+
+/* state kept for every connected WebSocket client */
+struct ClientSession {
+  uint32_t clientId;                 // id of the client, 0 if the session is free
+  uint32_t remoteAddress;            // the IPv4 address of the client, the only one its UDP datagrams are accepted from
+  FrameDecoder decoder;              // decoder state of the client's frames
+  uint8_t frameBuffer[MAX_FRAME_SIZE]; // buffer used to reassemble fragmented frames
+  size_t frameLength;                // number of bytes of the current frame received so far
+  Telemetry telemetryBaseline;       // the telemetry values last sent to the client
+  uint8_t framesSinceKeyframe;       // the number of telemetry frames sent since the last keyframe
+  uint32_t pingsSent;                // the number of heartbeat pings sent to the client
+  uint32_t pongsReceived;            // the number of heartbeat pongs received from the client
+  uint32_t lastRtt;                  // the last round-trip time measured (in microseconds)
+  uint32_t lastReceiveTime;          // the time the last frame was received (in microseconds)
+  uint32_t maxFrameGap;              // the longest time between two frames (in microseconds)
+  uint32_t lastTelemetryTime;        // timestamp of the last telemetry frame sent to the client
+  uint32_t telemetryDropped;         // telemetry frames not sent because the client's queue was backed up
+  volatile bool leasePending;        // whether the client must be told who holds the lease
+  ControlCommand lastStateCommands[OP_ACTIVATE + 1]; // the last move (or drive), speed and activate commands accepted, by opcode
+  uint32_t stateGeneration;          // the carStateGeneration the last commands were accepted in
+};
+
+/* what the car does in a drive state */
+struct DriveOutputs {
+  uint8_t leftMotors;  // the direction of the left motors (MOVE_FORWARD, MOVE_BACKWARDS or STOP_WHEELS)
+  uint8_t rightMotors; // the direction of the right motors
+  bool taillights;     // whether the taillights are on
+  uint32_t sounds;     // the motion sound played (a mask of SOUND_BIT)
+};
+
+/* what the car does in every drive state, indexed by DriveState */
+extern const DriveOutputs DRIVE_OUTPUTS[DRIVE_STATE_COUNT];
+
+/* state of the car */
+extern DriveState driveState;
+extern bool honking;
+extern bool headlights;
+extern uint32_t requestedSounds;
+extern bool avoidObstacles;
+extern uint32_t lastObstacleAvoidedTime;
+extern DistanceHistory distanceHistory;
+extern AvoidancePlan lastAvoidancePlan;
+extern int32_t avoidanceDuty;
+extern uint32_t avoidanceTime;
+extern uint32_t avoidanceBrakes;
+extern uint32_t avoidanceReversals;
+extern IrFilter irFilter;
+extern uint8_t lastDistance;
+extern uint8_t motorsSpeed;
+extern uint8_t motorsTargetDirection[2];
+extern int8_t driveThrottle;
+extern int8_t driveSteer;
+extern MotorRamp motorRamps[2];
+extern uint32_t controlTicks;
+extern uint32_t outputPins;
+extern uint32_t gpioWrites;
+
+/* link state */
+extern volatile uint32_t lastFrameTime;
+extern volatile uint32_t deadmanStops;
+extern volatile uint32_t soundRequestTime;
+extern CommandQueue commandQueue;
+extern ClientSession sessions[MAX_CLIENTS];
+extern Recorder recorder;
+extern PowerGovernor powerGovernor;
+extern volatile uint32_t lastActivityTime;
+extern volatile uint32_t lastActivityMicros;
+extern volatile uint32_t cycleScale;
+
+/* driver lease */
+extern volatile uint32_t driverClientId;
+extern volatile uint32_t leaseChanges;
+extern volatile uint32_t spectatorCommandsDropped;
+extern std::atomic<uint32_t> carStateGeneration;
+extern volatile uint32_t framesReceived;
+extern volatile uint32_t redundantCommandsDropped;
+extern volatile uint32_t datagramsReceived;
+extern volatile uint32_t datagramsRejected;
+
+/* bucket bounds of the timing histograms (in microseconds) and of the probes (in CPU cycles) */
+extern const uint32_t TIMING_BUCKETS[TIMING_BUCKET_COUNT];
+extern const uint32_t CYCLE_BUCKETS[CYCLE_BUCKET_COUNT];
+
+/* timing of the car logic */
+extern Histogram reactionTime;
+extern Histogram commandLatency;
+extern Histogram handleSoundsCycles;
+extern Histogram obstacleDetectionCycles;
+
+uint32_t motorDirectionPins(uint8_t motors, int8_t direction);
+void writeOutputPins(uint32_t levels);
+int32_t speedToDuty(uint8_t speedValue);
+void setMotorsTarget(uint8_t motors, uint8_t direction);
+void updateMotors();
+bool driveEvent(DriveEvent event);
+void moveWheels(uint8_t direction);
+void mixDrive();
+void driveJoystick(int32_t throttle, int32_t steer);
+void setMotorsSpeed(uint8_t speedValue);
+void activateFeature(uint8_t feature);
+void toggleFeature(uint8_t feature);
+ClientSession* findSession(uint32_t clientId);
+ClientSession* findSessionByShortId(uint16_t shortId);
+void applyCommand(const ControlCommand &command);
+bool enqueueCommand(const ControlCommand &command, uint32_t receivedAt);
+void recordCommandLatency(const QueuedCommand &queued);
+void applyQueuedCommand(const QueuedCommand &queued);
+void recordAppliedCommands();
+void processCommands();
+void announceLease();
+void setDriver(uint32_t clientId);
+void applyLeaseCommand(ClientSession &session, const ControlCommand &command);
+void connectClient(ClientSession &session, uint32_t clientId, uint32_t remoteAddress);
+uint8_t listOtherClients(uint32_t clientId, uint32_t *clients);
+void disconnectClient(ClientSession &session);
+bool isRedundantCommand(ClientSession &session, const ControlCommand &command);
+void rememberCommand(ClientSession &session, const ControlCommand &command);
+DecodeResult receiveFrame(ClientSession &session, const uint8_t *data, size_t length, uint32_t receivedAt);
+ClientSession* datagramSession(const uint8_t *data, size_t length, uint32_t remoteAddress);
+DecodeResult receiveDatagram(ClientSession &session, const uint8_t *data, size_t length, uint32_t receivedAt);
+void checkDeadman();
+void recordCycles(Histogram &histogram, uint32_t start);
+void setCycleScale(uint32_t cpuMhz);
+uint32_t driveSounds(DriveState state);
+void handleSounds();
+void startAvoidance(const AvoidancePlan &plan);
+void detectAndAvoidObstacles();
+void updatePowerGovernor();
+void runControlTick();
+void startRecording();
+uint32_t drainLog();
+
+#endif
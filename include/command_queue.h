@@ -0,0 +1,127 @@
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include <atomic>
+#include <stdint.h>
+#include "protocol.h"
+
+/*
+ * Bounded single-producer/single-consumer queue of commands
+ *
+ * The producer (the AsyncTCP task decoding WebSocket frames) and the consumer (the control loop)
+ * only share the head and tail indices, so neither side ever blocks or takes a lock. When the
+ * queue is full the newest command is dropped and counted; the consumer coalesces move and speed
+ * commands when draining, so a burst can't build up a backlog of outdated actuator updates.
+ */
+
+/* the number of slots in the queue (must be a power of two) */
+#define COMMAND_QUEUE_SIZE 32
+
+/* a command waiting in the queue */
+struct QueuedCommand {
+  ControlCommand command;
+  uint32_t enqueuedAt; // timestamp (in microseconds) of the moment the command was queued
+};
+
+/* counters describing the queue's behaviour */
+struct CommandQueueStats {
+  uint32_t enqueued;       // commands accepted by the queue
+  uint32_t overflowDrops;  // commands dropped because the queue was full
+  uint32_t applied;        // commands applied by the consumer
+  uint32_t coalescedDrops; // commands superseded by a newer command of the same kind
+  uint8_t maxDepth;        // the highest number of commands waiting at once
+  uint32_t lastLatency;    // the receive-to-pins time of the last applied command (in microseconds)
+  uint32_t maxLatency;     // the longest receive-to-pins time (in microseconds)
+  uint64_t totalLatency;   // sum of all receive-to-pins times (in microseconds)
+};
+
+class CommandQueue {
+  public:
+    CommandQueue() : stats(), head(0), tail(0) {}
+
+    /*
+     * Function that adds a command to the queue (producer side only)
+     *
+     * @param command - the command to add
+     * @param now - the current time in microseconds
+     * @return whether the command was added
+     */
+    bool push(const ControlCommand &command, uint32_t now) {
+      uint32_t currentHead = head.load(std::memory_order_relaxed);
+      uint32_t depth = currentHead - tail.load(std::memory_order_acquire);
+
+      if (depth >= COMMAND_QUEUE_SIZE) {
+        stats.overflowDrops++;
+        return false;
+      }
+
+      slots[currentHead & (COMMAND_QUEUE_SIZE - 1)] = { command, now };
+      head.store(currentHead + 1, std::memory_order_release);
+
+      stats.enqueued++;
+      if (depth + 1 > stats.maxDepth) {
+        stats.maxDepth = depth + 1;
+      }
+      return true;
+    }
+
+    /*
+     * Function that removes the oldest command from the queue (consumer side only)
+     *
+     * @param queued - where to store the removed command
+     * @return whether a command was available
+     */
+    bool pop(QueuedCommand &queued) {
+      uint32_t currentTail = tail.load(std::memory_order_relaxed);
+
+      if (currentTail == head.load(std::memory_order_acquire)) {
+        return false;
+      }
+
+      queued = slots[currentTail & (COMMAND_QUEUE_SIZE - 1)];
+      tail.store(currentTail + 1, std::memory_order_release);
+      return true;
+    }
+
+    /*
+     * Function that returns the number of commands currently waiting in the queue
+     */
+    uint32_t depth() const {
+      return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    /*
+     * Function that records that a command was applied (consumer side only)
+     *
+     * @param queued - the applied command
+     * @param now - the time its effect reached the pins, in microseconds
+     */
+    void recordApplied(const QueuedCommand &queued, uint32_t now) {
+      uint32_t latency = now - queued.enqueuedAt;
+
+      stats.applied++;
+      stats.lastLatency = latency;
+      stats.totalLatency += latency;
+      if (latency > stats.maxLatency) {
+        stats.maxLatency = latency;
+      }
+    }
+
+    /*
+     * Function that records that a command was superseded by a newer one (consumer side only)
+     */
+    void recordCoalesced() {
+      stats.coalescedDrops++;
+    }
+
+    /* counters of the queue; enqueued, overflowDrops and maxDepth are written by the producer,
+     * the rest by the consumer */
+    CommandQueueStats stats;
+
+  private:
+    std::atomic<uint32_t> head; // index of the next slot to write, owned by the producer
+    std::atomic<uint32_t> tail; // index of the next slot to read, owned by the consumer
+    QueuedCommand slots[COMMAND_QUEUE_SIZE];
+};
+
+#endif
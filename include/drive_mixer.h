@@ -0,0 +1,72 @@
+#ifndef DRIVE_MIXER_H
+#define DRIVE_MIXER_H
+
+#include <stdint.h>
+
+/*
+ * Arc-drive mixer
+ *
+ * A joystick gives a throttle (forward positive) and a steer (clockwise positive), both between
+ * -DRIVE_AXIS_MAX and DRIVE_AXIS_MAX. The steer is added to the left side and taken from the
+ * right one, so the car drives an arc whose radius shrinks as the steer grows: the inner side
+ * stops at equal throttle and steer, and steer alone spins the car on the spot. When a side would
+ * go past the full duty both sides are scaled down together, which keeps the ratio between them,
+ * and so the curve, instead of clipping the outer side. A reading within DRIVE_AXIS_DEADZONE of
+ * the center counts as zero, so a joystick at rest doesn't creep.
+ */
+
+/* the largest throttle and steer */
+#define DRIVE_AXIS_MAX 127
+
+/* the readings around the center of an axis that count as zero */
+#define DRIVE_AXIS_DEADZONE 8
+
+/* the signed duty of each side, positive forward */
+struct DriveMix {
+  int32_t left;
+  int32_t right;
+};
+
+/*
+ * Function that clamps the reading of an axis and removes its deadzone, the rest of the range is
+ * stretched so the axis still reaches DRIVE_AXIS_MAX
+ *
+ * @param value - the reading
+ * @return the value of the axis (-DRIVE_AXIS_MAX - DRIVE_AXIS_MAX)
+ */
+inline int32_t driveAxis(int32_t value) {
+  int32_t magnitude = value < 0 ? -value : value;
+  magnitude = magnitude > DRIVE_AXIS_MAX ? DRIVE_AXIS_MAX : magnitude;
+  if (magnitude <= DRIVE_AXIS_DEADZONE) {
+    return 0;
+  }
+
+  magnitude = (magnitude - DRIVE_AXIS_DEADZONE) * DRIVE_AXIS_MAX / (DRIVE_AXIS_MAX - DRIVE_AXIS_DEADZONE);
+  return value < 0 ? -magnitude : magnitude;
+}
+
+/*
+ * Function that mixes a throttle and a steer into the duty of each side
+ *
+ * @param throttle - the throttle reading (-DRIVE_AXIS_MAX - DRIVE_AXIS_MAX)
+ * @param steer - the steer reading (-DRIVE_AXIS_MAX - DRIVE_AXIS_MAX)
+ * @param maxDuty - the duty of a side at full throttle
+ * @return the duty of each side (-maxDuty - maxDuty)
+ */
+inline DriveMix mixArcDrive(int32_t throttle, int32_t steer, int32_t maxDuty) {
+  throttle = driveAxis(throttle);
+  steer = driveAxis(steer);
+
+  int32_t left = throttle + steer;
+  int32_t right = throttle - steer;
+
+  /* scale both sides by the same factor, the larger one to the full range */
+  int32_t leftMagnitude = left < 0 ? -left : left;
+  int32_t rightMagnitude = right < 0 ? -right : right;
+  int32_t largest = leftMagnitude > rightMagnitude ? leftMagnitude : rightMagnitude;
+  int32_t range = largest > DRIVE_AXIS_MAX ? largest : DRIVE_AXIS_MAX;
+
+  return { left * maxDuty / range, right * maxDuty / range };
+}
+
+#endif
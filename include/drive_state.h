@@ -0,0 +1,100 @@
+#ifndef DRIVE_STATE_H
+#define DRIVE_STATE_H
+
+#include <stdint.h>
+
+/*
+ * Drive state machine
+ *
+ * The car is always in exactly one drive state, and only moves to another one through the
+ * transition table below, in response to an event: a move or drive command, an obstacle, the end
+ * of an obstacle avoidance or the link going quiet. Everything the car does in a state (the direction
+ * of each pair of motors, the taillights, the motion sound) is a function of the state alone,
+ * so there is no combination of flags that can disagree with each other. The only exception is
+ * DRIVE_ARC, where the duty of each side is mixed from the joystick (see drive_mixer.h).
+ *
+ * The table is checked at compile time (see driveTableIsValid).
+ */
+
+/* drive states, the first ones in the order of the arguments of OP_MOVE */
+enum DriveState : uint8_t {
+  DRIVE_BRAKE,      // stopped, taillights on
+  DRIVE_FORWARD,
+  DRIVE_TURN_LEFT,
+  DRIVE_TURN_RIGHT,
+  DRIVE_REVERSE,
+  DRIVE_AVOID,      // braking or backing away from an obstacle (see avoidance.h)
+  DRIVE_ARC,        // driven with the joystick (OP_DRIVE)
+  DRIVE_STATE_COUNT
+};
+
+/* events of the drive state machine, the first ones in the order of the arguments of OP_MOVE */
+enum DriveEvent : uint8_t {
+  EVENT_STOP,
+  EVENT_FORWARD,
+  EVENT_LEFT,
+  EVENT_RIGHT,
+  EVENT_BACKWARDS,
+  EVENT_OBSTACLE,   // an obstacle the car would stop too close to
+  EVENT_AVOIDED,    // the time planned for the avoidance elapsed
+  EVENT_DEADMAN,    // no frame received for DEADMAN_TIMEOUT
+  EVENT_DRIVE,      // a drive command out of the deadzone
+  DRIVE_EVENT_COUNT
+};
+
+/* the state reached from every state (rows) on every event (columns) */
+constexpr DriveState DRIVE_TRANSITIONS[DRIVE_STATE_COUNT][DRIVE_EVENT_COUNT] = {
+  /*                    STOP         FORWARD        LEFT             RIGHT             BACKWARDS      OBSTACLE     AVOIDED           DEADMAN      DRIVE */
+  /* BRAKE */      { DRIVE_BRAKE, DRIVE_FORWARD, DRIVE_TURN_LEFT, DRIVE_TURN_RIGHT, DRIVE_REVERSE, DRIVE_AVOID, DRIVE_BRAKE,      DRIVE_BRAKE, DRIVE_ARC },
+  /* FORWARD */    { DRIVE_BRAKE, DRIVE_FORWARD, DRIVE_TURN_LEFT, DRIVE_TURN_RIGHT, DRIVE_REVERSE, DRIVE_AVOID, DRIVE_FORWARD,    DRIVE_BRAKE, DRIVE_ARC },
+  /* TURN_LEFT */  { DRIVE_BRAKE, DRIVE_FORWARD, DRIVE_TURN_LEFT, DRIVE_TURN_RIGHT, DRIVE_REVERSE, DRIVE_AVOID, DRIVE_TURN_LEFT,  DRIVE_BRAKE, DRIVE_ARC },
+  /* TURN_RIGHT */ { DRIVE_BRAKE, DRIVE_FORWARD, DRIVE_TURN_LEFT, DRIVE_TURN_RIGHT, DRIVE_REVERSE, DRIVE_AVOID, DRIVE_TURN_RIGHT, DRIVE_BRAKE, DRIVE_ARC },
+  /* REVERSE */    { DRIVE_BRAKE, DRIVE_FORWARD, DRIVE_TURN_LEFT, DRIVE_TURN_RIGHT, DRIVE_REVERSE, DRIVE_AVOID, DRIVE_REVERSE,    DRIVE_BRAKE, DRIVE_ARC },
+  /* AVOID */      { DRIVE_BRAKE, DRIVE_FORWARD, DRIVE_TURN_LEFT, DRIVE_TURN_RIGHT, DRIVE_REVERSE, DRIVE_AVOID, DRIVE_BRAKE,      DRIVE_AVOID, DRIVE_ARC },
+  /* ARC */        { DRIVE_BRAKE, DRIVE_FORWARD, DRIVE_TURN_LEFT, DRIVE_TURN_RIGHT, DRIVE_REVERSE, DRIVE_AVOID, DRIVE_ARC,        DRIVE_BRAKE, DRIVE_ARC }
+};
+
+/*
+ * Function that returns the state reached from a state on an event
+ *
+ * @param state - the current state
+ * @param event - the event
+ */
+constexpr DriveState driveTransition(DriveState state, DriveEvent event) {
+  return DRIVE_TRANSITIONS[state][event];
+}
+
+/*
+ * Function that checks the rules every transition table must follow:
+ * - a move command always reaches the state it asks for, even during an obstacle avoidance
+ * - so does a drive command, which always reaches DRIVE_ARC
+ * - an obstacle always starts an avoidance
+ * - only an avoidance ends when its time is up, and it ends braking
+ * - the deadman brakes every state but an avoidance, which ends on its own
+ */
+constexpr bool driveTableIsValid() {
+  for (uint8_t state = 0; state < DRIVE_STATE_COUNT; state++) {
+    for (uint8_t event = EVENT_STOP; event <= EVENT_BACKWARDS; event++) {
+      if (driveTransition((DriveState)state, (DriveEvent)event) != (DriveState)event) {
+        return false;
+      }
+    }
+    if (driveTransition((DriveState)state, EVENT_DRIVE) != DRIVE_ARC) {
+      return false;
+    }
+    if (driveTransition((DriveState)state, EVENT_OBSTACLE) != DRIVE_AVOID) {
+      return false;
+    }
+    if (driveTransition((DriveState)state, EVENT_AVOIDED) != (state == DRIVE_AVOID ? DRIVE_BRAKE : (DriveState)state)) {
+      return false;
+    }
+    if (driveTransition((DriveState)state, EVENT_DEADMAN) != (state == DRIVE_AVOID ? DRIVE_AVOID : DRIVE_BRAKE)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(driveTableIsValid(), "the drive transition table breaks a drive rule");
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+
+/*
+ * Hardware abstraction layer of the car logic
+ *
+ * The car logic (src/car.cpp) only reaches the hardware through these functions. On the ESP32
+ * they are inline wrappers around the Arduino core, so they cost nothing over calling it
+ * directly; in the native build they are implemented by a simulator (src/native/hal_native.cpp)
+ * with a simulated GPIO/ADC/PWM and a virtual clock, so the same logic runs on the host.
+ */
+
+/*
+ * Function that asks the audio task to play a set of sounds (a mask of SOUND_BIT), replacing
+ * the sounds requested before
+ * On the ESP32 it is implemented next to the audio task, in main.cpp
+ *
+ * @param sounds - the sounds to play
+ */
+void halRequestSounds(uint32_t sounds);
+
+/*
+ * Function that asks the main loop to apply the power state chosen by the governor (see power.h)
+ * On the ESP32 it is implemented next to the main loop, in main.cpp
+ *
+ * @param idle - whether the car goes idle
+ * @param since - the time (in microseconds) of the activity waking the car up, for the wake latency
+ */
+void halSetPowerState(bool idle, uint32_t since);
+
+/*
+ * Function that runs a control tick right away instead of at the next slow tick of the idle car,
+ * when a command is received or a client connects
+ * On the ESP32 it is implemented next to the control task, in main.cpp
+ */
+void halWakeControlTick();
+
+#ifdef ARDUINO
+
+#include <Arduino.h>
+#include <stdarg.h>
+#include <soc/gpio_struct.h>
+
+/* the size of the buffer used to format a log message */
+#define HAL_LOG_BUFFER_SIZE 128
+
+inline void halDigitalWrite(uint8_t pin, uint8_t level) {
+  digitalWrite(pin, level);
+}
+
+/*
+ * Function that sets and clears several output pins (0-31) at once, through the GPIO
+ * write-1-to-set and write-1-to-clear registers: one store each, so no other pin is touched and
+ * the pins of a mask all change on the same cycle. The pins are cleared first, so a pin of an
+ * H-bridge never goes high while its partner is still high.
+ *
+ * @param set - the mask of the pins to drive high
+ * @param clear - the mask of the pins to drive low
+ */
+inline void halGpioWrite(uint32_t set, uint32_t clear) {
+  GPIO.out_w1tc = clear;
+  GPIO.out_w1ts = set;
+}
+
+inline uint8_t halDigitalRead(uint8_t pin) {
+  return digitalRead(pin);
+}
+
+inline uint16_t halAnalogRead(uint8_t pin) {
+  return analogRead(pin);
+}
+
+inline void halPwmWrite(uint8_t channel, uint32_t duty) {
+  ledcWrite(channel, duty);
+}
+
+inline uint32_t halMillis() {
+  return millis();
+}
+
+inline uint32_t halMicros() {
+  return micros();
+}
+
+/*
+ * Function that reads the CPU cycle counter, used by the timing probes
+ * Reading it is a single instruction, so the probes can stay enabled; the counter is per core,
+ * so a probe must start and end on the same task
+ */
+inline uint32_t halCycleCount() {
+  return ESP.getCycleCount();
+}
+
+/*
+ * Function that prints a message on the serial monitor
+ *
+ * @param format - printf-style format of the message
+ */
+inline void halLog(const char *format, ...) {
+  char message[HAL_LOG_BUFFER_SIZE];
+  va_list args;
+
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  Serial.print(message);
+}
+
+#else
+
+/* logic levels of the pins, as defined by the Arduino core */
+#define LOW 0x0
+#define HIGH 0x1
+
+/* implemented by the simulator, see src/native/hal_native.cpp */
+void halDigitalWrite(uint8_t pin, uint8_t level);
+void halGpioWrite(uint32_t set, uint32_t clear);
+uint8_t halDigitalRead(uint8_t pin);
+uint16_t halAnalogRead(uint8_t pin);
+void halPwmWrite(uint8_t channel, uint32_t duty);
+uint32_t halMillis();
+uint32_t halMicros();
+uint32_t halCycleCount();
+void halLog(const char *format, ...);
+
+#endif
+
+#endif
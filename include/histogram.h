@@ -0,0 +1,101 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+/*
+ * Fixed-bucket histogram of durations
+ *
+ * Recording a value is a short scan of the bucket bounds and a few additions, with no allocation,
+ * so it is cheap enough for the control tick. Besides the bucket counts it keeps the exact
+ * minimum, maximum and sum, and estimates percentiles from the buckets.
+ */
+
+/* the maximum number of buckets of a histogram (values above the last bound go to an extra bucket) */
+#define HISTOGRAM_MAX_BUCKETS 12
+
+class Histogram {
+  public:
+    /*
+     * @param bounds - the inclusive upper bound of every bucket, in increasing order
+     * @param bucketCount - the number of bounds (at most HISTOGRAM_MAX_BUCKETS)
+     */
+    Histogram(const uint32_t *bounds, uint8_t bucketCount) : bounds(bounds), bucketCount(bucketCount) {
+      reset();
+    }
+
+    /*
+     * Function that clears all the recorded values
+     */
+    void reset() {
+      for (uint8_t i = 0; i <= HISTOGRAM_MAX_BUCKETS; i++) {
+        counts[i] = 0;
+      }
+      count = 0;
+      sum = 0;
+      min = UINT32_MAX;
+      max = 0;
+    }
+
+    /*
+     * Function that records a value
+     *
+     * @param value - the value to record
+     */
+    void record(uint32_t value) {
+      uint8_t bucket = 0;
+      while (bucket < bucketCount && value > bounds[bucket]) {
+        bucket++;
+      }
+
+      counts[bucket]++;
+      count++;
+      sum += value;
+      if (value < min) {
+        min = value;
+      }
+      if (value > max) {
+        max = value;
+      }
+    }
+
+    /*
+     * Function that returns the average of the recorded values
+     */
+    uint32_t mean() const {
+      return count ? (uint32_t)(sum / count) : 0;
+    }
+
+    /*
+     * Function that estimates a percentile of the recorded values
+     * The result is the upper bound of the bucket holding the percentile, or the maximum
+     * if that is smaller or if the percentile falls beyond the last bucket
+     *
+     * @param percent - the percentile (0 - 100)
+     */
+    uint32_t percentile(uint8_t percent) const {
+      if (count == 0) {
+        return 0;
+      }
+
+      uint32_t target = (uint32_t)(((uint64_t)count * percent + 99) / 100);
+      uint32_t cumulative = 0;
+      for (uint8_t bucket = 0; bucket < bucketCount; bucket++) {
+        cumulative += counts[bucket];
+        if (cumulative >= target) {
+          return bounds[bucket] < max ? bounds[bucket] : max;
+        }
+      }
+      return max;
+    }
+
+    const uint32_t *bounds;
+    uint8_t bucketCount;
+    uint32_t counts[HISTOGRAM_MAX_BUCKETS + 1];
+    uint32_t count;
+    uint64_t sum;
+    uint32_t min;
+    uint32_t max;
+};
+
+#endif
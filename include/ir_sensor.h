@@ -0,0 +1,180 @@
+#ifndef IR_SENSOR_H
+#define IR_SENSOR_H
+
+#include <stdint.h>
+
+/*
+ * Distance measurement with the GP2Y0A21YK0F infrared sensor
+ *
+ * The sensor's voltage-to-distance curve (distance = 29.988 * volts^-1.173, see the README) is
+ * evaluated at compile time for every possible ADC reading, so converting a sample at runtime is
+ * a single table lookup instead of a float division and a pow() call. Raw samples are filtered
+ * with a median of several back-to-back reads, which rejects the sensor's isolated spikes, followed
+ * by an exponential moving average, which smooths the remaining noise.
+ */
+
+/* the highest value returned by the 12-bit ADC */
+#define IR_ADC_MAX 4095
+
+/* the ADC reference voltage */
+#define IR_ADC_VOLTAGE 3.3
+
+/* coefficients of the sensor's voltage-to-distance curve */
+#define IR_CURVE_FACTOR 29.988
+#define IR_CURVE_EXPONENT -1.173
+
+/* the distance reported for readings beyond the range of the table (in cm) */
+#define IR_DISTANCE_MAX 255
+
+/* the number of back-to-back reads a sample is the median of (odd, at most 9) */
+#define IR_OVERSAMPLING 5
+
+/* weight of a new sample in the moving average, as a power of two (1/2^IR_EMA_SHIFT) */
+#define IR_EMA_SHIFT 1
+
+/*
+ * Function that computes the natural logarithm of a positive number at compile time
+ *
+ * @param x - the number
+ */
+constexpr double irLog(double x) {
+  /* reduce x to [1, 2) so that the series converges quickly */
+  double exponentTerm = 0.0;
+  while (x >= 2.0) {
+    x /= 2.0;
+    exponentTerm += 0.69314718055994530942;
+  }
+  while (x < 1.0) {
+    x *= 2.0;
+    exponentTerm -= 0.69314718055994530942;
+  }
+
+  /* ln(x) = 2 * atanh((x - 1) / (x + 1)) */
+  double y = (x - 1.0) / (x + 1.0);
+  double y2 = y * y;
+  double term = y;
+  double sum = 0.0;
+  for (int n = 1; n < 40; n += 2) {
+    sum += term / n;
+    term *= y2;
+  }
+
+  return exponentTerm + 2.0 * sum;
+}
+
+/*
+ * Function that computes the exponential of a number at compile time
+ *
+ * @param x - the number
+ */
+constexpr double irExp(double x) {
+  /* reduce x to [-0.5, 0.5] so that the series converges quickly */
+  double scale = 1.0;
+  while (x > 0.5) {
+    x -= 0.69314718055994530942;
+    scale *= 2.0;
+  }
+  while (x < -0.5) {
+    x += 0.69314718055994530942;
+    scale /= 2.0;
+  }
+
+  double term = 1.0;
+  double sum = 1.0;
+  for (int n = 1; n < 20; n++) {
+    term *= x / n;
+    sum += term;
+  }
+
+  return scale * sum;
+}
+
+/*
+ * Function that converts an ADC reading to a distance, the way the sensor was calibrated
+ *
+ * @param adc - the ADC reading (0 - IR_ADC_MAX)
+ * @return the distance in cm, truncated and limited to IR_DISTANCE_MAX
+ */
+constexpr uint8_t irDistanceFromAdc(uint16_t adc) {
+  if (adc == 0) {
+    return IR_DISTANCE_MAX;
+  }
+
+  double volts = (adc * IR_ADC_VOLTAGE) / IR_ADC_MAX;
+  double distance = IR_CURVE_FACTOR * irExp(IR_CURVE_EXPONENT * irLog(volts));
+
+  return distance >= IR_DISTANCE_MAX ? IR_DISTANCE_MAX : (uint8_t)distance;
+}
+
+/* the distance (in cm) for every ADC reading */
+struct IrDistanceTable {
+  uint8_t distance[IR_ADC_MAX + 1];
+
+  constexpr IrDistanceTable() : distance() {
+    for (uint16_t adc = 0; adc <= IR_ADC_MAX; adc++) {
+      distance[adc] = irDistanceFromAdc(adc);
+    }
+  }
+};
+
+/* the table is built by the compiler and stored in flash */
+inline constexpr IrDistanceTable IR_DISTANCE_TABLE;
+
+/*
+ * Function that converts an ADC reading to a distance
+ *
+ * @param adc - the ADC reading (0 - IR_ADC_MAX)
+ * @return the distance in cm
+ */
+inline uint8_t irDistance(uint16_t adc) {
+  return IR_DISTANCE_TABLE.distance[adc > IR_ADC_MAX ? IR_ADC_MAX : adc];
+}
+
+/*
+ * Function that returns the median of a few samples
+ * The samples are sorted in place
+ *
+ * @param samples - the samples
+ * @param count - the number of samples (odd)
+ */
+inline uint16_t irMedian(uint16_t *samples, uint8_t count) {
+  /* insertion sort, the fastest for a handful of samples */
+  for (uint8_t i = 1; i < count; i++) {
+    uint16_t sample = samples[i];
+    int8_t j = i - 1;
+    while (j >= 0 && samples[j] > sample) {
+      samples[j + 1] = samples[j];
+      j--;
+    }
+    samples[j + 1] = sample;
+  }
+
+  return samples[count / 2];
+}
+
+/* state of the moving average of the ADC readings */
+struct IrFilter {
+  uint32_t average; // the average reading, with IR_EMA_SHIFT fractional bits
+  bool primed;      // whether the average holds any sample yet
+};
+
+/*
+ * Function that adds a sample to the moving average
+ *
+ * @param filter - the filter state
+ * @param sample - the new ADC reading
+ * @return the filtered ADC reading
+ */
+inline uint16_t irFilterSample(IrFilter &filter, uint16_t sample) {
+  if (!filter.primed) {
+    filter.average = (uint32_t)sample << IR_EMA_SHIFT;
+    filter.primed = true;
+  } else {
+    /* average += sample - average / 2^IR_EMA_SHIFT, kept scaled by 2^IR_EMA_SHIFT */
+    filter.average += sample - (filter.average >> IR_EMA_SHIFT);
+  }
+
+  return filter.average >> IR_EMA_SHIFT;
+}
+
+#endif
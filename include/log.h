@@ -0,0 +1,199 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "hal.h"
+
+/*
+ * Deferred logging
+ *
+ * Formatting a message and writing it to the UART takes about a millisecond at 115200 baud, far
+ * too long for the network callbacks and the control loop. A log call only stores a binary record
+ * (the id of the message, a timestamp and its numbers) in a lock-free ring buffer; the log task
+ * formats the records and writes them out later, at a low priority. Any task may log: a producer
+ * claims a slot by moving the head with a compare-and-swap and publishes it through the sequence
+ * number of the slot, so no one ever waits on a lock or on the UART, and a record that doesn't
+ * fit is dropped and counted. The messages above LOG_LEVEL are compiled out.
+ */
+
+/* the levels of the messages, from the most to the least important */
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARNING 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+
+/* the least important level logged, lower it with -DLOG_LEVEL=... to compile the rest out */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/* the number of records in the buffer (must be a power of two) */
+#define LOG_BUFFER_SIZE 64
+
+/* the number of arguments a record holds */
+#define LOG_MAX_ARGS 5
+
+/* the size of a formatted message, timestamp included */
+#define LOG_LINE_SIZE 128
+
+/* the messages of the car */
+enum LogMessage : uint8_t {
+  LOG_COMMAND,
+  LOG_QUEUE_FULL,
+  LOG_LEASE,
+  LOG_INVALID_FRAME,
+  LOG_OBSTACLE_BRAKE,
+  LOG_OBSTACLE_REVERSE,
+  LOG_CLIENT_CONNECTED,
+  LOG_CLIENT_DISCONNECTED,
+  LOG_MESSAGE_COUNT
+};
+
+/* the level and the format of a message, the arguments are all printed as 32-bit numbers */
+struct LogFormat {
+  uint8_t level;
+  const char *format;
+};
+
+/* the messages, in the order of LogMessage */
+constexpr LogFormat LOG_FORMATS[LOG_MESSAGE_COUNT] = {
+  { LOG_LEVEL_DEBUG, "command: %u, argument: %u, value: %u" },
+  { LOG_LEVEL_WARNING, "Command queue full, command dropped!" },
+  { LOG_LEVEL_INFO, "WebSocket client #%u holds the driver lease" },
+  { LOG_LEVEL_WARNING, "Client #%u sent an invalid frame (%d)" },
+  { LOG_LEVEL_INFO, "obstacle at %u cm, closing at %d cm/s, would stop at %d cm: braking for %u ms" },
+  { LOG_LEVEL_INFO, "obstacle at %u cm, closing at %d cm/s, would stop at %d cm: reversing for %u ms" },
+  { LOG_LEVEL_INFO, "WebSocket client #%u connected from %u.%u.%u.%u" },
+  { LOG_LEVEL_INFO, "WebSocket client #%u disconnected" }
+};
+
+/* a message waiting to be written out */
+struct LogRecord {
+  uint32_t time; // the time it was logged (in milliseconds)
+  LogMessage message;
+  uint32_t args[LOG_MAX_ARGS];
+};
+
+class LogBuffer {
+  public:
+    LogBuffer() : records(0), dropped(0), written(0), head(0), tail(0) {
+      for (uint32_t i = 0; i < LOG_BUFFER_SIZE; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+      }
+    }
+
+    /*
+     * Function that adds a record to the buffer, from any task
+     * A slot is free for the position p when its sequence number is p, and holds the record of
+     * that position once its sequence number is p + 1
+     *
+     * @param record - the record to add
+     * @return whether the record was added
+     */
+    bool push(const LogRecord &record) {
+      uint32_t position = head.load(std::memory_order_relaxed);
+
+      for (;;) {
+        Slot &slot = slots[position & (LOG_BUFFER_SIZE - 1)];
+        int32_t difference = (int32_t)(slot.sequence.load(std::memory_order_acquire) - position);
+
+        if (difference == 0) {
+          /* the slot is free, claim it (a failed exchange reloads the position) */
+          if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+            slot.record = record;
+            slot.sequence.store(position + 1, std::memory_order_release);
+            records.fetch_add(1, std::memory_order_relaxed);
+            return true;
+          }
+        } else if (difference < 0) {
+          /* the slot still holds the record of the previous lap, the buffer is full */
+          dropped.fetch_add(1, std::memory_order_relaxed);
+          return false;
+        } else {
+          /* another task claimed the slot first */
+          position = head.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    /*
+     * Function that removes the oldest record from the buffer (log task only)
+     * A record claimed but not yet published holds up the ones after it until it is
+     *
+     * @param record - where to store the removed record
+     * @return whether a record was available
+     */
+    bool pop(LogRecord &record) {
+      Slot &slot = slots[tail & (LOG_BUFFER_SIZE - 1)];
+
+      if (slot.sequence.load(std::memory_order_acquire) != tail + 1) {
+        return false;
+      }
+
+      record = slot.record;
+      slot.sequence.store(tail + LOG_BUFFER_SIZE, std::memory_order_release);
+      tail++;
+      written++;
+      return true;
+    }
+
+    /* counters of the buffer */
+    std::atomic<uint32_t> records; // records added
+    std::atomic<uint32_t> dropped; // records dropped because the buffer was full
+    uint32_t written;              // records removed by the log task
+
+  private:
+    struct Slot {
+      std::atomic<uint32_t> sequence;
+      LogRecord record;
+    };
+
+    std::atomic<uint32_t> head; // the position of the next slot to claim, shared by the producers
+    uint32_t tail;              // the position of the next record to remove, owned by the log task
+    Slot slots[LOG_BUFFER_SIZE];
+};
+
+/* the log of the car, defined in car.cpp */
+extern LogBuffer logBuffer;
+
+/*
+ * Function that logs a message without waiting: the arguments are stored as they are and the
+ * message is formatted later by the log task. Compiles to nothing if the message is above LOG_LEVEL
+ *
+ * @param args - the arguments of the message, at most LOG_MAX_ARGS integers
+ */
+template <LogMessage message, typename... Args>
+inline void logEvent(Args... args) {
+  static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many arguments for a log record");
+
+  if constexpr (LOG_FORMATS[message].level <= LOG_LEVEL) {
+    LogRecord record = { halMillis(), message, { (uint32_t)args... } };
+    logBuffer.push(record);
+  }
+}
+
+/*
+ * Function that formats a record as a line of text
+ *
+ * @param record - the record
+ * @param line - where to store the line
+ * @param size - the size of the line, at least LOG_LINE_SIZE
+ */
+inline void formatLogRecord(const LogRecord &record, char *line, size_t size) {
+  const uint32_t *args = record.args;
+  int length = snprintf(line, size, "[%u] ", record.time);
+
+  /* the arguments a message doesn't use are ignored */
+  length += snprintf(line + length, size - length - 1, LOG_FORMATS[record.message].format, args[0], args[1], args[2],
+                     args[3], args[4]);
+  if (length > (int)size - 2) {
+    length = size - 2;
+  }
+  line[length] = '\n';
+  line[length + 1] = '\0';
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fixed-point block mixing kernel
+ *
+ * Voices are mixed one block at a time: every voice is scaled by its Q15 gain and accumulated
+ * in 32 bits, then the sum is saturated back to 16 bits once per sample, so loud voices clip
+ * instead of wrapping around. The kernel has no dependencies, so it can be built and
+ * benchmarked on the host. So can the assignment of the voices to the requested sounds.
+ */
+
+/* the number of samples mixed at once */
+#define MIXER_BLOCK_SIZE 128
+
+/* the gain of a voice played at its original volume (Q15) */
+#define MIXER_UNITY_GAIN 32767
+
+/*
+ * Function that converts a gain from floating point to Q15
+ *
+ * @param gain - the gain, between 0.0 and 1.0
+ */
+inline int16_t mixerGain(float gain) {
+  if (gain <= 0.0f) {
+    return 0;
+  }
+  if (gain >= 1.0f) {
+    return MIXER_UNITY_GAIN;
+  }
+  return (int16_t)(gain * MIXER_UNITY_GAIN);
+}
+
+/*
+ * Function that clamps a 32-bit sample to the 16-bit range
+ *
+ * @param sample - the sample to clamp
+ */
+inline int16_t saturate16(int32_t sample) {
+  if (sample > INT16_MAX) {
+    return INT16_MAX;
+  }
+  if (sample < INT16_MIN) {
+    return INT16_MIN;
+  }
+  return (int16_t)sample;
+}
+
+/*
+ * Function that mixes a block of samples from several voices
+ *
+ * @param output - where to store the mixed samples
+ * @param voices - the sample blocks of the voices
+ * @param gains - the Q15 gain of every voice
+ * @param voiceCount - the number of voices
+ * @param length - the number of samples in the block (at most MIXER_BLOCK_SIZE)
+ */
+inline void mixBlock(int16_t *output, const int16_t *const *voices, const int16_t *gains, uint8_t voiceCount, uint16_t length) {
+  int32_t accumulator[MIXER_BLOCK_SIZE];
+
+  for (uint16_t i = 0; i < length; i++) {
+    accumulator[i] = 0;
+  }
+
+  /* accumulate one voice at a time, so the inner loop stays a plain multiply-add over the block */
+  for (uint8_t voice = 0; voice < voiceCount; voice++) {
+    const int16_t *samples = voices[voice];
+    int32_t gain = gains[voice];
+
+    for (uint16_t i = 0; i < length; i++) {
+      accumulator[i] += (samples[i] * gain) >> 15;
+    }
+  }
+
+  for (uint16_t i = 0; i < length; i++) {
+    output[i] = saturate16(accumulator[i]);
+  }
+}
+
+/*
+ * Function that assigns the voices to the requested sounds
+ * When more sounds are requested than there are voices, the highest priority ones (the highest
+ * sound numbers) are played: a voice playing a sound left out is stopped and given to a higher
+ * priority one. A sound already playing keeps its voice, so it doesn't restart.
+ *
+ * @param voices - the voices, each with the sound it plays in `sound` (-1 if the voice is free)
+ * @param voiceCount - the number of voices
+ * @param requested - the mask of requested sounds
+ * @param soundCount - the number of sounds
+ * @param stop - the function that stops a voice and frees it
+ * @param start - the function that starts a sound on a free voice
+ * @return the number of requested sounds left out
+ */
+template<typename VoiceType, typename Stop, typename Start>
+inline uint8_t assignMixerVoices(VoiceType *voices, uint8_t voiceCount, uint32_t requested, uint8_t soundCount, Stop stop,
+                                 Start start) {
+  uint32_t selected = 0;
+  uint8_t available = voiceCount;
+  uint8_t leftOut = 0;
+
+  /* select the highest priority requested sounds */
+  for (int8_t sound = soundCount - 1; sound >= 0; sound--) {
+    if (requested & ((uint32_t)1 << sound)) {
+      if (available > 0) {
+        selected |= (uint32_t)1 << sound;
+        available--;
+      } else {
+        leftOut++;
+      }
+    }
+  }
+
+  /* free the voices playing sounds that are no longer selected */
+  for (uint8_t i = 0; i < voiceCount; i++) {
+    if (voices[i].sound >= 0 && !(selected & ((uint32_t)1 << voices[i].sound))) {
+      stop(voices[i]);
+    }
+  }
+
+  /* start the selected sounds that aren't playing yet on the free voices */
+  for (int8_t sound = soundCount - 1; sound >= 0; sound--) {
+    if (!(selected & ((uint32_t)1 << sound))) {
+      continue;
+    }
+
+    VoiceType *freeVoice = NULL;
+    bool playing = false;
+    for (uint8_t i = 0; i < voiceCount; i++) {
+      if (voices[i].sound == sound) {
+        playing = true;
+      } else if (voices[i].sound < 0 && freeVoice == NULL) {
+        freeVoice = &voices[i];
+      }
+    }
+
+    if (!playing && freeVoice != NULL) {
+      start(*freeVoice, sound);
+    }
+  }
+
+  return leftOut;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef MOTOR_RAMP_H
+#define MOTOR_RAMP_H
+
+#include <stdint.h>
+
+/*
+ * Slew-rate limited motor command
+ *
+ * A pair of motors is commanded with a signed duty: positive spins them forward, negative
+ * backwards, and the magnitude is the PWM duty. At every control tick the applied duty moves
+ * towards the target by at most one acceleration step when speeding up, or one deceleration step
+ * when slowing down. A change of direction first ramps down to zero and stops there for the
+ * tick, so the H-bridge direction pins are only ever flipped while the motors are unpowered.
+ */
+
+/* a pair of motors being ramped */
+struct MotorRamp {
+  int32_t duty;   // the signed duty currently applied
+  int32_t target; // the signed duty requested
+};
+
+/*
+ * Function that returns the direction of a signed duty
+ *
+ * @param duty - the signed duty
+ * @return 1 (forward), -1 (backwards) or 0 (stopped)
+ */
+inline int8_t motorDirection(int32_t duty) {
+  return (duty > 0) - (duty < 0);
+}
+
+/*
+ * Function that moves the applied duty one step towards the target
+ *
+ * @param ramp - the ramp to update
+ * @param accelerationStep - the largest increase of the duty's magnitude in one step
+ * @param decelerationStep - the largest decrease of the duty's magnitude in one step
+ * @return the new applied duty
+ */
+inline int32_t stepMotorRamp(MotorRamp &ramp, int32_t accelerationStep, int32_t decelerationStep) {
+  int8_t direction = motorDirection(ramp.duty);
+  int8_t targetDirection = motorDirection(ramp.target);
+  int32_t magnitude = direction * ramp.duty;
+
+  /* reversing: slow down to zero first, without crossing it in the same step */
+  if (direction != 0 && targetDirection != direction) {
+    magnitude = magnitude > decelerationStep ? magnitude - decelerationStep : 0;
+    ramp.duty = direction * magnitude;
+    return ramp.duty;
+  }
+
+  /* same direction (or starting from zero): speed up or slow down towards the target */
+  int32_t targetMagnitude = targetDirection * ramp.target;
+  if (targetMagnitude > magnitude) {
+    magnitude = (targetMagnitude - magnitude > accelerationStep) ? magnitude + accelerationStep : targetMagnitude;
+  } else {
+    magnitude = (magnitude - targetMagnitude > decelerationStep) ? magnitude - decelerationStep : targetMagnitude;
+  }
+
+  ramp.duty = targetDirection * magnitude;
+  return ramp.duty;
+}
+
+#endif
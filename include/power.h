@@ -0,0 +1,109 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdint.h>
+
+/*
+ * Power governor
+ *
+ * The car spends most of its time parked, with the CPU at full clock and the radio awake for
+ * nothing. The governor is updated at every control tick with whether anything needs them: the
+ * motors turning, a sound playing, or a client that connected or sent a command in the last
+ * POWER_IDLE_TIMEOUT. Once nothing has for POWER_IDLE_DELAY the car goes idle (lower CPU clock,
+ * modem sleep, the main loop blocking on events, the control tick every POWER_IDLE_TICK_INTERVAL),
+ * and the first tick something does again it goes back to active: a command or a connection runs
+ * that tick right away (halWakeControlTick), and the control tick is back at its full rate. The governor only decides; the power state is applied by main.cpp
+ * through halSetPowerState.
+ */
+
+/* the time nothing must need the car before it goes idle (in milliseconds) */
+#define POWER_IDLE_DELAY 2000
+
+/* the time a connected client keeps the car active after its last command (in milliseconds) */
+#define POWER_IDLE_TIMEOUT 30000
+
+/* the CPU clock while the car is active, and while it is idle: 80 MHz is the lowest clock that
+ * keeps the APB clock of the timers, the LEDC and the UART at 80 MHz */
+#define POWER_ACTIVE_CPU_MHZ 240
+#define POWER_IDLE_CPU_MHZ 80
+
+/* the period of the control tick while the car is idle (in microseconds): the motors are stopped
+ * and no sound plays, so the tick only has the governor, the deadman and the sensor to watch */
+#define POWER_IDLE_TICK_INTERVAL 100000
+
+/* the power states */
+enum PowerState : uint8_t {
+  POWER_ACTIVE,
+  POWER_IDLE
+};
+
+/* the state and the statistics of the governor */
+struct PowerGovernor {
+  PowerState state;
+  uint32_t lastBusyTime;    // the last time something needed the car (in milliseconds)
+  uint32_t lastUpdateTime;  // the time of the last update (in milliseconds)
+  uint32_t activeTime;      // the time spent active (in milliseconds)
+  uint32_t idleTime;        // the time spent idle (in milliseconds)
+  uint32_t idlePeriods;     // the number of times the car went idle
+  uint32_t lastWakeLatency; // the time from the activity that woke the car up to the full clock (in microseconds)
+  uint32_t maxWakeLatency;  // the longest of these times (in microseconds)
+};
+
+/*
+ * Function that updates the governor
+ *
+ * @param governor - the governor
+ * @param busy - whether anything needs the car now
+ * @param now - the current time (in milliseconds)
+ * @return whether the power state changed
+ */
+inline bool powerUpdate(PowerGovernor &governor, bool busy, uint32_t now) {
+  uint32_t elapsed = now - governor.lastUpdateTime;
+  governor.lastUpdateTime = now;
+  if (governor.state == POWER_ACTIVE) {
+    governor.activeTime += elapsed;
+  } else {
+    governor.idleTime += elapsed;
+  }
+
+  if (busy) {
+    governor.lastBusyTime = now;
+  }
+
+  PowerState state = busy ? POWER_ACTIVE : now - governor.lastBusyTime >= POWER_IDLE_DELAY ? POWER_IDLE : governor.state;
+  if (state == governor.state) {
+    return false;
+  }
+
+  governor.state = state;
+  if (state == POWER_IDLE) {
+    governor.idlePeriods++;
+  }
+  return true;
+}
+
+/*
+ * Function that records how long the car took to get back to full clock
+ *
+ * @param governor - the governor
+ * @param latency - the time from the activity that woke it up (in microseconds)
+ */
+inline void powerRecordWake(PowerGovernor &governor, uint32_t latency) {
+  governor.lastWakeLatency = latency;
+  if (latency > governor.maxWakeLatency) {
+    governor.maxWakeLatency = latency;
+  }
+}
+
+/*
+ * Function that returns the share of the time the car was active
+ *
+ * @param governor - the governor
+ * @return the duty cycle (in percent)
+ */
+inline uint32_t powerDutyCycle(const PowerGovernor &governor) {
+  uint64_t total = (uint64_t)governor.activeTime + governor.idleTime;
+  return total > 0 ? (uint32_t)(governor.activeTime * 100ULL / total) : 100;
+}
+
+#endif
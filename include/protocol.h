@@ -0,0 +1,255 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Binary control protocol used between the web interface and the car
+ *
+ * Every WebSocket message carries one frame, laid out as follows (little-endian):
+ *
+ *   offset 0: protocol version (PROTOCOL_VERSION)
+ *   offset 1: number of commands in the frame (0..MAX_COMMANDS_PER_FRAME, 0 for a keepalive frame)
+ *   offset 2: sequence number of the frame (uint16), incremented by the client for every frame
+ *   offset 4: commands, COMMAND_SIZE bytes each:
+ *               - opcode (uint8)
+ *               - argument (uint8)
+ *               - value (uint16)
+ *
+ * Clients send keepalive frames while they have nothing else to send, so that the car can tell
+ * a quiet link from a dead one.
+ *
+ * Frames whose sequence number is not newer than the last accepted one are stale (duplicated or
+ * reordered) and are dropped as a whole, so an old command can never override a newer one.
+ *
+ * A client connected to the WebSocket can also send its frames as UDP datagrams, which a lost
+ * packet doesn't hold up the way a lost TCP segment holds up every later message:
+ *
+ *   offset 0: the id of the client (uint32), as given by the lease message
+ *   offset 4: a frame, numbered in the same sequence as the client's WebSocket frames
+ *
+ * A lost datagram is never sent again, so every datagram should carry the whole control state
+ * (move or drive, speed, activate): the next one makes up for it, and a late one is dropped as stale.
+ *
+ * Only one client, the driver, holds the lease to control the car; the other clients are
+ * spectators, whose commands are dropped except for OP_LEASE. Whenever the lease changes or a
+ * client connects or disconnects, the car sends every client a lease message:
+ *
+ *   offset 0: message type (MSG_LEASE)
+ *   offset 1: the role of the client (ROLE_SPECTATOR or ROLE_DRIVER)
+ *   offset 2: the id of the client (uint32)
+ *   offset 6: the id of the driver (uint32), 0 if there is none
+ *   offset 10: the number of the other connected clients
+ *   offset 11: their ids (uint32 each), for the driver to pick one to hand the lease off to
+ *
+ * The ids are those the web server gives the connections, 32 bits wide. A handoff names the new
+ * driver by the low 16 bits of its id, in the value of its command; it is refused if they match
+ * no connected client or more than one, so the lease never goes to a client that wasn't meant.
+ */
+
+/* version of the frame format */
+#define PROTOCOL_VERSION 1
+
+/* size of the frame header in bytes */
+#define FRAME_HEADER_SIZE 4
+
+/* size of one command in bytes */
+#define COMMAND_SIZE 4
+
+/* the maximum number of commands batched in one frame */
+#define MAX_COMMANDS_PER_FRAME 8
+
+/* the maximum size of a frame in bytes */
+#define MAX_FRAME_SIZE (FRAME_HEADER_SIZE + MAX_COMMANDS_PER_FRAME * COMMAND_SIZE)
+
+/* the size of the header of a UDP datagram (the client id) and the maximum size of a datagram in bytes */
+#define DATAGRAM_HEADER_SIZE 4
+#define MAX_DATAGRAM_SIZE (DATAGRAM_HEADER_SIZE + MAX_FRAME_SIZE)
+
+/* opcodes of the commands given to the car */
+#define OP_MOVE 1     // argument: direction (STOP_WHEELS, MOVE_FORWARD, ...)
+#define OP_SPEED 2    // value: speed (127-255)
+#define OP_ACTIVATE 3 // argument: feature to activate (0 deactivates it)
+#define OP_TOGGLE 4   // argument: feature to toggle
+#define OP_LEASE 5    // argument: LEASE_*, value: the low 16 bits of the id of the client to hand the lease off to
+#define OP_DRIVE 6    // argument: steer (int8), value: throttle (int16), both -DRIVE_AXIS_MAX - DRIVE_AXIS_MAX
+
+/* arguments of OP_LEASE */
+#define LEASE_RELEASE 0 // the driver gives up the lease
+#define LEASE_ACQUIRE 1 // take the lease, if nobody holds it or the driver went quiet
+#define LEASE_HANDOFF 2 // the driver gives the lease to another client
+
+/* type of the lease message sent by the car */
+#define MSG_LEASE 0x81
+
+/* the size of a lease message without its list of clients, and of a client in the list */
+#define LEASE_MESSAGE_SIZE 11
+#define LEASE_CLIENT_SIZE 4
+
+/* the size of a lease message listing a number of clients */
+#define MAX_LEASE_MESSAGE_SIZE(clients) (LEASE_MESSAGE_SIZE + (clients) * LEASE_CLIENT_SIZE)
+
+/* roles of a client in a lease message */
+#define ROLE_SPECTATOR 0
+#define ROLE_DRIVER 1
+
+/* results of decoding a frame */
+enum DecodeResult {
+  DECODE_OK,
+  DECODE_BAD_LENGTH,
+  DECODE_BAD_VERSION,
+  DECODE_STALE
+};
+
+/* a single decoded command */
+struct ControlCommand {
+  uint8_t opcode;
+  uint8_t arg;
+  uint16_t value;
+};
+
+/* per-connection decoder state */
+struct FrameDecoder {
+  uint16_t lastSequence; // sequence number of the last accepted frame
+  bool synced;           // whether any frame has been accepted yet
+  uint32_t acceptedFrames;
+  uint32_t staleFrames;
+  uint32_t malformedFrames;
+};
+
+/*
+ * Function that resets the state of a decoder, e.g. when a new client connects
+ *
+ * @param decoder - the decoder to reset
+ */
+inline void resetFrameDecoder(FrameDecoder &decoder) {
+  decoder.lastSequence = 0;
+  decoder.synced = false;
+  decoder.acceptedFrames = 0;
+  decoder.staleFrames = 0;
+  decoder.malformedFrames = 0;
+}
+
+/*
+ * Function that reads a little-endian 16-bit value
+ *
+ * @param data - pointer to the first byte of the value
+ */
+inline uint16_t readUint16(const uint8_t *data) {
+  return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+/*
+ * Function that writes a little-endian 16-bit value
+ *
+ * @param data - pointer to the first byte of the value
+ * @param value - the value to write
+ */
+inline void writeUint16(uint8_t *data, uint16_t value) {
+  data[0] = value & 0xFF;
+  data[1] = value >> 8;
+}
+
+/*
+ * Function that reads a little-endian 32-bit value
+ *
+ * @param data - pointer to the first byte of the value
+ */
+inline uint32_t readUint32(const uint8_t *data) {
+  return (uint32_t)readUint16(data) | ((uint32_t)readUint16(data + 2) << 16);
+}
+
+/*
+ * Function that writes a little-endian 32-bit value
+ *
+ * @param data - pointer to the first byte of the value
+ * @param value - the value to write
+ */
+inline void writeUint32(uint8_t *data, uint32_t value) {
+  writeUint16(data, value & 0xFFFF);
+  writeUint16(data + 2, value >> 16);
+}
+
+/*
+ * Function that checks whether a sequence number is newer than another one,
+ * taking the wrap-around of the 16-bit counter into account
+ *
+ * @param sequence - the sequence number to check
+ * @param reference - the sequence number to compare against
+ */
+inline bool isNewerSequence(uint16_t sequence, uint16_t reference) {
+  return (int16_t)(sequence - reference) > 0;
+}
+
+/*
+ * Function that validates a frame and passes each of its commands to a handler, in order
+ * The frame is decoded in place, without any allocation or copy
+ *
+ * @param decoder - the decoder state of the connection the frame was received on
+ * @param data - the received frame
+ * @param len - the length of the frame
+ * @param handler - callable invoked as handler(const ControlCommand&) for every command
+ */
+template <typename Handler>
+DecodeResult decodeFrame(FrameDecoder &decoder, const uint8_t *data, size_t len, Handler &&handler) {
+  /* the frame must hold a header followed by exactly the announced number of commands */
+  if (len < FRAME_HEADER_SIZE || len > MAX_FRAME_SIZE) {
+    decoder.malformedFrames++;
+    return DECODE_BAD_LENGTH;
+  }
+
+  if (data[0] != PROTOCOL_VERSION) {
+    decoder.malformedFrames++;
+    return DECODE_BAD_VERSION;
+  }
+
+  uint8_t count = data[1];
+  if (len != FRAME_HEADER_SIZE + (size_t)count * COMMAND_SIZE) {
+    decoder.malformedFrames++;
+    return DECODE_BAD_LENGTH;
+  }
+
+  /* drop duplicated or out-of-order frames */
+  uint16_t sequence = readUint16(data + 2);
+  if (decoder.synced && !isNewerSequence(sequence, decoder.lastSequence)) {
+    decoder.staleFrames++;
+    return DECODE_STALE;
+  }
+  decoder.lastSequence = sequence;
+  decoder.synced = true;
+  decoder.acceptedFrames++;
+
+  const uint8_t *command = data + FRAME_HEADER_SIZE;
+  for (uint8_t i = 0; i < count; i++, command += COMMAND_SIZE) {
+    ControlCommand decoded = { command[0], command[1], readUint16(command + 2) };
+    handler(decoded);
+  }
+
+  return DECODE_OK;
+}
+
+/*
+ * Function that encodes the lease message sent to a client
+ *
+ * @param data - where to write the message (at least MAX_LEASE_MESSAGE_SIZE(clientCount) bytes)
+ * @param clientId - the id of the client the message is sent to
+ * @param driverId - the id of the driver, 0 if there is none
+ * @param clients - the ids of the other connected clients
+ * @param clientCount - the number of the other connected clients
+ * @return the size of the message
+ */
+inline size_t encodeLeaseMessage(uint8_t *data, uint32_t clientId, uint32_t driverId, const uint32_t *clients,
+                                 uint8_t clientCount) {
+  data[0] = MSG_LEASE;
+  data[1] = (clientId == driverId) ? ROLE_DRIVER : ROLE_SPECTATOR;
+  writeUint32(data + 2, clientId);
+  writeUint32(data + 6, driverId);
+  data[10] = clientCount;
+  for (uint8_t i = 0; i < clientCount; i++) {
+    writeUint32(data + LEASE_MESSAGE_SIZE + i * LEASE_CLIENT_SIZE, clients[i]);
+  }
+  return MAX_LEASE_MESSAGE_SIZE(clientCount);
+}
+
+#endif
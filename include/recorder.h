@@ -0,0 +1,214 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "telemetry.h"
+
+/*
+ * Drive-session recorder
+ *
+ * The control tick records its inputs (the commands it applies, the infrared samples, the link
+ * activity) and its outputs (the motors' duty, the lights) in a compact binary log. A log
+ * starts with a header (RECORDER_MAGIC, RECORDER_VERSION, the control tick period) followed by
+ * records laid out as:
+ *
+ *   type (RECORD_*), ticks since the previous record (varint), payload (varints, see below)
+ *
+ * where every varint is zigzag-encoded like in the telemetry frames (see telemetry.h).
+ *
+ * Records are appended to one of two buffers while the other one is written out by a separate
+ * task, so the producer never waits for the storage: when both buffers are busy the record is
+ * dropped and counted instead.
+ */
+
+/* the first bytes of a log file */
+#define RECORDER_MAGIC "CARLOG"
+#define RECORDER_MAGIC_SIZE 6
+#define RECORDER_VERSION 1
+
+/* the maximum size of a log header */
+#define RECORDER_HEADER_SIZE (RECORDER_MAGIC_SIZE + 1 + 5)
+
+/* the size of each of the two buffers */
+#define RECORDER_BUFFER_SIZE 4096
+
+/* the maximum size of a record (type, tick delta and four varints) */
+#define RECORD_MAX_SIZE (1 + 5 + 4 * 5)
+
+/* types of the records */
+#define RECORD_START 1      // recording started: absolute tick, time (in milliseconds)
+#define RECORD_COMMAND 2    // command applied: opcode, argument, value, queueing latency (in microseconds)
+#define RECORD_IR_SAMPLE 3  // infrared sensor read: the median ADC reading
+#define RECORD_MOTORS 4     // duty of a pair of motors changed: motors, signed duty
+#define RECORD_LIGHTS 5     // lights changed: headlights, taillights
+#define RECORD_LINK 6       // a frame was received: time since it was received at the start of the tick (in milliseconds)
+
+/* recorder statistics */
+struct RecorderStats {
+  uint32_t records;       // records accepted
+  uint32_t droppedRecords; // records dropped because both buffers were busy
+  uint32_t bytesWritten;  // bytes handed to the storage
+  uint32_t lastWriteTime; // duration of the last buffer write (in microseconds)
+  uint32_t maxWriteTime;  // the longest buffer write (in microseconds)
+};
+
+/*
+ * Function that reads a zigzag-encoded varint written by writeVarint
+ *
+ * @param data - the data to read from
+ * @param length - the number of bytes available
+ * @param value - where to store the value
+ * @return the number of bytes read, or 0 if the varint is truncated or too long
+ */
+inline size_t readVarint(const uint8_t *data, size_t length, int32_t &value) {
+  uint32_t encoded = 0;
+
+  for (size_t i = 0; i < length && i < 5; i++) {
+    encoded |= (uint32_t)(data[i] & 0x7F) << (7 * i);
+    if (!(data[i] & 0x80)) {
+      value = (int32_t)(encoded >> 1) ^ -(int32_t)(encoded & 1);
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Function that writes the header of a log
+ *
+ * @param data - where to write the header (at least RECORDER_HEADER_SIZE bytes)
+ * @param tickInterval - the period of the control tick (in microseconds)
+ * @return the size of the header
+ */
+inline size_t writeLogHeader(uint8_t *data, uint32_t tickInterval) {
+  memcpy(data, RECORDER_MAGIC, RECORDER_MAGIC_SIZE);
+  data[RECORDER_MAGIC_SIZE] = RECORDER_VERSION;
+  return RECORDER_MAGIC_SIZE + 1 + writeVarint(data + RECORDER_MAGIC_SIZE + 1, tickInterval);
+}
+
+/*
+ * Function that reads the header of a log
+ *
+ * @param data - the beginning of the log
+ * @param length - the number of bytes available
+ * @param tickInterval - where to store the period of the control tick (in microseconds)
+ * @return the size of the header, or 0 if it isn't a log this version can read
+ */
+inline size_t readLogHeader(const uint8_t *data, size_t length, int32_t &tickInterval) {
+  if (length < RECORDER_MAGIC_SIZE + 2 || memcmp(data, RECORDER_MAGIC, RECORDER_MAGIC_SIZE) != 0 ||
+      data[RECORDER_MAGIC_SIZE] != RECORDER_VERSION) {
+    return 0;
+  }
+
+  size_t read = readVarint(data + RECORDER_MAGIC_SIZE + 1, length - RECORDER_MAGIC_SIZE - 1, tickInterval);
+  return read ? RECORDER_MAGIC_SIZE + 1 + read : 0;
+}
+
+/*
+ * Double-buffered record log, with a single producer and a single consumer
+ */
+class Recorder {
+  public:
+    Recorder() : stats(), enabled(false), active(0), lastTick(0), handedOver(-1) {
+      lengths[0] = 0;
+      lengths[1] = 0;
+    }
+
+    /*
+     * Function that appends a record (producer only)
+     *
+     * @param type - the type of the record (RECORD_*)
+     * @param tick - the control tick the record belongs to
+     * @param values - the payload of the record
+     * @param count - the number of values in the payload (at most 4)
+     * @return whether the record was accepted
+     */
+    bool record(uint8_t type, uint32_t tick, const int32_t *values, uint8_t count) {
+      if (!enabled) {
+        return false;
+      }
+
+      /* the active buffer is full, hand it over and continue in the other one */
+      if (lengths[active] + RECORD_MAX_SIZE > RECORDER_BUFFER_SIZE && !handOver()) {
+        stats.droppedRecords++;
+        return false;
+      }
+
+      uint8_t *data = buffers[active] + lengths[active];
+      size_t length = 0;
+      data[length++] = type;
+      length += writeVarint(data + length, tick - lastTick);
+      for (uint8_t i = 0; i < count; i++) {
+        length += writeVarint(data + length, values[i]);
+      }
+
+      lengths[active] += length;
+      lastTick = tick;
+      stats.records++;
+      return true;
+    }
+
+    /*
+     * Function that hands the active buffer over to the consumer, even if it isn't full yet,
+     * so that the records reach the storage during quiet periods too (producer only)
+     *
+     * @return whether the buffer was handed over (false if it is empty or the consumer is busy)
+     */
+    bool handOver() {
+      if (lengths[active] == 0 || handedOver.load(std::memory_order_acquire) >= 0) {
+        return false;
+      }
+
+      handedOver.store(active, std::memory_order_release);
+      active ^= 1;
+      lengths[active] = 0;
+      return true;
+    }
+
+    /*
+     * Function that returns the buffer handed over to the consumer, if any (consumer only)
+     *
+     * @param length - where to store the length of the buffer
+     * @return the buffer, or NULL if there is none
+     */
+    const uint8_t* pending(size_t &length) {
+      int8_t buffer = handedOver.load(std::memory_order_acquire);
+      if (buffer < 0) {
+        return NULL;
+      }
+
+      length = lengths[buffer];
+      return buffers[buffer];
+    }
+
+    /*
+     * Function that gives the buffer returned by pending back to the producer (consumer only)
+     *
+     * @param writeTime - the time it took to write it (in microseconds)
+     */
+    void release(uint32_t writeTime) {
+      int8_t buffer = handedOver.load(std::memory_order_relaxed);
+      stats.bytesWritten += lengths[buffer];
+      stats.lastWriteTime = writeTime;
+      if (writeTime > stats.maxWriteTime) {
+        stats.maxWriteTime = writeTime;
+      }
+
+      handedOver.store(-1, std::memory_order_release);
+    }
+
+    RecorderStats stats;
+    bool enabled; // records are ignored until the log is ready
+
+  private:
+    uint8_t buffers[2][RECORDER_BUFFER_SIZE];
+    size_t lengths[2];
+    uint8_t active;                // the buffer the producer appends to
+    uint32_t lastTick;             // the tick of the last record
+    std::atomic<int8_t> handedOver; // the buffer owned by the consumer, -1 if none
+};
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stdint.h>
+#include "mixer.h"
+
+/*
+ * Procedural sound synthesizer
+ *
+ * A sound is the sum of the first harmonics of a fundamental read from a sine wavetable through a
+ * 32-bit phase accumulator, in fixed-point arithmetic and one block at a time, so it needs no
+ * audio file and no SD card access. A patch describes the sound: its pitch and its harmonics move
+ * with a load (0 - SYNTH_LOAD_MAX, the duty of the motors for the engine), the amplitude can pulse
+ * at half the fundamental like the firing of the cylinders, and the sound can be gated on and off
+ * like a beeper. The pitch glides towards its target, and the gating and the start of a sound
+ * fade over SYNTH_FADE_TIME, so neither clicks.
+ */
+
+/* the number of entries of the sine wavetable, a power of 2 */
+#define SYNTH_TABLE_BITS 8
+#define SYNTH_TABLE_SIZE (1 << SYNTH_TABLE_BITS)
+
+/* the number of harmonics of a patch */
+#define SYNTH_HARMONICS 3
+
+/* the full load */
+#define SYNTH_LOAD_MAX 32767
+
+/* the pitch moves by 1 / 2^SYNTH_GLIDE_SHIFT of the way to its target every block */
+#define SYNTH_GLIDE_SHIFT 2
+
+/* the time for the amplitude to go from silent to full when a sound starts or a gate opens (in milliseconds) */
+#define SYNTH_FADE_TIME 3
+
+/* a sine wavetable in Q15 */
+struct SineTable {
+  int16_t values[SYNTH_TABLE_SIZE];
+};
+
+/*
+ * Function that approximates the sine with its Taylor series, precise enough for 16-bit samples
+ *
+ * @param x - the angle, between -pi and pi
+ */
+constexpr double taylorSine(double x) {
+  double term = x;
+  double sum = x;
+  for (int n = 1; n < 12; n++) {
+    term *= -x * x / ((2 * n) * (2 * n + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+/*
+ * Function that builds the sine wavetable at compile time
+ */
+constexpr SineTable makeSineTable() {
+  SineTable table = {};
+  const double pi = 3.14159265358979323846;
+  for (int i = 0; i < SYNTH_TABLE_SIZE; i++) {
+    double x = 2 * pi * i / SYNTH_TABLE_SIZE;
+    double sine = taylorSine(x > pi ? x - 2 * pi : x) * 32767;
+    table.values[i] = (int16_t)(sine >= 0 ? sine + 0.5 : sine - 0.5);
+  }
+  return table;
+}
+
+constexpr SineTable SYNTH_SINE = makeSineTable();
+
+/* the description of a synthesized sound */
+struct SynthPatch {
+  int32_t minFrequency;                  // the fundamental at no load (in 1/256 Hz)
+  int32_t maxFrequency;                  // the fundamental at full load (in 1/256 Hz)
+  int16_t harmonics[SYNTH_HARMONICS];    // the amplitude of the fundamental and the next harmonics at no load (Q15)
+  int16_t loadHarmonics[SYNTH_HARMONICS]; // the amplitude they gain at full load (Q15)
+  int16_t pulseDepth;                    // the depth of the modulation at half the fundamental (Q15), 0 for none
+  uint16_t gatePeriod;                   // the period of the on/off gating, on for the first half (in milliseconds), 0 for none
+};
+
+/* the state of a synthesized sound */
+struct Synth {
+  const SynthPatch *patch;
+  uint32_t phase;     // the phase of the fundamental (a full turn is 2^32)
+  uint32_t subPhase;  // the phase of the pulse, at half the fundamental
+  int32_t frequency;  // the current fundamental (in 1/256 Hz), gliding towards the target
+  int32_t envelope;   // the current amplitude (Q15)
+  uint32_t gateTime;  // the samples played since the gate last opened
+};
+
+/*
+ * Function that starts a synthesized sound
+ *
+ * @param synth - the state of the sound
+ * @param patch - the description of the sound
+ * @param load - the load the sound starts at (0 - SYNTH_LOAD_MAX)
+ */
+inline void synthStart(Synth &synth, const SynthPatch *patch, int32_t load) {
+  synth.patch = patch;
+  synth.phase = 0;
+  synth.subPhase = 0;
+  synth.frequency = patch->minFrequency + (int32_t)((int64_t)(patch->maxFrequency - patch->minFrequency) * load / SYNTH_LOAD_MAX);
+  synth.envelope = 0;
+  synth.gateTime = 0;
+}
+
+/*
+ * Function that synthesizes a block of samples
+ *
+ * @param synth - the state of the sound
+ * @param load - the current load (0 - SYNTH_LOAD_MAX)
+ * @param rate - the sample rate (in hertz)
+ * @param samples - where to store the samples
+ * @param length - the number of samples (at most MIXER_BLOCK_SIZE)
+ */
+inline void synthBlock(Synth &synth, int32_t load, uint32_t rate, int16_t *samples, uint16_t length) {
+  const SynthPatch &patch = *synth.patch;
+  load = load < 0 ? 0 : load > SYNTH_LOAD_MAX ? SYNTH_LOAD_MAX : load;
+
+  /* everything that only depends on the load is worked out once per block */
+  int32_t target = patch.minFrequency + (int32_t)((int64_t)(patch.maxFrequency - patch.minFrequency) * load / SYNTH_LOAD_MAX);
+  synth.frequency += (target - synth.frequency) >> SYNTH_GLIDE_SHIFT;
+  uint32_t increment = (uint32_t)(((uint64_t)synth.frequency << 24) / rate); // 2^32 * frequency / 256 / rate
+
+  int32_t amplitudes[SYNTH_HARMONICS];
+  for (uint8_t h = 0; h < SYNTH_HARMONICS; h++) {
+    amplitudes[h] = patch.harmonics[h] + ((patch.loadHarmonics[h] * load) >> 15);
+  }
+
+  int32_t fadeStep = (int32_t)(MIXER_UNITY_GAIN * 1000 / (rate * SYNTH_FADE_TIME)) + 1;
+  uint32_t gateLength = (uint32_t)patch.gatePeriod * rate / 1000;
+
+  for (uint16_t i = 0; i < length; i++) {
+    /* the harmonics are read at 2 and 3 times the phase, the overflow wraps them around the table */
+    int32_t sample = 0;
+    for (uint8_t h = 0; h < SYNTH_HARMONICS; h++) {
+      uint32_t phase = synth.phase * (h + 1);
+      sample += (amplitudes[h] * SYNTH_SINE.values[phase >> (32 - SYNTH_TABLE_BITS)]) >> 15;
+    }
+    sample = saturate16(sample); // a patch louder than full scale clips, and the products below stay within 32 bits
+
+    /* pulse between 1 - depth and 1 */
+    if (patch.pulseDepth > 0) {
+      int32_t pulse = SYNTH_SINE.values[synth.subPhase >> (32 - SYNTH_TABLE_BITS)] + 32767; // 0 - 2^16
+      sample = (sample * (MIXER_UNITY_GAIN - patch.pulseDepth + ((patch.pulseDepth * pulse) >> 16))) >> 15;
+      synth.subPhase += increment >> 1;
+    }
+
+    /* fade in while the gate is open, out while it is closed */
+    bool open = gateLength == 0 || synth.gateTime < gateLength / 2;
+    if (gateLength > 0 && ++synth.gateTime >= gateLength) {
+      synth.gateTime = 0;
+    }
+    if (open) {
+      synth.envelope = synth.envelope + fadeStep > MIXER_UNITY_GAIN ? MIXER_UNITY_GAIN : synth.envelope + fadeStep;
+    } else {
+      synth.envelope = synth.envelope > fadeStep ? synth.envelope - fadeStep : 0;
+    }
+
+    samples[i] = saturate16((sample * synth.envelope) >> 15);
+    synth.phase += increment;
+  }
+}
+
+#endif
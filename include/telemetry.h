@@ -0,0 +1,112 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Telemetry frames sent by the car to the web interface
+ *
+ * Every frame is laid out as follows:
+ *
+ *   offset 0: message type (MSG_TELEMETRY)
+ *   offset 1: flags (TELEMETRY_KEYFRAME if the values are absolute)
+ *   offset 2: mask of the fields present in the frame (bit n = field n)
+ *   offset 3: the present fields, in increasing order, as zigzag-encoded base-128 varints
+ *
+ * A keyframe carries every field with its absolute value; the following frames only carry the
+ * fields that changed, as the difference from the previous frame sent to the same client. Most
+ * fields change slowly, so a typical frame is just a few bytes.
+ */
+
+/* type of the messages sent by the car */
+#define MSG_TELEMETRY 0x80
+
+/* flags of a telemetry frame */
+#define TELEMETRY_KEYFRAME 0x01
+
+/* fields of a telemetry frame */
+#define TELEMETRY_DISTANCE 0        // distance measured by the infrared sensor (cm)
+#define TELEMETRY_STATE 1           // state flags of the car (TELEMETRY_STATE_*)
+#define TELEMETRY_DUTY 2            // PWM duty applied to the motors
+#define TELEMETRY_FREE_HEAP 3       // free heap (bytes)
+#define TELEMETRY_TICK_TIME 4       // duration of the last control tick (us)
+#define TELEMETRY_RSSI 5            // signal strength of the connected station (dBm)
+#define TELEMETRY_COMMAND_LATENCY 6 // receive-to-pins time of the last command (us)
+#define TELEMETRY_FIELD_COUNT 7
+
+/* bits of the TELEMETRY_STATE field */
+#define TELEMETRY_STATE_ACCELERATING (1 << 0)
+#define TELEMETRY_STATE_REVERSING (1 << 1)
+#define TELEMETRY_STATE_HONKING (1 << 2)
+#define TELEMETRY_STATE_AVOIDING (1 << 3)
+#define TELEMETRY_STATE_AVOIDANCE_ON (1 << 4)
+#define TELEMETRY_STATE_HEADLIGHTS (1 << 5)
+
+/* the maximum size of a telemetry frame (a 32-bit varint takes at most 5 bytes) */
+#define MAX_TELEMETRY_FRAME_SIZE (3 + TELEMETRY_FIELD_COUNT * 5)
+
+/* a snapshot of the telemetry fields */
+struct Telemetry {
+  int32_t fields[TELEMETRY_FIELD_COUNT];
+};
+
+/*
+ * Function that appends a signed value to a frame as a zigzag-encoded varint
+ *
+ * @param data - where to write the value
+ * @param value - the value to write
+ * @return the number of bytes written
+ */
+inline size_t writeVarint(uint8_t *data, int32_t value) {
+  /* zigzag encoding maps small negative values to small positive ones */
+  uint32_t encoded = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+  size_t length = 0;
+
+  while (encoded >= 0x80) {
+    data[length++] = (encoded & 0x7F) | 0x80;
+    encoded >>= 7;
+  }
+  data[length++] = encoded;
+  return length;
+}
+
+/*
+ * Function that encodes a telemetry frame for a client
+ *
+ * @param data - where to write the frame (at least MAX_TELEMETRY_FRAME_SIZE bytes)
+ * @param current - the current values of the fields
+ * @param baseline - the values last sent to the client, updated to the current values
+ * @param keyframe - whether to send every field with its absolute value
+ * @return the size of the frame, or 0 if nothing changed since the last frame
+ */
+inline size_t encodeTelemetry(uint8_t *data, const Telemetry &current, Telemetry &baseline, bool keyframe) {
+  size_t length = 3;
+  uint8_t mask = 0;
+
+  for (uint8_t field = 0; field < TELEMETRY_FIELD_COUNT; field++) {
+    int32_t value = current.fields[field];
+
+    if (keyframe) {
+      length += writeVarint(data + length, value);
+    } else if (value != baseline.fields[field]) {
+      length += writeVarint(data + length, (int32_t)((uint32_t)value - (uint32_t)baseline.fields[field]));
+    } else {
+      continue;
+    }
+
+    mask |= 1 << field;
+    baseline.fields[field] = value;
+  }
+
+  if (mask == 0) {
+    return 0;
+  }
+
+  data[0] = MSG_TELEMETRY;
+  data[1] = keyframe ? TELEMETRY_KEYFRAME : 0;
+  data[2] = mask;
+  return length;
+}
+
+#endif
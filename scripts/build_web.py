@@ -0,0 +1,96 @@
+"""
+Build step that turns the web interface into a header the firmware can serve
+
+The page in web/index.html is minified, gzipped and written to include/index_html.h as a
+PROGMEM byte array, together with a strong ETag derived from the compressed bytes. The
+header is only rewritten when the page changes, so it doesn't trigger needless rebuilds.
+
+Runs as a PlatformIO pre-script (see extra_scripts in platformio.ini), or on its own:
+
+    python scripts/build_web.py
+"""
+
+import gzip
+import hashlib
+import os
+import re
+
+SOURCE = os.path.join("web", "index.html")
+OUTPUT = os.path.join("include", "index_html.h")
+
+# the number of bytes per line of the generated array
+BYTES_PER_LINE = 16
+
+
+def minify(html):
+    """Strips the comments, the indentation and the blank lines of the page
+
+    Line breaks are kept, so the JavaScript never relies on the minifier for semicolons.
+    """
+    html = re.sub(r"<!--.*?-->", "", html, flags=re.S)
+
+    # /* */ comments only appear in the <style> and <script> blocks
+    def strip_block_comments(match):
+        return re.sub(r"/\*.*?\*/", "", match.group(0), flags=re.S)
+
+    html = re.sub(r"<(style|script)>.*?</\1>", strip_block_comments, html, flags=re.S)
+
+    lines = (line.strip() for line in html.splitlines())
+    return "\n".join(line for line in lines if line)
+
+
+def render_header(compressed, etag, original_size):
+    rows = []
+    for offset in range(0, len(compressed), BYTES_PER_LINE):
+        chunk = compressed[offset:offset + BYTES_PER_LINE]
+        rows.append("  " + ", ".join("0x%02x" % byte for byte in chunk) + ",")
+
+    return (
+        "/* generated by scripts/build_web.py from web/index.html, do not edit */\n"
+        "#ifndef INDEX_HTML_H\n"
+        "#define INDEX_HTML_H\n"
+        "\n"
+        "#include <Arduino.h>\n"
+        "\n"
+        "/* the size of the page before minification and compression (in bytes) */\n"
+        "#define INDEX_HTML_ORIGINAL_SIZE %d\n"
+        "\n"
+        "/* strong validator of the compressed page */\n"
+        "#define INDEX_HTML_ETAG \"\\\"%s\\\"\"\n"
+        "\n"
+        "/* the minified and gzipped page */\n"
+        "const uint8_t indexHtmlGz[] PROGMEM = {\n"
+        "%s\n"
+        "};\n"
+        "\n"
+        "#endif\n" % (original_size, etag, "\n".join(rows))
+    )
+
+
+def build(project_dir):
+    with open(os.path.join(project_dir, SOURCE), "r", encoding="utf-8") as source:
+        html = source.read()
+
+    minified = minify(html).encode("utf-8")
+    # a fixed mtime keeps the output (and so the ETag) identical across builds
+    compressed = gzip.compress(minified, compresslevel=9, mtime=0)
+    etag = hashlib.sha256(compressed).hexdigest()[:16]
+    header = render_header(compressed, etag, len(html.encode("utf-8")))
+
+    output_path = os.path.join(project_dir, OUTPUT)
+    if os.path.exists(output_path):
+        with open(output_path, "r", encoding="utf-8") as output:
+            if output.read() == header:
+                return
+
+    with open(output_path, "w", encoding="utf-8", newline="\n") as output:
+        output.write(header)
+    print("web: %s -> %s (%d -> %d -> %d bytes)" % (SOURCE, OUTPUT, len(html), len(minified), len(compressed)))
+
+
+try:
+    Import("env")  # noqa: F821 (defined by PlatformIO)
+    build(env.subst("$PROJECT_DIR"))  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        build(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
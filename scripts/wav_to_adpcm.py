@@ -0,0 +1,184 @@
+"""
+Converter of the car's WAV sounds to IMA-ADPCM assets
+
+The sounds are downmixed to mono and encoded in the block format of include/adpcm.h, four times
+smaller than the 16-bit WAV files. The asset is then decoded again and compared with the source,
+so a sound that doesn't survive the compression shows up before it reaches the SD card:
+
+    python scripts/wav_to_adpcm.py horn.wav [horn.adp] [--block-size 256]
+
+The car plays /horn.adp from the SD card when it exists, and falls back to /horn.wav otherwise
+(the engine and the reversing beeper are synthesized, see include/synth.h).
+"""
+
+import argparse
+import math
+import os
+import struct
+import sys
+import wave
+
+MAGIC = b"ADPC"
+VERSION = 1
+
+# sizes in bytes, see include/adpcm.h
+HEADER_SIZE = 16
+BLOCK_HEADER_SIZE = 4
+DEFAULT_BLOCK_SIZE = 256
+MAX_BLOCK_SIZE = 512
+
+STEPS = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97,
+    107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428,
+    4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350,
+    22385, 24623, 27086, 29794, 32767,
+]
+
+INDEX_CHANGES = [-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8]
+
+
+def block_samples(block_size):
+    return 1 + 2 * (block_size - BLOCK_HEADER_SIZE)
+
+
+def read_wav(path):
+    """Returns the sample rate and the mono 16-bit samples of a PCM WAV file"""
+    with wave.open(path, "rb") as source:
+        channels = source.getnchannels()
+        width = source.getsampwidth()
+        rate = source.getframerate()
+        frames = source.readframes(source.getnframes())
+
+    if width == 1:
+        values = [(byte - 128) << 8 for byte in frames]
+    elif width == 2:
+        values = list(struct.unpack("<%dh" % (len(frames) // 2), frames))
+    else:
+        raise ValueError("%s: only 8 and 16-bit WAV files are supported" % path)
+
+    samples = []
+    for frame in range(0, len(values), channels):
+        samples.append(sum(values[frame:frame + channels]) // channels)
+    return rate, samples
+
+
+def decode_sample(state, code):
+    """Decodes one code, the state is [predictor, index]"""
+    step = STEPS[state[1]]
+    difference = step >> 3
+    if code & 4:
+        difference += step
+    if code & 2:
+        difference += step >> 1
+    if code & 1:
+        difference += step >> 2
+
+    predictor = state[0] - difference if code & 8 else state[0] + difference
+    state[0] = max(-32768, min(32767, predictor))
+    state[1] = max(0, min(len(STEPS) - 1, state[1] + INDEX_CHANGES[code]))
+    return state[0]
+
+
+def encode_sample(state, sample):
+    """Encodes one sample as the code that gets the decoder closest to it"""
+    step = STEPS[state[1]]
+    difference = sample - state[0]
+    code = 0
+
+    if difference < 0:
+        code = 8
+        difference = -difference
+    if difference >= step:
+        code |= 4
+        difference -= step
+    if difference >= step >> 1:
+        code |= 2
+        difference -= step >> 1
+    if difference >= step >> 2:
+        code |= 1
+
+    decode_sample(state, code)
+    return code
+
+
+def encode(samples, rate, block_size):
+    """Returns the asset holding the samples"""
+    asset = bytearray(MAGIC)
+    asset += struct.pack("<BBHII", VERSION, 1, block_size, rate, len(samples))
+
+    index = 0
+    per_block = block_samples(block_size)
+    for start in range(0, len(samples), per_block):
+        block = samples[start:start + per_block]
+        state = [block[0], index]
+        asset += struct.pack("<hBB", block[0], index, 0)
+
+        for i in range(1, len(block), 2):
+            low = encode_sample(state, block[i])
+            high = encode_sample(state, block[i + 1]) if i + 1 < len(block) else 0
+            asset.append(low | (high << 4))
+        index = state[1]
+
+    return bytes(asset)
+
+
+def decode(asset):
+    """Returns the samples of an asset"""
+    magic, version, channels, block_size, _, count = struct.unpack("<4sBBHII", asset[:HEADER_SIZE])
+    if magic != MAGIC or version != VERSION or channels != 1:
+        raise ValueError("not an ADPCM asset")
+
+    samples = []
+    for start in range(HEADER_SIZE, len(asset), block_size):
+        block = asset[start:start + block_size]
+        first, index, _ = struct.unpack("<hBB", block[:BLOCK_HEADER_SIZE])
+        state = [first, index]
+        samples.append(first)
+        for byte in block[BLOCK_HEADER_SIZE:]:
+            samples.append(decode_sample(state, byte & 0x0F))
+            samples.append(decode_sample(state, byte >> 4))
+
+    return samples[:count]
+
+
+def compare(source, decoded):
+    """Returns the signal-to-noise ratio (in dB) and the largest error of the decoded samples"""
+    signal = sum(sample * sample for sample in source)
+    noise = sum((a - b) * (a - b) for a, b in zip(source, decoded))
+    largest = max((abs(a - b) for a, b in zip(source, decoded)), default=0)
+    if noise == 0:
+        return math.inf, largest
+    return 10 * math.log10(max(signal, 1) / noise), largest
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Converts a WAV file to an IMA-ADPCM asset (.adp)")
+    parser.add_argument("source", help="the WAV file")
+    parser.add_argument("output", nargs="?", help="the asset, next to the WAV file by default")
+    parser.add_argument("--block-size", type=int, default=DEFAULT_BLOCK_SIZE,
+                        help="the size of a block in bytes (default %d)" % DEFAULT_BLOCK_SIZE)
+    parser.add_argument("--min-snr", type=float, default=20.0,
+                        help="fail when the decoded sound is noisier than this (in dB, default 20)")
+    args = parser.parse_args()
+
+    if not BLOCK_HEADER_SIZE < args.block_size <= MAX_BLOCK_SIZE:
+        parser.error("the block size must be between %d and %d bytes" % (BLOCK_HEADER_SIZE + 1, MAX_BLOCK_SIZE))
+
+    output = args.output or os.path.splitext(args.source)[0] + ".adp"
+    rate, samples = read_wav(args.source)
+    if not samples:
+        parser.error("%s has no samples" % args.source)
+
+    asset = encode(samples, rate, args.block_size)
+    with open(output, "wb") as destination:
+        destination.write(asset)
+
+    snr, largest = compare(samples, decode(asset))
+    print("%s -> %s: %d samples at %d Hz, %d -> %d bytes, SNR %.1f dB, largest error %d" % (
+        args.source, output, len(samples), rate, len(samples) * 2, len(asset), snr, largest))
+    return 0 if snr >= args.min_snr else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,1085 @@
+#include <stdlib.h>
+#include <string.h>
+#include "car.h"
+
+/* what the car does in every drive state: motors' directions, taillights and motion sound */
+const DriveOutputs DRIVE_OUTPUTS[DRIVE_STATE_COUNT] = {
+  /* BRAKE */      { STOP_WHEELS,    STOP_WHEELS,    true,  0 },
+  /* FORWARD */    { MOVE_FORWARD,   MOVE_FORWARD,   false, SOUND_BIT(SOUND_ACCELERATION) },
+  /* TURN_LEFT */  { MOVE_BACKWARDS, MOVE_FORWARD,   false, SOUND_BIT(SOUND_ACCELERATION) },
+  /* TURN_RIGHT */ { MOVE_FORWARD,   MOVE_BACKWARDS, false, SOUND_BIT(SOUND_ACCELERATION) },
+  /* REVERSE */    { MOVE_BACKWARDS, MOVE_BACKWARDS, false, SOUND_BIT(SOUND_REVERSING) },
+  /* AVOID */      { MOVE_BACKWARDS, MOVE_BACKWARDS, false, SOUND_BIT(SOUND_REVERSING) },
+  /* ARC */        { STOP_WHEELS,    STOP_WHEELS,    false, SOUND_BIT(SOUND_ACCELERATION) } // mixed (see mixDrive)
+};
+
+/* the drive state of the car (see drive_state.h) */
+DriveState driveState = DRIVE_BRAKE;
+
+/* indicates whether the car is honking */
+bool honking = false;
+
+/* indicates whether the headlights are on */
+bool headlights = false;
+
+/* the sounds last requested from the audio task */
+uint32_t requestedSounds = 0;
+
+/* indicates the current state of the obstacle avoidance feature */
+bool avoidObstacles = false;
+
+/* timestamp of the last obstacle avoidance event */
+uint32_t lastObstacleAvoidedTime = 0;
+
+/* the recent filtered distances, the closing speed is estimated from */
+DistanceHistory distanceHistory = { {}, 0 };
+
+/* the last avoidance started, its reversing duty and its duration (in milliseconds) */
+AvoidancePlan lastAvoidancePlan = { AVOID_NONE, 0, 0, 0, 0 };
+int32_t avoidanceDuty = 0;
+uint32_t avoidanceTime = 0;
+
+/* the number of avoidances that only braked, and that reversed */
+uint32_t avoidanceBrakes = 0;
+uint32_t avoidanceReversals = 0;
+
+/* moving average of the infrared sensor readings */
+IrFilter irFilter = { 0, false };
+
+/* the last distance measured by the infrared sensor (in cm) */
+uint8_t lastDistance = 0;
+
+/* the speed of the motors (127-255) */
+uint8_t motorsSpeed = 255;
+
+/* the direction requested for each pair of motors, indexed by LEFT_MOTORS / RIGHT_MOTORS */
+uint8_t motorsTargetDirection[2] = { STOP_WHEELS, STOP_WHEELS };
+
+/* the throttle and the steer of the last drive command (see drive_mixer.h) */
+int8_t driveThrottle = 0;
+int8_t driveSteer = 0;
+
+/* the duty ramps of each pair of motors, indexed by LEFT_MOTORS / RIGHT_MOTORS */
+MotorRamp motorRamps[2] = { { 0, 0 }, { 0, 0 } };
+
+/* the number of control ticks since startup */
+uint32_t controlTicks = 0;
+
+/* the levels last written to the output pins (OUTPUT_PINS), so only their changes are written */
+uint32_t outputPins = 0;
+
+/* the number of batched writes of the output pins */
+uint32_t gpioWrites = 0;
+
+/* timestamp of the last valid frame received from any client */
+volatile uint32_t lastFrameTime = 0;
+
+/* the number of times the motors were stopped because the link went quiet */
+volatile uint32_t deadmanStops = 0;
+
+/* timestamp (in microseconds) of the last change of the requested sounds */
+volatile uint32_t soundRequestTime = 0;
+
+/* commands received from the clients, waiting to be applied by the control loop */
+CommandQueue commandQueue;
+
+/* sessions of the connected clients */
+ClientSession sessions[MAX_CLIENTS];
+
+/* the id of the client holding the driver lease, 0 if nobody holds it */
+volatile uint32_t driverClientId = 0;
+
+/* lease statistics */
+volatile uint32_t leaseChanges = 0;
+volatile uint32_t spectatorCommandsDropped = 0; // commands sent by clients not holding the lease
+
+/* incremented whenever the car's state changes without a command (deadman stop, end of an obstacle avoidance, new
+ * driver), from both the network task and the control task */
+std::atomic<uint32_t> carStateGeneration(0);
+
+/* frame statistics */
+volatile uint32_t framesReceived = 0;
+volatile uint32_t redundantCommandsDropped = 0; // commands repeating the previous one of their kind
+volatile uint32_t datagramsReceived = 0;        // frames received over UDP
+volatile uint32_t datagramsRejected = 0;        // datagrams too short or from a client without a session
+
+/* log of the drive session, written out by the recorder task */
+Recorder recorder;
+
+/* decides when the car can save power (see power.h) */
+PowerGovernor powerGovernor;
+
+/* the last time a client connected or a command was applied, in milliseconds and in microseconds */
+volatile uint32_t lastActivityTime = 0;
+volatile uint32_t lastActivityMicros = 0;
+
+/* the full clock over the current CPU clock, set whenever the clock changes (see recordCycles) */
+volatile uint32_t cycleScale = 1;
+
+static_assert(CPU_FREQUENCY_MHZ % POWER_IDLE_CPU_MHZ == 0, "the idle clock must divide the full clock");
+
+/* messages of the car, written out by the log task (see log.h) */
+LogBuffer logBuffer;
+
+/* the number of dropped log records already reported */
+uint32_t reportedLogDrops = 0;
+
+/* the last frame time and lights recorded, to record only their changes */
+uint32_t recordedFrameTime = 0;
+uint8_t recordedLights = 0;
+
+/* bucket bounds (in microseconds) of the control timing histograms */
+const uint32_t TIMING_BUCKETS[TIMING_BUCKET_COUNT] = { 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000 };
+
+/* bucket bounds (in CPU cycles at full clock) of the hot path probes, from 1 us to 50 ms */
+const uint32_t CYCLE_BUCKETS[CYCLE_BUCKET_COUNT] = {
+  US_TO_CYCLES(1), US_TO_CYCLES(5), US_TO_CYCLES(10), US_TO_CYCLES(50), US_TO_CYCLES(100),
+  US_TO_CYCLES(500), US_TO_CYCLES(1000), US_TO_CYCLES(5000), US_TO_CYCLES(10000), US_TO_CYCLES(50000)
+};
+
+/* time from the infrared sensor reading to the motors reversing (in microseconds) */
+Histogram reactionTime(TIMING_BUCKETS, TIMING_BUCKET_COUNT);
+
+/* time from a command being received to it being applied to the pins (in microseconds) */
+Histogram commandLatency(TIMING_BUCKETS, TIMING_BUCKET_COUNT);
+
+/* the commands drained from the queue by the current tick */
+QueuedCommand commandBatch[COMMAND_QUEUE_SIZE];
+
+/* the commands applied during the current tick, whose latency is recorded once the pins are written */
+QueuedCommand appliedCommands[COMMAND_QUEUE_SIZE];
+uint8_t appliedCommandCount = 0;
+
+/* durations (in CPU cycles) of the hot paths of the control tick */
+Histogram handleSoundsCycles(CYCLE_BUCKETS, CYCLE_BUCKET_COUNT);
+Histogram obstacleDetectionCycles(CYCLE_BUCKETS, CYCLE_BUCKET_COUNT);
+
+/*
+ * Function that returns the levels of the direction pins of a pair of motors
+ *
+ * @param motors - the pair of motors
+ * @param direction - the direction the motors spin in: 1 (forward), -1 (backwards) or 0 (stopped)
+ * @return the mask of the direction pins to drive high
+ */
+uint32_t motorDirectionPins(uint8_t motors, int8_t direction) {
+  /* IN1/IN3 high spins the motors backwards, IN2/IN4 high forward, both low stops them */
+  static const uint32_t pins[2][3] = {
+    { PIN_BIT(LEFT_MOTORS_IN1), 0, PIN_BIT(LEFT_MOTORS_IN2) },
+    { PIN_BIT(RIGHT_MOTORS_IN3), 0, PIN_BIT(RIGHT_MOTORS_IN4) }
+  };
+
+  return pins[motors][direction + 1];
+}
+
+/*
+ * Function that drives the output pins to the given levels
+ * Only the pins that changed are written, all of them at once (see halGpioWrite)
+ *
+ * @param levels - the mask of the output pins (OUTPUT_PINS) to drive high, the others are driven low
+ */
+void writeOutputPins(uint32_t levels) {
+  uint32_t changed = levels ^ outputPins;
+
+  if (changed == 0) {
+    return;
+  }
+
+  halGpioWrite(levels & changed, ~levels & changed);
+  outputPins = levels;
+  gpioWrites++;
+}
+
+/*
+ * Function that converts a speed value to a PWM duty
+ *
+ * @param speedValue - the speed value (127-255)
+ */
+int32_t speedToDuty(uint8_t speedValue) {
+  return (int32_t)speedValue * MOTOR_DUTY_MAX / 255;
+}
+
+/*
+ * Function that sets the direction a specified pair of motors should ramp to, at the current speed
+ * The motors reach it over the next control ticks (see updateMotors)
+ *
+ * @param motors - the pair of motors to control
+ * @param direction - the desired direction for the motors to spin
+ */
+void setMotorsTarget(uint8_t motors, uint8_t direction) {
+  /* an avoidance reverses with the duty it planned, whatever the speed */
+  int32_t duty = driveState == DRIVE_AVOID ? avoidanceDuty : speedToDuty(motorsSpeed);
+
+  motorsTargetDirection[motors] = direction;
+  switch (direction) {
+    case MOVE_FORWARD:
+      motorRamps[motors].target = duty;
+      break;
+    case MOVE_BACKWARDS:
+      motorRamps[motors].target = -duty;
+      break;
+    default:
+      motorRamps[motors].target = 0;
+      break;
+  }
+}
+
+/*
+ * Function that moves the duty of both pairs of motors one step towards their targets, then
+ * writes the direction pins and the lights in one go, before the new duty is applied
+ * The direction pins are only changed once the duty has ramped down to zero
+ */
+void updateMotors() {
+  const uint8_t channels[2] = { LEFT_MOTORS_PWM_CHANNEL, RIGHT_MOTORS_PWM_CHANNEL };
+  uint32_t levels = 0;
+
+  for (uint8_t motors = LEFT_MOTORS; motors <= RIGHT_MOTORS; motors++) {
+    MotorRamp &ramp = motorRamps[motors];
+    int32_t previousDuty = ramp.duty;
+    int32_t duty = stepMotorRamp(ramp, MOTOR_ACCELERATION_STEP, MOTOR_DECELERATION_STEP);
+
+    if (duty != previousDuty) {
+      int32_t values[] = { motors, duty };
+      recorder.record(RECORD_MOTORS, controlTicks, values, 2);
+    }
+    levels |= motorDirectionPins(motors, motorDirection(duty));
+  }
+
+  if (DRIVE_OUTPUTS[driveState].taillights) {
+    levels |= PIN_BIT(TAILLIGHTS);
+  }
+  if (headlights) {
+    levels |= PIN_BIT(HEADLIGHTS);
+  }
+  writeOutputPins(levels);
+
+  for (uint8_t motors = LEFT_MOTORS; motors <= RIGHT_MOTORS; motors++) {
+    halPwmWrite(channels[motors], abs(motorRamps[motors].duty));
+  }
+}
+
+/*
+ * Function that moves the drive state machine on an event, and sets the motors' targets of the
+ * state it reaches (the motors ramp through zero when changing direction)
+ *
+ * @param event - the event
+ * @return whether the drive state changed
+ */
+bool driveEvent(DriveEvent event) {
+  DriveState state = driveTransition(driveState, event);
+  bool changed = state != driveState;
+
+  driveState = state;
+  if (state == DRIVE_ARC) {
+    mixDrive();
+  } else {
+    setMotorsTarget(LEFT_MOTORS, DRIVE_OUTPUTS[state].leftMotors);
+    setMotorsTarget(RIGHT_MOTORS, DRIVE_OUTPUTS[state].rightMotors);
+  }
+
+  /* every obstacle restarts the avoidance */
+  if (event == EVENT_OBSTACLE) {
+    lastObstacleAvoidedTime = halMillis();
+  }
+  return changed;
+}
+
+/*
+ * Function that handles the move command given to the car
+ * A move command ends any obstacle avoidance in progress (see drive_state.h)
+ *
+ * @param direction - the desired direction for the car to move
+ */
+void moveWheels(uint8_t direction) {
+  /* the move arguments are the first drive events, anything else stops the car */
+  driveEvent(direction <= MOVE_BACKWARDS ? (DriveEvent)direction : EVENT_STOP);
+}
+
+/*
+ * Function that sets the motors' targets from the throttle and the steer of the joystick, the
+ * speed being the duty at full throttle (see drive_mixer.h)
+ * Each side ramps to its own duty, so the car follows a curve without stopping to turn
+ */
+void mixDrive() {
+  DriveMix mix = mixArcDrive(driveThrottle, driveSteer, speedToDuty(motorsSpeed));
+
+  motorRamps[LEFT_MOTORS].target = mix.left;
+  motorRamps[RIGHT_MOTORS].target = mix.right;
+  motorsTargetDirection[LEFT_MOTORS] = mix.left > 0 ? MOVE_FORWARD : (mix.left < 0 ? MOVE_BACKWARDS : STOP_WHEELS);
+  motorsTargetDirection[RIGHT_MOTORS] = mix.right > 0 ? MOVE_FORWARD : (mix.right < 0 ? MOVE_BACKWARDS : STOP_WHEELS);
+}
+
+/*
+ * Function that handles the drive command given to the car
+ * Like a move command, it ends any obstacle avoidance in progress; a joystick back in its
+ * deadzone stops the car
+ *
+ * @param throttle - the throttle (-DRIVE_AXIS_MAX - DRIVE_AXIS_MAX, forward positive)
+ * @param steer - the steer (-DRIVE_AXIS_MAX - DRIVE_AXIS_MAX, clockwise positive)
+ */
+void driveJoystick(int32_t throttle, int32_t steer) {
+  driveThrottle = throttle < -DRIVE_AXIS_MAX ? -DRIVE_AXIS_MAX : (throttle > DRIVE_AXIS_MAX ? DRIVE_AXIS_MAX : throttle);
+  driveSteer = steer < -DRIVE_AXIS_MAX ? -DRIVE_AXIS_MAX : (steer > DRIVE_AXIS_MAX ? DRIVE_AXIS_MAX : steer);
+  driveEvent(driveAxis(throttle) == 0 && driveAxis(steer) == 0 ? EVENT_STOP : EVENT_DRIVE);
+}
+
+/*
+ * Function that sets the motors speed, reached through the duty ramps
+ *
+ * @param speedValue - the desired speed value (127-255)
+ */
+void setMotorsSpeed(uint8_t speedValue) {
+  motorsSpeed = speedValue;
+  if (driveState == DRIVE_ARC) {
+    mixDrive();
+    return;
+  }
+  setMotorsTarget(LEFT_MOTORS, motorsTargetDirection[LEFT_MOTORS]);   // set speed for left motors
+  setMotorsTarget(RIGHT_MOTORS, motorsTargetDirection[RIGHT_MOTORS]); // set speed for right motors
+}
+
+/*
+ * Function that activates a specific feature of the car
+ *
+ * @param feature - the feature to activate
+ */
+void activateFeature(uint8_t feature) {
+  switch (feature) {
+    case ACTIVATE_HORN:
+      honking = true; // enable the horn
+      break;
+    default:
+      honking = false; // disable the horn by default
+      break;
+  }
+}
+
+/*
+ * Function that toggles a specific feature of the car
+ *
+ * @param feature - the feature to toggle
+ */
+void toggleFeature(uint8_t feature) {
+  switch (feature) {
+    case TOGGLE_HEADLIGHTS:
+      /* toggle the headlights on or off, written at the end of the tick (see updateMotors) */
+      headlights = !headlights;
+      break;
+    case TOGGLE_OBSTACLE_AVOIDANCE:
+      /* toggle the obstacle avoidance feature */
+      avoidObstacles = !avoidObstacles;
+      irFilter.primed = false; // don't reuse readings from before the feature was turned off
+      distanceHistory.count = 0;
+      break;
+    default:
+      break; /* do nothing for unrecognized features */
+  }
+}
+
+/*
+ * Function that finds the session of a connected client
+ *
+ * @param clientId - the id of the client
+ * @return the session of the client, or NULL if it has none
+ */
+ClientSession* findSession(uint32_t clientId) {
+  for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+    if (sessions[i].clientId == clientId) {
+      return &sessions[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Function that finds the session of the connected client named by the low 16 bits of its id,
+ * the way a handoff command names it
+ *
+ * @param shortId - the low 16 bits of the id of the client
+ * @return the session of the client, or NULL if no connected client or more than one has this short id
+ */
+ClientSession* findSessionByShortId(uint16_t shortId) {
+  ClientSession *found = NULL;
+
+  for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+    if (sessions[i].clientId != 0 && (uint16_t)sessions[i].clientId == shortId) {
+      if (found != NULL) {
+        return NULL; // ambiguous
+      }
+      found = &sessions[i];
+    }
+  }
+  return found;
+}
+
+/*
+ * Function that applies a single command received from a client
+ * Must only be called from the control loop, which is the only writer of the actuator state
+ *
+ * @param command - the decoded command
+ */
+void applyCommand(const ControlCommand &command) {
+  switch (command.opcode) {
+    case OP_MOVE:
+      moveWheels(command.arg); // handle movement commands
+      break;
+    case OP_SPEED:
+      setMotorsSpeed(command.value < 127 ? 127 : (command.value > 255 ? 255 : command.value)); // set the motors' speed
+      break;
+    case OP_ACTIVATE:
+      activateFeature(command.arg); // handle feature activation
+      break;
+    case OP_TOGGLE:
+      toggleFeature(command.arg); // handle feature toggling
+      break;
+    case OP_DRIVE:
+      driveJoystick((int16_t)command.value, (int8_t)command.arg); // handle joystick commands
+      break;
+    default:
+      break; /* ignore unknown opcodes */
+  }
+}
+
+/*
+ * Function that queues a command decoded on the network task for the control loop
+ *
+ * @param command - the decoded command
+ * @param receivedAt - the time (in microseconds) the frame holding the command was received
+ * @return whether the command was queued, false if the queue was full
+ */
+bool enqueueCommand(const ControlCommand &command, uint32_t receivedAt) {
+  logEvent<LOG_COMMAND>(command.opcode, command.arg, command.value);
+
+  if (!commandQueue.push(command, receivedAt)) {
+    logEvent<LOG_QUEUE_FULL>();
+    return false;
+  }
+
+  /* the idle car ticks slowly, don't wait for its next tick */
+  if (powerGovernor.state == POWER_IDLE) {
+    halWakeControlTick();
+  }
+  return true;
+}
+
+/*
+ * Function that records the latency of a command, from its frame being received to now
+ *
+ * @param queued - the applied command
+ */
+void recordCommandLatency(const QueuedCommand &queued) {
+  uint32_t now = halMicros();
+  commandQueue.recordApplied(queued, now);
+  commandLatency.record(now - queued.enqueuedAt);
+}
+
+/*
+ * Function that applies a queued command
+ * Its latency is recorded by recordAppliedCommands, once the tick has written the pins
+ *
+ * @param queued - the queued command
+ */
+void applyQueuedCommand(const QueuedCommand &queued) {
+  applyCommand(queued.command);
+  lastActivityTime = halMillis();
+  lastActivityMicros = queued.enqueuedAt;
+
+  if (appliedCommandCount < COMMAND_QUEUE_SIZE) {
+    appliedCommands[appliedCommandCount++] = queued;
+  } else {
+    recordCommandLatency(queued); // not reached, a tick drains at most a queue's worth
+  }
+}
+
+/*
+ * Function that records the latency of the commands applied during the tick, once their effect
+ * is on the pins
+ */
+void recordAppliedCommands() {
+  for (uint8_t i = 0; i < appliedCommandCount; i++) {
+    recordCommandLatency(appliedCommands[i]);
+  }
+  appliedCommandCount = 0;
+}
+
+/*
+ * Function that applies all the queued commands
+ * Only the newest move (or drive) and speed commands are applied, since each of them overrides the
+ * previous ones; they are applied where they were received, so the batch keeps its order with
+ * the other commands (e.g. a move followed by a toggle of the obstacle avoidance)
+ */
+void processCommands() {
+  uint8_t count = 0;
+  int8_t lastMove = -1;
+  int8_t lastSpeed = -1;
+
+  /* drain at most a queue's worth, the commands arriving meanwhile wait for the next tick */
+  while (count < COMMAND_QUEUE_SIZE && commandQueue.pop(commandBatch[count])) {
+    const QueuedCommand &queued = commandBatch[count];
+    int32_t values[] = { queued.command.opcode, queued.command.arg, queued.command.value,
+                         (int32_t)(halMicros() - queued.enqueuedAt) };
+    recorder.record(RECORD_COMMAND, controlTicks, values, 4);
+
+    switch (queued.command.opcode) {
+      case OP_MOVE:
+      case OP_DRIVE:
+        if (lastMove >= 0) {
+          commandQueue.recordCoalesced();
+        }
+        lastMove = count;
+        break;
+      case OP_SPEED:
+        if (lastSpeed >= 0) {
+          commandQueue.recordCoalesced();
+        }
+        lastSpeed = count;
+        break;
+      default:
+        break;
+    }
+    count++;
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t opcode = commandBatch[i].command.opcode;
+    bool superseded = ((opcode == OP_MOVE || opcode == OP_DRIVE) && i != lastMove) || (opcode == OP_SPEED && i != lastSpeed);
+    if (!superseded) {
+      applyQueuedCommand(commandBatch[i]);
+    }
+  }
+}
+
+/*
+ * Function that has a lease message sent to every connected client, when the driver or the
+ * connected clients change
+ */
+void announceLease() {
+  for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+    if (sessions[i].clientId != 0) {
+      sessions[i].leasePending = true;
+    }
+  }
+}
+
+/*
+ * Function that gives the driver lease to a client
+ * The car stops whenever the driver changes, so a new driver never takes over a moving car,
+ * and every client is told about the change
+ *
+ * @param clientId - the id of the new driver, 0 if nobody holds the lease
+ */
+void setDriver(uint32_t clientId) {
+  if (clientId == driverClientId) {
+    return;
+  }
+
+  driverClientId = clientId;
+  leaseChanges++;
+  carStateGeneration.fetch_add(1, std::memory_order_relaxed);
+  enqueueCommand({ OP_MOVE, STOP_WHEELS, 0 }, halMicros());
+  announceLease();
+
+  /* the new driver's link is alive, it has just been heard from or chosen by the previous one */
+  lastFrameTime = halMillis();
+  logEvent<LOG_LEASE>(clientId);
+}
+
+/*
+ * Function that applies a lease command sent by a client
+ *
+ * @param session - the session of the client
+ * @param command - the lease command
+ */
+void applyLeaseCommand(ClientSession &session, const ControlCommand &command) {
+  bool driver = session.clientId == driverClientId;
+
+  switch (command.arg) {
+    case LEASE_RELEASE:
+      if (driver) {
+        setDriver(0);
+      }
+      break;
+    case LEASE_ACQUIRE:
+      /* the lease is free, or its holder stopped sending frames */
+      if (driverClientId == 0 || (halMillis() - lastFrameTime) >= LEASE_TIMEOUT) {
+        setDriver(session.clientId);
+      }
+      break;
+    case LEASE_HANDOFF: {
+      /* the value only holds the low 16 bits of the new driver's id, which must name a single client */
+      ClientSession *target = findSessionByShortId(command.value);
+      if (driver && target != NULL) {
+        setDriver(target->clientId);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+/*
+ * Function that starts the session of a newly connected client
+ * The client becomes the driver if nobody holds the lease, a spectator otherwise
+ *
+ * @param session - a free session
+ * @param clientId - the id of the client
+ * @param remoteAddress - the IPv4 address the client is connected from
+ */
+void connectClient(ClientSession &session, uint32_t clientId, uint32_t remoteAddress) {
+  session.clientId = clientId;
+  session.remoteAddress = remoteAddress;
+  session.frameLength = 0;
+  session.pingsSent = 0;
+  session.pongsReceived = 0;
+  session.lastRtt = 0;
+  session.maxFrameGap = 0;
+  session.lastTelemetryTime = 0;
+  session.telemetryDropped = 0;
+  session.stateGeneration = carStateGeneration.load(std::memory_order_relaxed) - 1; // nothing accepted yet
+  resetFrameDecoder(session.decoder);
+  lastActivityTime = halMillis();
+  lastActivityMicros = halMicros();
+
+  /* the other clients get the new one in their list */
+  announceLease();
+  if (driverClientId == 0) {
+    setDriver(clientId);
+  }
+  if (powerGovernor.state == POWER_IDLE) {
+    halWakeControlTick();
+  }
+}
+
+/*
+ * Function that lists the connected clients other than one, for its lease message
+ *
+ * @param clientId - the id of the client the list is for
+ * @param clients - where to store the ids of the other clients (MAX_CLIENTS - 1 of them at most)
+ * @return the number of the other clients
+ */
+uint8_t listOtherClients(uint32_t clientId, uint32_t *clients) {
+  uint8_t count = 0;
+
+  for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+    if (sessions[i].clientId != 0 && sessions[i].clientId != clientId) {
+      clients[count++] = sessions[i].clientId;
+    }
+  }
+  return count;
+}
+
+/*
+ * Function that ends the session of a disconnected client
+ * The car stops if the client was driving it
+ *
+ * @param session - the session of the client
+ */
+void disconnectClient(ClientSession &session) {
+  if (session.clientId == driverClientId) {
+    setDriver(0);
+  }
+  session.clientId = 0;
+  announceLease();
+}
+
+/*
+ * Function that checks whether a command repeats the previous one of its kind sent by a client
+ * Move, drive, speed and activate commands set a state, so repeating one changes nothing (a repeated
+ * move would even cancel an obstacle avoidance in progress); toggles are never redundant. Moves
+ * and drives set the same state, so they are remembered as one kind. The
+ * remembered commands are forgotten when the car's state changes on its own, so a client can
+ * always restore it.
+ *
+ * @param session - the session of the client
+ * @param command - the command
+ * @return whether the command can be dropped
+ */
+bool isRedundantCommand(ClientSession &session, const ControlCommand &command) {
+  if (command.opcode != OP_MOVE && command.opcode != OP_DRIVE && command.opcode != OP_SPEED &&
+      command.opcode != OP_ACTIVATE) {
+    return false;
+  }
+
+  uint32_t generation = carStateGeneration.load(std::memory_order_relaxed);
+  if (session.stateGeneration != generation) {
+    session.stateGeneration = generation;
+    memset(session.lastStateCommands, 0, sizeof(session.lastStateCommands));
+  }
+
+  const ControlCommand &last = session.lastStateCommands[command.opcode == OP_DRIVE ? OP_MOVE : command.opcode];
+  return last.opcode == command.opcode && last.arg == command.arg && last.value == command.value;
+}
+
+/*
+ * Function that remembers a command queued for a client, so its repetitions can be dropped
+ * It is only called once the command is in the queue: a command lost to a full queue must be
+ * accepted again when the client resends it.
+ *
+ * @param session - the session of the client
+ * @param command - the queued command
+ */
+void rememberCommand(ClientSession &session, const ControlCommand &command) {
+  if (command.opcode != OP_MOVE && command.opcode != OP_DRIVE && command.opcode != OP_SPEED &&
+      command.opcode != OP_ACTIVATE) {
+    return;
+  }
+
+  session.lastStateCommands[command.opcode == OP_DRIVE ? OP_MOVE : command.opcode] = command;
+}
+
+/*
+ * Function that decodes a complete frame received from a client and queues its commands
+ * Only the driver's commands are queued; the other clients can only send lease commands
+ *
+ * @param session - the session of the client
+ * @param data - the frame
+ * @param length - the length of the frame
+ * @param receivedAt - the time (in microseconds) the frame was received
+ * @return the result of the decoding
+ */
+DecodeResult receiveFrame(ClientSession &session, const uint8_t *data, size_t length, uint32_t receivedAt) {
+  DecodeResult result = decodeFrame(session.decoder, data, length,
+                                    [&session, receivedAt](const ControlCommand &command) {
+                                      if (command.opcode == OP_LEASE) {
+                                        applyLeaseCommand(session, command);
+                                      } else if (session.clientId != driverClientId) {
+                                        spectatorCommandsDropped++;
+                                      } else if (isRedundantCommand(session, command)) {
+                                        redundantCommandsDropped++;
+                                      } else {
+                                        /* refreshed before the command is queued, so the deadman can't stop it */
+                                        lastFrameTime = halMillis();
+                                        if (enqueueCommand(command, receivedAt)) {
+                                          rememberCommand(session, command);
+                                        }
+                                      }
+                                    });
+  framesReceived++;
+  if (result != DECODE_OK) {
+    logEvent<LOG_INVALID_FRAME>(session.clientId, result);
+    return result;
+  }
+
+  /* the link is alive, track the gaps between frames */
+  if (session.decoder.acceptedFrames > 1 && receivedAt - session.lastReceiveTime > session.maxFrameGap) {
+    session.maxFrameGap = receivedAt - session.lastReceiveTime;
+  }
+  session.lastReceiveTime = receivedAt;
+
+  /* only the driver's frames keep the car going */
+  if (session.clientId == driverClientId) {
+    lastFrameTime = halMillis();
+  }
+  return result;
+}
+
+/*
+ * Function that returns the session of the client a UDP datagram comes from
+ * A datagram is only accepted from the address the client's WebSocket is connected from, so
+ * another device can't drive in the name of the driver
+ *
+ * @param data - the datagram
+ * @param length - the length of the datagram
+ * @param remoteAddress - the IPv4 address the datagram was sent from
+ * @return the session of the client, NULL if the datagram is malformed or doesn't come from a connected client
+ */
+ClientSession* datagramSession(const uint8_t *data, size_t length, uint32_t remoteAddress) {
+  uint32_t clientId = length >= DATAGRAM_HEADER_SIZE ? readUint32(data) : 0;
+  ClientSession *session = clientId != 0 && length <= MAX_DATAGRAM_SIZE ? findSession(clientId) : NULL;
+
+  if (session != NULL && session->remoteAddress != remoteAddress) {
+    session = NULL;
+  }
+  if (session == NULL) {
+    datagramsRejected++;
+  }
+  return session;
+}
+
+/*
+ * Function that decodes the frame of a UDP datagram and applies its commands
+ * It goes through the same decoder as the client's WebSocket frames, so a datagram overtaken by
+ * a newer frame, on either path, is dropped as stale
+ *
+ * @param session - the session of the client that sent it (see datagramSession)
+ * @param data - the datagram
+ * @param length - the length of the datagram
+ * @param receivedAt - timestamp of the reception (in microseconds)
+ * @return the result of decoding the frame
+ */
+DecodeResult receiveDatagram(ClientSession &session, const uint8_t *data, size_t length, uint32_t receivedAt) {
+  datagramsReceived++;
+  return receiveFrame(session, data + DATAGRAM_HEADER_SIZE, length - DATAGRAM_HEADER_SIZE, receivedAt);
+}
+
+/*
+ * Function that records the cycles a probe measured in its histogram, in cycles of the full clock
+ * The CPU runs at a lower clock while the car is idle (see power.h), where the same work counts
+ * fewer cycles; scaling them keeps the buckets in the microseconds they stand for. The scale is
+ * cached by setCycleScale, so a probe costs a multiplication; a probe spanning a change of clock
+ * is scaled by the clock it ends at.
+ *
+ * @param histogram - the histogram of the probe
+ * @param start - the cycle count at the start of the probe
+ */
+void recordCycles(Histogram &histogram, uint32_t start) {
+  histogram.record((halCycleCount() - start) * cycleScale);
+}
+
+/*
+ * Function that updates the scale of the probes after the CPU clock changed
+ *
+ * @param cpuMhz - the new CPU clock (in MHz)
+ */
+void setCycleScale(uint32_t cpuMhz) {
+  cycleScale = CPU_FREQUENCY_MHZ / cpuMhz;
+}
+
+/*
+ * Function that stops the car when no frame has been received for DEADMAN_TIMEOUT
+ * Clients send keepalive frames while idle, so a quiet link means the client is gone
+ * (e.g. the phone left the AP) even if the socket hasn't been closed yet
+ */
+void checkDeadman() {
+  bool moving = motorRamps[LEFT_MOTORS].target != 0 || motorRamps[RIGHT_MOTORS].target != 0;
+
+  /* an obstacle avoidance manoeuvre ends on its own */
+  if (moving && (halMillis() - lastFrameTime) >= DEADMAN_TIMEOUT && driveEvent(EVENT_DEADMAN)) {
+    deadmanStops++;
+    carStateGeneration.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+/*
+ * Function that returns the motion sound of a drive state
+ * Driven with the joystick, the car beeps while the throttle is backwards
+ *
+ * @param state - the drive state
+ * @return a mask of SOUND_BIT
+ */
+uint32_t driveSounds(DriveState state) {
+  if (state == DRIVE_ARC && driveAxis(driveThrottle) < 0) {
+    return SOUND_BIT(SOUND_REVERSING);
+  }
+  return DRIVE_OUTPUTS[state].sounds;
+}
+
+/*
+ * Function that notifies the audio task when the sounds required by the car's state change
+ */
+void handleSounds() {
+  uint32_t sounds = driveSounds(driveState);
+
+  if (honking) {
+    sounds |= SOUND_BIT(SOUND_HORN);
+  }
+
+  if (sounds != requestedSounds) {
+    requestedSounds = sounds;
+    soundRequestTime = halMicros();
+    halRequestSounds(sounds);
+  }
+}
+
+/*
+ * Function that starts avoiding an obstacle: the car brakes, or reverses with a duty and for a
+ * time that grow with the effort of the plan
+ * An avoidance in progress is only replaced by a stronger one, or extended by the same one
+ *
+ * @param plan - the reaction to the obstacle
+ */
+void startAvoidance(const AvoidancePlan &plan) {
+  const int32_t minDuty = speedToDuty(127);
+  uint32_t leftDuty = abs(motorRamps[LEFT_MOTORS].duty);
+  uint32_t rightDuty = abs(motorRamps[RIGHT_MOTORS].duty);
+  int32_t duty = 0;
+
+  /* braking lasts until the motors have ramped down to zero */
+  uint32_t time = (leftDuty > rightDuty ? leftDuty : rightDuty) * MOTOR_DECELERATION_TIME / MOTOR_DUTY_MAX + CONTROL_TICK_INTERVAL / 1000;
+
+  if (plan.action == AVOID_REVERSE) {
+    uint32_t reversingTime = (uint32_t)REVERSING_TIME * plan.effort / AVOID_EFFORT_MAX;
+    duty = minDuty + (MOTOR_DUTY_MAX - minDuty) * plan.effort / AVOID_EFFORT_MAX;
+    time = reversingTime > time ? reversingTime : time;
+  }
+
+  if (driveState == DRIVE_AVOID && duty < avoidanceDuty) {
+    return;
+  }
+
+  avoidanceDuty = duty;
+  avoidanceTime = time;
+  lastAvoidancePlan = plan;
+  if (plan.action == AVOID_REVERSE) {
+    avoidanceReversals++;
+    logEvent<LOG_OBSTACLE_REVERSE>(lastDistance, plan.closingSpeed, plan.stopDistance, time);
+  } else {
+    avoidanceBrakes++;
+    logEvent<LOG_OBSTACLE_BRAKE>(lastDistance, plan.closingSpeed, plan.stopDistance, time);
+  }
+  driveEvent(EVENT_OBSTACLE);
+}
+
+/*
+ * Function that detects obstacles and automatically avoid them, based on the time to collision
+ * (see avoidance.h)
+ */
+void detectAndAvoidObstacles() {
+  /* check if it's time to read the IR sensor */
+  if ((controlTicks % IR_SENSOR_READ_TICKS) == 0) {
+    uint32_t readTime = halMicros();
+    uint16_t samples[IR_OVERSAMPLING];
+
+    /* read the sensor several times in a row and keep the median, to reject isolated spikes */
+    for (uint8_t i = 0; i < IR_OVERSAMPLING; i++) {
+      samples[i] = halAnalogRead(IR_SENSOR);
+    }
+    uint16_t median = irMedian(samples, IR_OVERSAMPLING);
+    int32_t values[] = { median };
+    recorder.record(RECORD_IR_SAMPLE, controlTicks, values, 1);
+
+    uint16_t analogValue = irFilterSample(irFilter, median); // smooth the readings
+    uint8_t cmDistance = irDistance(analogValue); // convert to distance in cm using the precomputed table
+    lastDistance = cmDistance;
+
+    /* far readings are too coarse to tell a speed from */
+    if (cmDistance > AVOID_RANGE_MAX) {
+      distanceHistory.count = 0;
+    } else {
+      addDistance(distanceHistory, cmDistance);
+    }
+
+    /* the car closes in at least at the speed it is driven forward at */
+    int32_t duty = motorRamps[LEFT_MOTORS].duty < motorRamps[RIGHT_MOTORS].duty ? motorRamps[LEFT_MOTORS].duty
+                                                                                : motorRamps[RIGHT_MOTORS].duty;
+    int32_t drivenSpeed = duty > 0 ? duty * CAR_MAX_SPEED / MOTOR_DUTY_MAX : 0;
+    int32_t measuredSpeed = measureClosingSpeed(distanceHistory, IR_SENSOR_READ_INTERVAL);
+    int32_t closingSpeed = measuredSpeed > drivenSpeed ? measuredSpeed : drivenSpeed;
+
+    /* the distance covered while braking from a constant deceleration is half of it at a constant speed */
+    uint32_t stoppingTime = AVOID_REACTION_TIME + (duty > 0 ? (uint32_t)duty * MOTOR_DECELERATION_TIME / MOTOR_DUTY_MAX / 2 : 0);
+
+    /* check if the car would stop too close to the obstacle */
+    AvoidancePlan plan = planAvoidance(cmDistance, closingSpeed, stoppingTime);
+    if (plan.action != AVOID_NONE) {
+      startAvoidance(plan);
+      reactionTime.record(halMicros() - readTime); // log the time it took to react to the reading
+    }
+  }
+
+  /* stop braking or reversing after the planned time has elapsed */
+  if (driveState == DRIVE_AVOID && (halMillis() - lastObstacleAvoidedTime) >= avoidanceTime) {
+    driveEvent(EVENT_AVOIDED); // stop the car
+    carStateGeneration.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+/*
+ * Function that tells the power governor whether anything needs the car, and has its decision
+ * applied when it changes
+ */
+void updatePowerGovernor() {
+  bool clientConnected = false;
+  for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+    clientConnected = clientConnected || sessions[i].clientId != 0;
+  }
+
+  uint32_t now = halMillis();
+  bool busy = motorRamps[LEFT_MOTORS].duty != 0 || motorRamps[RIGHT_MOTORS].duty != 0 ||
+              motorRamps[LEFT_MOTORS].target != 0 || motorRamps[RIGHT_MOTORS].target != 0 || requestedSounds != 0 ||
+              (clientConnected && now - lastActivityTime < POWER_IDLE_TIMEOUT);
+
+  if (powerUpdate(powerGovernor, busy, now)) {
+    halSetPowerState(powerGovernor.state == POWER_IDLE, lastActivityMicros);
+  }
+}
+
+/*
+ * Function that runs one control tick of the car logic
+ * Applies the received commands, samples the infrared sensor and updates the requested sounds
+ */
+void runControlTick() {
+  /* record the frames received since the last tick, for the deadman to be replayed */
+  uint32_t frameTime = lastFrameTime;
+  if (frameTime != recordedFrameTime) {
+    int32_t values[] = { (int32_t)(halMillis() - frameTime) };
+    recorder.record(RECORD_LINK, controlTicks, values, 1);
+    recordedFrameTime = frameTime;
+  }
+
+  /* apply the commands received from the clients */
+  processCommands();
+
+  /* check the state of the obstacle avoidance feature */
+  if (avoidObstacles == true) {
+    uint32_t start = halCycleCount();
+    detectAndAvoidObstacles(); // detect and avoid potential collision
+    recordCycles(obstacleDetectionCycles, start);
+  }
+
+  /* stop the car if the link went quiet */
+  checkDeadman();
+
+  /* ramp the motors towards the requested duty */
+  updateMotors();
+  recordAppliedCommands();
+
+  /* notify the audio task about the sounds to play */
+  uint32_t start = halCycleCount();
+  handleSounds();
+  recordCycles(handleSoundsCycles, start);
+
+  /* save power while nothing needs the car */
+  updatePowerGovernor();
+
+  /* record the changes of the lights */
+  uint8_t lights = (((outputPins >> HEADLIGHTS) & 1) << 1) | ((outputPins >> TAILLIGHTS) & 1);
+  if (lights != recordedLights) {
+    int32_t values[] = { lights >> 1, lights & 1 };
+    recorder.record(RECORD_LIGHTS, controlTicks, values, 2);
+    recordedLights = lights;
+  }
+
+  /* send the records to the storage regularly, even if the buffer isn't full */
+  if ((controlTicks % RECORDER_HANDOVER_TICKS) == 0) {
+    recorder.handOver();
+  }
+
+  controlTicks++;
+}
+
+/*
+ * Function that starts recording the drive session
+ * Must be called before the control tick starts, the records are then only made by the control tick
+ */
+void startRecording() {
+  recorder.enabled = true;
+
+  int32_t values[] = { (int32_t)controlTicks, (int32_t)halMillis() };
+  recorder.record(RECORD_START, controlTicks, values, 2);
+}
+
+/*
+ * Function that writes out the messages waiting in the log buffer, from the log task
+ * The records dropped since the last call are reported first
+ *
+ * @return the number of messages written
+ */
+uint32_t drainLog() {
+  char line[LOG_LINE_SIZE];
+  LogRecord record;
+  uint32_t count = 0;
+
+  uint32_t dropped = logBuffer.dropped.load(std::memory_order_relaxed);
+  if (dropped != reportedLogDrops) {
+    halLog("%u log messages dropped\n", dropped - reportedLogDrops);
+    reportedLogDrops = dropped;
+  }
+
+  while (logBuffer.pop(record)) {
+    formatLogRecord(record, line, sizeof(line));
+    halLog("%s", line);
+    count++;
+  }
+  return count;
+}
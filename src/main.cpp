@@ -1,685 +1,1705 @@
-#include <Arduino.h>
-#include <WiFi.h>
-#include <AsyncTCP.h>
-#include <ESPAsyncWebServer.h>
-#include <SD.h>
-#include <SPI.h>
-#include <AudioGeneratorWAV.h>
-#include <AudioOutputI2S.h>
-#include <AudioFileSourceSD.h>
-
-/* flags related to the commands given to the car */
-#define STOP_WHEELS 0
-#define MOVE_FORWARD 1
-#define MOVE_LEFT 2
-#define MOVE_RIGHT 3
-#define MOVE_BACKWARDS 4
-#define ACTIVATE_HORN 1
-#define TOGGLE_OBSTACLE_AVOIDANCE 1
-#define TOGGLE_HEADLIGHTS 2
-
-/* motors identifiers */
-#define LEFT_MOTORS 0
-#define RIGHT_MOTORS 1
-
-/* pins used by the motors */
-#define LEFT_MOTORS_EN 32
-#define LEFT_MOTORS_IN1 13
-#define LEFT_MOTORS_IN2 27
-#define RIGHT_MOTORS_IN3 14
-#define RIGHT_MOTORS_IN4 12
-#define RIGHT_MOTORS_EN 33
-
-/* pin used by the infrared distance sensor */
-#define IR_SENSOR 35
-
-/* the time period for the infrared sensor to read data */
-#define IR_SENSOR_READ_INTERVAL 25
-
-/* the duration of car reversing when avoiding an obstacle */
-#define REVERSING_TIME 250
-
-/* the distance at which an obstacle should be avoided */
-#define OBSTACLE_DISTANCE_THRESHOLD 15
-
-/* pins assigned to the LEDs for headlights and taillights */
-#define HEADLIGHTS 17
-#define TAILLIGHTS 16
-
-/* pins used by the SD Card Module using the SPI protocol */
-#define SD_CS    5
-#define SD_SCLK  18
-#define SD_MOSI  23
-#define SD_MISO  19
-
-/* file paths for the audio files */
-#define ACCELERATION_SOUND_PATH "/acceleration.wav"
-#define HORN_SOUND_PATH "/horn.wav"
-#define REVERSING_SOUND_PATH "/reverse.wav"
-
-/* credentials of the Wi-Fi AP */
-const char* SSID = "Wi-Fi_RC_Car";
-const char* password = "qwerty123";
-
-/* indicates whether the car is accelerating */
-bool accelerating = false;
-
-/* indicates whether the car is honking */
-bool honking = false;
-
-/* indicates whether the car is reversing */
-bool reversing = false;
-
-/* indicates whether any sound playback has stopped */
-bool soundStopped = true;
-
-/* indicates the current state of the obstacle avoidance feature */
-bool avoidObstacles = false;
-
-/* indicates whether any obstacle has been successfully avoided */
-bool obstacleAvoided = false;
-
-/* timestamp of the last sensor reading */
-unsigned long lastSensorReadTime = 0;
-
-/* timestamp of the last obstacle avoidance event */
-unsigned long lastObstacleAvoidedTime = 0;
-
-/* audio objects */
-AudioGeneratorWAV *wav;
-AudioFileSourceSD *file;
-AudioOutputI2S *out;
-
-/* create AsyncWebServer object on port 80 */
-AsyncWebServer server(80);
-
-/* create an AsyncWebSocket object to handle connections on the /ws path */
-AsyncWebSocket ws("/ws");
-
-/* store the HTML, CSS and JavaScript for the web page */
-const char indexHtml[] PROGMEM = R"rawliteral(
-<!DOCTYPE html>
-<html>
-    <head>
-        <meta name="viewport" content="width=device-width, initial-scale=1, maximum-scale=1, user-scalable=no">
-        <title>Wi-Fi RC Car</title>
-        <style>
-            body {
-                display: flex;
-                flex-direction: column;
-                justify-content: center;
-                align-items: center;
-                height: 100vh;
-                margin: 0;
-                font-family: Arial, sans-serif;
-                background-color: #1c1c1c;
-                color: #ffffff;
-                overflow: hidden;
-            }
-            .title {
-                font-size: 2em;
-                font-weight: bold;
-                margin-bottom: 20px;
-                color: #ffffff;
-                text-align: center;
-            }
-            .controller {
-                display: grid;
-                grid-template-rows: repeat(6, 1fr);
-                grid-template-columns: repeat(3, 1fr);
-                gap: 10px;
-                width: 100%;
-                max-width: 320px;
-                height: 100%;
-                max-height: 500px;
-            }
-            .button {
-                display: flex;
-                justify-content: center;
-                align-items: center;
-                background-color: #007bff;
-                color: white;
-                font-size: 5vw;
-                font-weight: bold;
-                border: none;
-                border-radius: 10px;
-                cursor: pointer;
-                outline: none;
-                -webkit-tap-highlight-color: rgba(0, 0, 0, 0);
-                box-shadow: 0 4px 6px rgba(0, 0, 0, 0.3);
-                transition: background-color 0.2s, transform 0.2s;
-            }
-            .button:active {
-                background-color: #0056b3;
-                transform: translateY(2px);
-            }
-            .empty {
-                pointer-events: none;
-                background: none;
-                box-shadow: none;
-            }
-            .noselect {
-                -webkit-touch-callout: none;
-                -webkit-user-select: none;
-                -khtml-user-select: none;
-                -moz-user-select: none;
-                -ms-user-select: none;
-                user-select: none;
-            }
-            .slider-container {
-                grid-column: 1 / span 3;
-                display: flex;
-                flex-direction: column;
-                justify-content: center;
-                align-items: center;
-                background-color: #333;
-                padding: 10px;
-                border-radius: 10px;
-                box-shadow: 0 4px 6px rgba(0, 0, 0, 0.3);
-            }
-            .slider-title {
-                font-size: 1.2em;
-                margin-bottom: 10px;
-                color: #ffffff;
-            }
-            .slider {
-                width: 80%;
-                accent-color: #007bff;
-            }
-            :root {
-              touch-action: pan-x pan-y;
-              height: 100% 
-            }
-        </style>
-    </head>
-    <body class="noselect">
-        <div class="title">Wi-Fi RC Car</div>
-        <div class="controller">
-            <button class="button empty"></button>
-            <button class="button" ontouchstart="sendCommand('move', '1')" ontouchend="sendCommand('move', '0')">
-                &#9650;
-            </button>
-            <button class="button empty"></button>
-            <button class="button" ontouchstart="sendCommand('move', '2')" ontouchend="sendCommand('move', '0')">
-                &#9664;
-            </button>
-            <button class="button empty"></button>
-            <button class="button" ontouchstart="sendCommand('move', '3')" ontouchend="sendCommand('move', '0')">
-                &#9654;
-            </button>
-            <button class="button empty"></button>
-            <button class="button" ontouchstart="sendCommand('move', '4')" ontouchend="sendCommand('move', '0')">
-                &#9660;
-            </button>
-            <button class="button empty"></button>
-            <button class="button" ontouchstart="sendCommand('activate', '1')" ontouchend="sendCommand('activate', '0')">       	
-                Horn <br>&#128226;
-            </button>
-            <button class="button" ontouchstart="sendCommand('toggle', '1')">
-                Avoid <br> &#128679;
-            </button>
-            <button class="button" ontouchstart="sendCommand('toggle', '2')">
-                Lights <br>&#128161;
-            </button>
-            <button class="button empty"></button>
-            <div class="slider-container">
-                <div class="slider-title">Speed</div>
-                <input type="range" min="127" max="255" value="255" class="slider" id="speedSlider" oninput="sendCommand('speed', this.value)">
-            </div>
-        </div>
-        <script>
-            var gateway = `ws://${window.location.hostname}/ws`;
-            var websocket;
-
-            window.addEventListener("load", onLoad);
-
-            function initWebSocket() {
-                console.log("Trying to open a WebSocket connection...");
-                websocket = new WebSocket(gateway);
-                websocket.onopen = onOpen;
-                websocket.onclose = onClose;
-                websocket.onmessage = onMessage;
-            }
-            function onOpen(event) {
-                console.log("Connection opened");
-            }
-            function onClose(event) {
-                console.log("Connection closed");
-                setTimeout(initWebSocket, 2000);
-            }
-            function onMessage(event) {
-            }
-            function onLoad(event) {
-                initWebSocket();
-            }
-
-            function sendCommand(command, value) {
-                console.log(command, value);
-                var data = command + "" + value;
-                websocket.send(data);
-            }
-        </script>
-    </body>
-</html>
-)rawliteral";
-
-/*
- * Function that sets the direction of a specified pair of motors
- *
- * @param motors - the pair of motors to control
- * @param direction - the desired direction for the motors to spin
-*/
-void setMotorsDirection(uint8_t motors, uint8_t direction) {
-  if (motors == LEFT_MOTORS) {
-    switch (direction) {
-      case MOVE_FORWARD: // move left motors forward
-        digitalWrite(LEFT_MOTORS_IN1, LOW);
-        digitalWrite(LEFT_MOTORS_IN2, HIGH); 
-        break;
-      case MOVE_BACKWARDS: // move left motors backwards
-        digitalWrite(LEFT_MOTORS_IN1, HIGH);
-        digitalWrite(LEFT_MOTORS_IN2, LOW);
-        break;
-      default: // stop left motors
-        digitalWrite(LEFT_MOTORS_IN1, LOW);
-        digitalWrite(LEFT_MOTORS_IN2, LOW);
-        break;
-    }
-  } else if (motors == RIGHT_MOTORS) {
-    switch (direction) {
-      case MOVE_FORWARD: // move right motors forward
-        digitalWrite(RIGHT_MOTORS_IN3, LOW);
-        digitalWrite(RIGHT_MOTORS_IN4, HIGH); 
-        break;
-      case MOVE_BACKWARDS: // move right motors backwards
-        digitalWrite(RIGHT_MOTORS_IN3, HIGH);
-        digitalWrite(RIGHT_MOTORS_IN4, LOW);
-        break;
-      default: // stop right motors
-        digitalWrite(RIGHT_MOTORS_IN3, LOW);
-        digitalWrite(RIGHT_MOTORS_IN4, LOW);
-        break;
-    }
-  }
-}
-
-/*
- * Function that handles the move command given to the car by controlling the motor directions
- * and updating the car's state (accelerating, reversing, etc.)
- *
- * @param direction - the desired direction for the car to move
- */
-void moveWheels(uint8_t direction) {
-  /* check if an obstacle was recently avoided, which might have caused the car to reverse */
-  if (obstacleAvoided) {
-    /* stop the motors before changing direction to prevent both input pins of a motor from being HIGH simultaneously */
-    setMotorsDirection(LEFT_MOTORS, STOP_WHEELS);
-    setMotorsDirection(RIGHT_MOTORS, STOP_WHEELS);
-
-    /* reset the obstacle avoidance state */
-    obstacleAvoided = false;
-  }
-
-  /* handle the desired movement direction */
-  switch (direction) {
-    case MOVE_FORWARD: // move the car forward
-      /* set both pairs of motors to move forward */
-      setMotorsDirection(LEFT_MOTORS, MOVE_FORWARD);
-      setMotorsDirection(RIGHT_MOTORS, MOVE_FORWARD);
-
-      /* turn off the taillights */
-      digitalWrite(TAILLIGHTS, LOW);
-
-      /* update the car's state to indicate it is accelerating, allowing the corresponding sound to be played */
-      accelerating = true;
-      reversing = false;
-      break;
-
-    case MOVE_BACKWARDS: // move the car backwards
-      /* set both pairs of motors to move backwards */
-      setMotorsDirection(LEFT_MOTORS, MOVE_BACKWARDS);
-      setMotorsDirection(RIGHT_MOTORS, MOVE_BACKWARDS);
-
-      /* turn off the taillights */
-      digitalWrite(TAILLIGHTS, LOW);
-
-      /* update the car's state to indicate it is reversing, allowing the corresponding sound to be played */
-      accelerating = false;
-      reversing = true;
-      break;
-
-    case MOVE_LEFT: // turn the car left
-      /* set left motors to move backward */
-      setMotorsDirection(LEFT_MOTORS, MOVE_BACKWARDS);
-
-      /* set right motors to move forward */
-      setMotorsDirection(RIGHT_MOTORS, MOVE_FORWARD);
-
-      /* turn off the taillights */
-      digitalWrite(TAILLIGHTS, LOW);
-      break;
-
-    case MOVE_RIGHT: // turn the car right
-      /* set left motors to move forward */
-      setMotorsDirection(LEFT_MOTORS, MOVE_FORWARD);
-
-      /* set right motors to move backward */
-      setMotorsDirection(RIGHT_MOTORS, MOVE_BACKWARDS);
-
-      /* turn off the taillights */
-      digitalWrite(TAILLIGHTS, LOW);
-      break;
-
-    default: // stop the car
-      /* stop both pairs of wheels */
-      setMotorsDirection(LEFT_MOTORS, STOP_WHEELS);
-      setMotorsDirection(RIGHT_MOTORS, STOP_WHEELS);
-
-      /* turn on the taillights to indicate braking */
-      digitalWrite(TAILLIGHTS, HIGH);
-
-      /* update the car's state to indicate it is neither accelerating nor reversing */
-      accelerating = false;
-      reversing = false;
-      break;
-  }
-}
-
-/*
- * Function that sets the motors speed using PWM
- *
- * @param speedValue - the desired speed value (127-255)
- */
-void setMotorsSpeed(uint8_t speedValue) {
-  analogWrite(LEFT_MOTORS_EN, speedValue);  // set speed for left motors
-  analogWrite(RIGHT_MOTORS_EN, speedValue); // set speed for right motors
-}
-
-/*
- * Function that activates a specific feature of the car
- *
- * @param feature - the feature to activate
- */
-void activateFeature(uint8_t feature) {
-  switch (feature) {
-    case ACTIVATE_HORN:
-      honking = true; // enable the horn
-      break;
-    default:
-      honking = false; // disable the horn by default
-      break;
-  }
-}
-
-/*
- * Function that toggles a specific feature of the car
- *
- * @param feature - the feature to toggle
- */
-void toggleFeature(uint8_t feature) {
-  switch (feature) {
-    case TOGGLE_HEADLIGHTS:
-      /* toggle the headlights on or off */
-      digitalWrite(HEADLIGHTS, !digitalRead(HEADLIGHTS));
-      break;
-    case TOGGLE_OBSTACLE_AVOIDANCE:
-      /* toggle the obstacle avoidance feature */
-      avoidObstacles = !avoidObstacles;
-      break;
-    default:
-      break; /* do nothing for unrecognized features */
-  }
-}
-
-/*
- * Function that handles incoming WebSocket messages from clients
- *
- * @param arg - pointer to the WebSocket frame information
- * @param data - the data received from the client
- * @param len - the length of the data
- */
-void handleWebSocketMessage(void *arg, uint8_t *data, size_t len) {
-  AwsFrameInfo *info = (AwsFrameInfo*)arg;
-  
-  /* ensure the message is complete, not fragmented, and is a text frame */
-  if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT) {
-    data[len] = 0; // null-terminate the received string
-    
-    /* check for a "speed" command */
-    if (strncmp((char*)data, "speed", 5) == 0) {
-      int speedValue = atoi((char*)data + 5); // extract speed value
-      setMotorsSpeed(speedValue); // set the motors' speed
-      Serial.printf("command: %s, value: %d\n", "speed", speedValue); 
-      return;
-    }
-    
-    /* extract the value from the last character of the data */
-    int value = data[len - 1] - '0';
-    data[len - 1] = 0; // null-terminate the command string
-    
-    Serial.printf("command: %s, value: %d\n", (char*)data, value); 
-    
-    /* handle commands based on the received data */
-    if (strcmp((char*)data, "move") == 0) {
-      moveWheels(value); // handle movement commands
-    } else if (strcmp((char*)data, "activate") == 0) {
-      activateFeature(value); // handle feature activation
-    } else if (strcmp((char*)data, "toggle") == 0) {
-      toggleFeature(value); // handle feature toggling
-    }
-  }
-}
-
-
-/*
- * Function that handles WebSocket events such as client connection, disconnection, and data reception
- *
- * @param server - the WebSocket server
- * @param client - the WebSocket client
- * @param type - the type of WebSocket event
- * @param arg - pointer to additional event information
- * @param data - the data sent by the client (if applicable)
- * @param len - the length of the data (if applicable)
- */
-void onWebSocketEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
-  switch (type) {
-    case WS_EVT_CONNECT: // handle client connection
-      Serial.printf("WebSocket client #%u connected from %s\n", 
-                    client->id(), 
-                    client->remoteIP().toString().c_str());
-      break;
-    case WS_EVT_DISCONNECT: // handle client disconnection
-      Serial.printf("WebSocket client #%u disconnected\n", client->id());
-      break;
-    case WS_EVT_DATA: // handle incoming data from the client
-      handleWebSocketMessage(arg, data, len);
-      break;
-    case WS_EVT_PONG: // handle a pong response (heartbeat check)
-      // optional: add custom logic if needed
-      break;
-    case WS_EVT_ERROR: // handle a WebSocket error
-      // optional: add error-handling logic if needed
-      break;
-  }
-}
-
-/*
- * Function that initializes the WebSocket protocol
- * Sets up the WebSocket event handler and links it to the server
- */
-void initWebSocket() {
-  ws.onEvent(onWebSocketEvent); // attach the WebSocket event handler
-  server.addHandler(&ws);       // add the WebSocket handler to the server
-}
-
-/*
- * Function that handles HTTP GET requests on the root ("/") URL
- * Serves the HTML content stored in the "indexHtml" variable
- */
-void handleRootRequests() {
-  server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send_P(200, "text/html", indexHtml); // respond with the HTML page
-  });
-}
-
-/*
- * Function that initializes the motor control pins
- * Configures the pins for the left and right motors as outputs and sets their initial states
- */
-void initMotors() {
-  /* configure pins for the left motors */
-  pinMode(LEFT_MOTORS_EN, OUTPUT);   // enable pin for left motors
-  pinMode(LEFT_MOTORS_IN1, OUTPUT);  // input 1 pin for left motors
-  pinMode(LEFT_MOTORS_IN2, OUTPUT);  // input 2 pin for left motors
-
-  /* set the initial state of the left motors to stopped */
-  digitalWrite(LEFT_MOTORS_IN1, LOW);
-  digitalWrite(LEFT_MOTORS_IN2, LOW);
-
-  /* configure pins for the right motors */
-  pinMode(RIGHT_MOTORS_EN, OUTPUT);   // enable pin for right motors
-  pinMode(RIGHT_MOTORS_IN3, OUTPUT);  // input 3 pin for right motors
-  pinMode(RIGHT_MOTORS_IN4, OUTPUT);  // input 4 pin for right motors
-
-  /* set the initial state of the right motors to stopped */
-  digitalWrite(RIGHT_MOTORS_IN3, LOW);
-  digitalWrite(RIGHT_MOTORS_IN4, LOW);
-
-  /* set the initial speed of both motors to maximum */
-  analogWrite(LEFT_MOTORS_EN, 255);  // full speed for left motors
-  analogWrite(RIGHT_MOTORS_EN, 255); // full speed for right motors
-}
-
-
-/*
- * Function that initializes the SD card and audio playback system
- */
-void initSDAudio() {
-  /* initialize SPI for SD card communication */
-  SPI.begin(SD_SCLK, SD_MISO, SD_MOSI, SD_CS);
-  if (!SD.begin(SD_CS)) {
-    Serial.println("SD card initialization failed!");
-  }
-
-  /* initialize I2S for audio output (mono channel) */
-  out = new AudioOutputI2S(0, 1); // 0 = left channel, 1 = mono
-  out->SetGain(0.15); // set a lower gain to prevent distortion
-
-  /* set up audio components */
-  wav = new AudioGeneratorWAV();
-  file = new AudioFileSourceSD();
-}
-
-/*
- * Function to initialize the car's headlights and taillights
- */
-void initLights() {
-  pinMode(HEADLIGHTS, OUTPUT);
-  pinMode(TAILLIGHTS, OUTPUT);
-
-  /* turn off lights initially */
-  digitalWrite(HEADLIGHTS, LOW);
-  digitalWrite(TAILLIGHTS, LOW);
-}
-
-/*
- * Function that checks and plays a sound based on a condition
- *
- * @param filePath - path to the audio file
- * @param condition - condition to determine if the sound should play
- */
-void checkAndPlaySound(const char* filePath, bool condition) {
-  if (condition && !wav->isRunning()) {
-    file->open(filePath);
-    wav->begin(file, out);
-  } else if (condition && wav->isRunning()) {
-    wav->loop(); // continue playing the sound
-    soundStopped = false;
-  } else if (!soundStopped && !accelerating && !honking && !reversing) {
-    wav->stop(); // stop playback when no sound condition is active
-    soundStopped = true;
-  }
-}
-
-/*
- * Function that handles all sound-related functionality
- */
-void handleSounds() {
-  /* play sounds based on the current car state */
-  checkAndPlaySound(ACCELERATION_SOUND_PATH, accelerating);
-  checkAndPlaySound(HORN_SOUND_PATH, honking);
-  checkAndPlaySound(REVERSING_SOUND_PATH, reversing);
-}
-
-/*
- * Function that detects obstacles and automatically avoid them
- */
-void detectAndAvoidObstacles() {
-  /* check if it's time to read the IR sensor */
-  if ((millis() - lastSensorReadTime) >= IR_SENSOR_READ_INTERVAL) {
-    uint16_t analogValue = analogRead(IR_SENSOR); // read sensor value
-    float volts = (analogValue * 3.3) / 4095.00;  // convert to voltage
-    int cmDistance = 29.988 * pow(volts, -1.173); // convert to distance in cm
-
-    /* check if an obstacle is detected within the threshold distance */
-    if (cmDistance <= OBSTACLE_DISTANCE_THRESHOLD) {
-      moveWheels(STOP_WHEELS); // stop the car
-      accelerating = false;   // mark the fact that the car is not accelerating
-      moveWheels(MOVE_BACKWARDS); // reverse the car
-      reversing = true; // mark the fact that the car is reversing
-      lastObstacleAvoidedTime = millis(); // log the reversing start time
-      obstacleAvoided = true; // mark the fact that an obstacle was avoided
-    }
-
-    lastSensorReadTime = millis(); // log the sensor read time
-  }
-
-  /* stop reversing after the defined reversing time has elapsed */
-  if ((millis() - lastObstacleAvoidedTime) >= REVERSING_TIME && obstacleAvoided) {
-    moveWheels(STOP_WHEELS); // stop the car
-    obstacleAvoided = false; // mark the fact that the obstacle avoidance stopped
-    reversing = false; // mark the fact that the car stopped reversing
-  }
-}
-
-void setup() {
-  Serial.begin(115200);
-
-  /* start the Wi-Fi AP with the credentials defined */
-  WiFi.softAP(SSID, password);
-
-  /* print the IP address of the AP */
-  Serial.print("IP Address: ");
-  Serial.println(WiFi.softAPIP());
-  
-  /* initialize the WebSocket protocol */
-  initWebSocket();
-
-  /* handle requests on the root ("/") URL */
-  handleRootRequests();
-
-  /* start the server */
-  server.begin();
-
-  /* initialize the motors */
-  initMotors();
-
-  /* initialize the SD Card and audio playback system */
-  initSDAudio();
-
-  /* initialize the car's headlights and taillights */
-  initLights();
-} 
-
-void loop() {
-  /* limit the number of clients by closing the oldest client when maximum number of clients has been exceeded */
-  ws.cleanupClients();
-
-  /* handle all sound-related functionality */
-  handleSounds();
-
-  /* check the state of the obstacle avoidance feature */
-  if (avoidObstacles == true) {
-    detectAndAvoidObstacles(); // detect and avoid potential collision
-  }
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_wifi.h>
+#include <AsyncTCP.h>
+#include <AsyncUDP.h>
+#include <ESPAsyncWebServer.h>
+#include <SD.h>
+#include <SPI.h>
+#include <freertos/semphr.h>
+#include <AudioGeneratorWAV.h>
+#include <AudioOutputI2S.h>
+#include <AudioFileSourceSD.h>
+#include <AudioFileSourcePROGMEM.h>
+#include "car.h"
+#include "mixer.h"
+#include "adpcm.h"
+#include "synth.h"
+#include "index_html.h" // generated from web/index.html by scripts/build_web.py
+
+/* settings of the control task (above the Arduino loop, on the same core) */
+#define CONTROL_TASK_CORE 1
+#define CONTROL_TASK_PRIORITY 5
+#define CONTROL_TASK_STACK_SIZE 4096
+
+/* hardware timer driving the control tick, counting microseconds */
+#define CONTROL_TIMER 0
+#define CONTROL_TIMER_DIVIDER 80
+
+/* pins used by the SD Card Module using the SPI protocol */
+#define SD_CS    5
+#define SD_SCLK  18
+#define SD_MOSI  23
+#define SD_MISO  19
+
+/* file path for the horn, and for its IMA-ADPCM version, played instead of the WAV file when it exists */
+#define HORN_SOUND_PATH "/horn.wav"
+#define HORN_ADPCM_PATH "/horn.adp"
+
+/* the sample rate of the synthesized sounds, the audio files are expected to have the same one (in hertz) */
+#define SYNTH_SAMPLE_RATE 22050
+
+/* the pitch of the engine with the motors stopped and at full duty (in hertz) */
+#define ENGINE_IDLE_FREQUENCY 70
+#define ENGINE_MAX_FREQUENCY 280
+
+/* the pitch of the reversing beeper (in hertz) and the period it beeps at (in milliseconds) */
+#define BEEPER_FREQUENCY 1000
+#define BEEPER_PERIOD 800
+
+/* the time period for printing the runtime statistics */
+#define STATS_REPORT_INTERVAL 5000
+
+/* the longest the main loop waits for an event while the car is active, and while it is idle */
+#define LOOP_INTERVAL 10
+#define POWER_IDLE_LOOP_INTERVAL 250
+
+/* the number of sounds the mixer can play at the same time, the highest priority sounds win */
+#define MIXER_VOICES 2
+
+/* the volume of every sound in the mix (0.0 - 1.0) */
+#define ACCELERATION_SOUND_GAIN 0.6
+#define REVERSING_SOUND_GAIN 0.8
+#define HORN_SOUND_GAIN 1.0
+
+/* size of the RAM arena holding the cached audio files, files that don't fit are streamed from the SD card */
+#define SOUND_CACHE_SIZE (64 * 1024)
+
+/* settings of the audio task (pinned to the core that doesn't run the control loop) */
+#define AUDIO_TASK_CORE 0
+#define AUDIO_TASK_PRIORITY 2
+#define AUDIO_TASK_STACK_SIZE 4096
+
+/* the time period for the audio task to refill the I2S buffers while a sound is playing */
+#define AUDIO_SERVICE_INTERVAL 2
+
+/* approximate duration of the audio held by the I2S DMA buffers (in microseconds),
+ * a longer gap between two refills means the output ran dry */
+#define AUDIO_BUFFER_TIME 10000
+
+/* settings of the recorder task, which writes the drive log to the SD card */
+#define RECORDER_TASK_CORE 0
+#define RECORDER_TASK_PRIORITY 1
+#define RECORDER_TASK_STACK_SIZE 4096
+
+/* the time period for the recorder task to check for a buffer to write */
+#define RECORDER_POLL_INTERVAL 50
+
+/* settings of the log task, which writes the log messages to the serial monitor */
+#define LOG_TASK_CORE 0
+#define LOG_TASK_PRIORITY 1
+#define LOG_TASK_STACK_SIZE 4096
+
+/* the time period for the log task to check for messages to write */
+#define LOG_POLL_INTERVAL 20
+
+/* the maximum number of drive logs kept on the SD card, named /drive-000.bin to /drive-999.bin */
+#define RECORDER_MAX_LOGS 1000
+
+/* the time period for sending telemetry to the clients */
+#define TELEMETRY_INTERVAL 200
+
+/* the number of telemetry frames between two keyframes */
+#define TELEMETRY_KEYFRAME_INTERVAL 25
+
+/* the time period for sending telemetry to the spectators, the clients not holding the driver lease */
+#define SPECTATOR_TELEMETRY_INTERVAL 1000
+
+/* the number of messages waiting in a spectator's send queue above which nothing more is queued for it */
+#define SPECTATOR_MAX_QUEUED_MESSAGES 2
+
+/* the number of WebSocket message buffers kept for the telemetry and lease messages, a buffer is
+ * made the first time a message of its length finds none free and then reused by those messages */
+#define MESSAGE_POOL_SIZE 32
+
+/* the time period for pinging the clients to measure the round-trip time */
+#define HEARTBEAT_INTERVAL 500
+
+/* the time period over which the rate of received frames is measured */
+#define FRAME_RATE_INTERVAL 1000
+
+/* the UDP port the control datagrams are received on (see protocol.h) */
+#define CONTROL_UDP_PORT 4210
+
+/* credentials of the Wi-Fi AP */
+const char* SSID = "Wi-Fi_RC_Car";
+const char* password = "qwerty123";
+
+/* timestamp of the last telemetry broadcast */
+unsigned long lastTelemetryTime = 0;
+
+/* telemetry statistics */
+uint32_t telemetryFramesSent = 0;
+uint32_t telemetryFramesSkipped = 0; // frames not sent because the client's queue was full
+
+/* the pooled message buffers (locked, so AsyncWebSocket never frees them) */
+AsyncWebSocketMessageBuffer *messagePool[MESSAGE_POOL_SIZE];
+uint8_t messagePoolCount = 0;
+uint32_t messagesUnpooled = 0; // messages sent through a buffer of their own because the pool was full
+
+/* the free heap and its largest free block once the car is set up, to watch them drift */
+uint32_t setupFreeHeap = 0;
+uint32_t setupLargestHeapBlock = 0;
+uint32_t leaseMessagesSent = 0;
+
+/* rate of the frames received from the clients, all clients together */
+unsigned long lastFrameRateTime = 0;
+uint32_t lastFramesReceived = 0;
+uint32_t framesPerSecond = 0;
+uint32_t maxFramesPerSecond = 0;
+
+/* timestamp of the last statistics report */
+unsigned long lastStatsReportTime = 0;
+
+/* handle of the control task */
+TaskHandle_t controlTaskHandle = NULL;
+
+/* handle of the task running setup() and loop(), woken up by the power governor */
+TaskHandle_t loopTaskHandle = NULL;
+
+/* the power state requested by the governor, the time of the activity that woke the car up
+ * (in microseconds), and the power state applied */
+volatile bool powerIdleRequested = false;
+volatile uint32_t powerWakeTime = 0;
+bool powerIdle = false;
+
+/* hardware timer driving the control tick */
+hw_timer_t *controlTimer = NULL;
+
+/* the number of control ticks missed because the previous one took too long */
+volatile uint32_t controlTickOverruns = 0;
+
+/* the time spent in the last control tick (in microseconds) */
+volatile uint32_t lastTickDuration = 0;
+
+/* deviation of the control tick from its period (in microseconds) */
+Histogram tickJitter(TIMING_BUCKETS, TIMING_BUCKET_COUNT);
+
+/* bucket bounds (in microseconds) of the round-trip time histogram */
+const uint32_t RTT_BUCKETS[] = { 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000 };
+
+/* round-trip time of the heartbeat pings, all clients together (in microseconds) */
+Histogram linkRtt(RTT_BUCKETS, sizeof(RTT_BUCKETS) / sizeof(RTT_BUCKETS[0]));
+
+/* durations (in CPU cycles) of the hot paths, each one recorded by a single task */
+Histogram loopCycles(CYCLE_BUCKETS, CYCLE_BUCKET_COUNT);
+Histogram controlTickCycles(CYCLE_BUCKETS, CYCLE_BUCKET_COUNT);
+Histogram audioServiceCycles(CYCLE_BUCKETS, CYCLE_BUCKET_COUNT);
+Histogram webSocketMessageCycles(CYCLE_BUCKETS, CYCLE_BUCKET_COUNT);
+
+/* handle of the audio task */
+TaskHandle_t audioTaskHandle = NULL;
+
+/* audio task statistics */
+volatile uint32_t audioUnderruns = 0;   // refills that came later than AUDIO_BUFFER_TIME
+volatile uint32_t audioMaxServiceGap = 0; // the longest time between two refills (in microseconds)
+volatile uint32_t audioVoiceSteals = 0; // requested sounds left out because all voices were busy
+
+/* time from a sound being requested to its first samples reaching the I2S output (in microseconds) */
+volatile uint32_t lastTimeToFirstSample = 0;
+volatile uint32_t maxTimeToFirstSample = 0;
+
+/* timestamp of the last heartbeat */
+unsigned long lastHeartbeatTime = 0;
+
+/* serializes the accesses to the SD card of the audio and recorder tasks */
+SemaphoreHandle_t sdMutex = NULL;
+
+/* serializes the handling of the frames and sessions by the AsyncTCP and AsyncUDP tasks, so the
+ * command queue keeps a single producer at a time; the main loop takes it to read and update the
+ * sessions, but never while it calls into AsyncWebSocket, where a failed send can report a
+ * disconnection (and take the mutex again) on the same task */
+SemaphoreHandle_t frameMutex = NULL;
+
+/* whether any sound is streamed from the SD card instead of the sound cache */
+bool soundsStreamed = false;
+
+/* the drive log being recorded */
+File logFile;
+
+/* handle of the recorder task */
+TaskHandle_t recorderTaskHandle = NULL;
+
+/* handle of the log task */
+TaskHandle_t logTaskHandle = NULL;
+
+/*
+ * The engine: a rumble pulsing at half its pitch, which rises with the duty of the motors and
+ * gets brighter under load. The amplitudes at full load add up to at most 1 (see synth.h)
+ */
+const SynthPatch ENGINE_PATCH = {
+  ENGINE_IDLE_FREQUENCY * 256, ENGINE_MAX_FREQUENCY * 256,
+  { 14000, 5000, 2000 }, { 2000, 5000, 4000 }, 12000, 0
+};
+
+/* the reversing beeper: a steady tone with a touch of its third harmonic, on half of the time */
+const SynthPatch BEEPER_PATCH = {
+  BEEPER_FREQUENCY * 256, BEEPER_FREQUENCY * 256,
+  { 20000, 0, 6000 }, { 0, 0, 0 }, 0, BEEPER_PERIOD
+};
+
+/* a sound played by the car, either an audio file or synthesized */
+struct SoundAsset {
+  const SynthPatch *patch; // the description of a synthesized sound, NULL for an audio file
+  const char *path; // path of the file on the SD card
+  const char *adpcmPath; // path of its IMA-ADPCM version (see adpcm.h)
+  bool adpcm;       // whether the file played is the IMA-ADPCM version
+  float gain;       // volume of the sound in the mix
+  bool looping;     // whether the sound restarts when it ends, for as long as it is requested
+  uint32_t offset;  // offset of the file in the sound cache
+  uint32_t size;    // size of the file in bytes
+  bool cached;      // whether the file is held in the sound cache or streamed from the SD card
+};
+
+/* the audio files, indexed by sound */
+SoundAsset soundAssets[SOUND_COUNT] = {
+  { &ENGINE_PATCH, NULL, NULL, false, ACCELERATION_SOUND_GAIN, true, 0, 0, false },
+  { &BEEPER_PATCH, NULL, NULL, false, REVERSING_SOUND_GAIN, true, 0, 0, false },
+  { NULL, HORN_SOUND_PATH, HORN_ADPCM_PATH, false, HORN_SOUND_GAIN, true, 0, 0, false }
+};
+
+/* RAM arena holding the cached audio files */
+uint8_t soundCache[SOUND_CACHE_SIZE];
+
+/*
+ * Audio output that collects the samples of one voice in a block, for the mixer to combine
+ */
+class VoiceOutput : public AudioOutput {
+  public:
+    VoiceOutput() : length(0) {}
+
+    virtual bool begin() override {
+      length = 0;
+      return true;
+    }
+
+    virtual bool ConsumeSample(int16_t sample[2]) override {
+      /* the block is full, the generator will retry the sample in the next block */
+      if (length >= MIXER_BLOCK_SIZE) {
+        return false;
+      }
+      samples[length++] = ((int32_t)sample[LEFTCHANNEL] + sample[RIGHTCHANNEL]) >> 1; // downmix to mono
+      return true;
+    }
+
+    virtual bool stop() override {
+      return true;
+    }
+
+    /* the sample rate of the voice's audio file */
+    int rate() const {
+      return hertz;
+    }
+
+    int16_t samples[MIXER_BLOCK_SIZE];
+    uint16_t length;
+};
+
+/* a voice of the mixer, playing one sound */
+struct Voice {
+  int8_t sound;                       // the sound played by the voice, -1 if the voice is free
+  int16_t gain;                       // volume of the voice (Q15)
+  bool firstBlockPending;             // whether the first block of the sound has yet to be mixed
+  AudioGeneratorWAV generator;
+  AudioFileSourceSD file;
+  AudioFileSourcePROGMEM cachedFile;  // reads a cached audio file straight from RAM
+  VoiceOutput output;
+
+  /* decoding of an IMA-ADPCM asset, which doesn't go through the generator */
+  bool decoding;                      // whether the voice is decoding an IMA-ADPCM asset
+  AudioFileSource *source;            // the asset being decoded
+  AdpcmHeader asset;                  // the description of the asset
+  uint32_t samplesLeft;               // the samples of the asset not decoded yet
+  uint8_t block[ADPCM_MAX_BLOCK_SIZE]; // the last block read
+  int16_t decoded[ADPCM_BLOCK_SAMPLES(ADPCM_MAX_BLOCK_SIZE)]; // the samples of the last block
+  uint16_t decodedLength;             // the number of samples of the last block
+  uint16_t decodedPosition;           // the number of them already copied to the output
+
+  /* synthesis of a sound that has no audio file */
+  bool synthesizing;                  // whether the voice is synthesizing its sound
+  Synth synth;
+};
+
+/* the voices of the mixer */
+Voice voices[MIXER_VOICES];
+
+/* the last mixed block and the number of its samples already sent to the I2S output */
+int16_t mixBuffer[MIXER_BLOCK_SIZE];
+uint16_t mixPosition = MIXER_BLOCK_SIZE;
+
+/* indicates whether the I2S output is running */
+bool outputRunning = false;
+
+/* audio output, 0 = left channel, 1 = mono */
+AudioOutputI2S out(0, 1);
+
+/* create AsyncWebServer object on port 80 */
+AsyncWebServer server(80);
+
+/* create an AsyncWebSocket object to handle connections on the /ws path */
+AsyncWebSocket ws("/ws");
+
+/* receives the control datagrams, next to the WebSocket */
+AsyncUDP controlUdp;
+
+/*
+ * Function that returns how fragmented the free heap is
+ *
+ * @return the share of the free heap outside its largest free block (in percent)
+ */
+uint32_t heapFragmentation() {
+  uint32_t freeHeap = ESP.getFreeHeap();
+  return freeHeap > 0 ? 100 - (uint32_t)((uint64_t)ESP.getMaxAllocHeap() * 100 / freeHeap) : 0;
+}
+
+/*
+ * Function that periodically prints the runtime statistics
+ */
+void reportStats() {
+  if ((millis() - lastStatsReportTime) < STATS_REPORT_INTERVAL) {
+    return;
+  }
+  lastStatsReportTime = millis();
+
+  const CommandQueueStats &stats = commandQueue.stats;
+  Serial.printf("commands: %u queued, %u applied, %u coalesced, %u overflowed, max depth %u, latency avg %u us, max %u us\n",
+                stats.enqueued, stats.applied, stats.coalescedDrops, stats.overflowDrops, stats.maxDepth,
+                stats.applied ? (uint32_t)(stats.totalLatency / stats.applied) : 0, stats.maxLatency);
+  Serial.printf("audio: %u underruns, max refill gap %u us, %u voice steals, time to first sample last %u us, max %u us\n",
+                audioUnderruns, audioMaxServiceGap, audioVoiceSteals, lastTimeToFirstSample, maxTimeToFirstSample);
+  Serial.printf("control tick: jitter min %u us, avg %u us, p99 %u us, max %u us, %u overruns; reaction time avg %u us, max %u us\n",
+                tickJitter.count ? tickJitter.min : 0, tickJitter.mean(), tickJitter.percentile(99), tickJitter.max,
+                controlTickOverruns, reactionTime.mean(), reactionTime.max);
+  Serial.printf("telemetry: %u frames sent, %u skipped; %u pooled message buffers, %u messages unpooled\n",
+                telemetryFramesSent, telemetryFramesSkipped, messagePoolCount, messagesUnpooled);
+  Serial.printf("recorder: %u records, %u dropped, %u bytes written, last write %u us, max %u us\n",
+                recorder.stats.records, recorder.stats.droppedRecords, recorder.stats.bytesWritten,
+                recorder.stats.lastWriteTime, recorder.stats.maxWriteTime);
+  Serial.printf("link: rtt avg %u us, p99 %u us, max %u us; %u deadman stops; %u frames/s (max %u), %u redundant commands; %u datagrams, %u rejected\n",
+                linkRtt.mean(), linkRtt.percentile(99), linkRtt.max, deadmanStops, framesPerSecond, maxFramesPerSecond,
+                redundantCommandsDropped, datagramsReceived, datagramsRejected);
+  Serial.printf("lease: driver #%u, %u changes, %u spectator commands dropped\n",
+                driverClientId, leaseChanges, spectatorCommandsDropped);
+  Serial.printf("log: %u messages, %u written, %u dropped\n",
+                logBuffer.records.load(), logBuffer.written, logBuffer.dropped.load());
+  Serial.printf("power: %s at %u MHz, active %u%% of the time, %u idle periods, wake latency last %u us, max %u us\n",
+                powerIdle ? "idle" : "active", getCpuFrequencyMhz(), powerDutyCycle(powerGovernor),
+                powerGovernor.idlePeriods, powerGovernor.lastWakeLatency, powerGovernor.maxWakeLatency);
+  Serial.printf("heap: %u bytes free (%d since setup, min %u), largest block %u bytes (%d since setup), %u%% fragmented\n",
+                ESP.getFreeHeap(), (int32_t)(ESP.getFreeHeap() - setupFreeHeap), ESP.getMinFreeHeap(),
+                ESP.getMaxAllocHeap(), (int32_t)(ESP.getMaxAllocHeap() - setupLargestHeapBlock), heapFragmentation());
+}
+
+/*
+ * Function that handles incoming WebSocket messages from clients
+ * Fragmented messages are reassembled in the client's session before being decoded
+ *
+ * @param client - the WebSocket client that sent the message
+ * @param arg - pointer to the WebSocket frame information
+ * @param data - the data received from the client
+ * @param len - the length of the data
+ */
+void handleWebSocketMessage(AsyncWebSocketClient *client, void *arg, uint8_t *data, size_t len) {
+  uint32_t start = halCycleCount();
+  uint32_t receivedAt = micros();
+  AwsFrameInfo *info = (AwsFrameInfo*)arg;
+  ClientSession *session = findSession(client->id());
+
+  /* only binary messages from clients with a session are accepted */
+  if (session == NULL || info->message_opcode != WS_BINARY) {
+    return;
+  }
+
+  /* a new message starts, drop whatever was left from a previous incomplete one */
+  if (info->index == 0 && (info->num == 0 || info->opcode != WS_CONTINUATION)) {
+    session->frameLength = 0;
+  }
+
+  /* reject messages that can't be valid frames */
+  if (session->frameLength + len > MAX_FRAME_SIZE) {
+    session->decoder.malformedFrames++;
+    session->frameLength = 0;
+    return;
+  }
+
+  memcpy(session->frameBuffer + session->frameLength, data, len);
+  session->frameLength += len;
+
+  /* decode the frame once the whole message has been received */
+  if (info->final && info->index + len == info->len) {
+    receiveFrame(*session, session->frameBuffer, session->frameLength, receivedAt);
+    session->frameLength = 0;
+  }
+
+  recordCycles(webSocketMessageCycles, start);
+}
+
+
+/*
+ * Function that checks whether more messages can be queued for a client
+ * The driver's messages are only held back when its queue is full, the spectators' ones as soon
+ * as a few of them are waiting, so a slow spectator never takes buffers from the driver
+ *
+ * @param clientId - the id of the client
+ * @param client - the WebSocket client
+ */
+bool canQueueMessage(uint32_t clientId, AsyncWebSocketClient *client) {
+  if (clientId == driverClientId) {
+    return !client->queueIsFull();
+  }
+  return client->queueLen() < SPECTATOR_MAX_QUEUED_MESSAGES;
+}
+
+/*
+ * Function that sends a binary message through a pooled buffer of the same length
+ * A buffer is free again once the client has sent every message using it (its count drops back
+ * to 0), so the steady stream of telemetry and lease messages doesn't allocate a buffer each time
+ *
+ * @param client - the WebSocket client
+ * @param data - the message
+ * @param length - the length of the message
+ */
+void sendPooledMessage(AsyncWebSocketClient *client, const uint8_t *data, size_t length) {
+  for (uint8_t i = 0; i < messagePoolCount; i++) {
+    if (messagePool[i]->length() == length && messagePool[i]->count() == 0) {
+      memcpy(messagePool[i]->get(), data, length);
+      client->binary(messagePool[i]);
+      return;
+    }
+  }
+
+  /* no free buffer of this length, add one to the pool while there is room */
+  if (messagePoolCount < MESSAGE_POOL_SIZE) {
+    AsyncWebSocketMessageBuffer *buffer = ws.makeBuffer(length);
+    if (buffer != NULL) {
+      buffer->lock();
+      memcpy(buffer->get(), data, length);
+      messagePool[messagePoolCount++] = buffer;
+      client->binary(buffer);
+      return;
+    }
+  }
+
+  messagesUnpooled++;
+  client->binary(data, length);
+}
+
+/*
+ * Function that periodically measures the number of frames received per second
+ */
+void updateFrameRate() {
+  if ((millis() - lastFrameRateTime) < FRAME_RATE_INTERVAL) {
+    return;
+  }
+
+  uint32_t received = framesReceived;
+  framesPerSecond = (uint64_t)(received - lastFramesReceived) * 1000 / (millis() - lastFrameRateTime);
+  maxFramesPerSecond = max(maxFramesPerSecond, framesPerSecond);
+  lastFramesReceived = received;
+  lastFrameRateTime = millis();
+}
+
+/*
+ * Function that periodically pings every client
+ * The ping carries its send time, which the client echoes back in the pong
+ */
+void sendHeartbeats() {
+  if ((millis() - lastHeartbeatTime) < HEARTBEAT_INTERVAL) {
+    return;
+  }
+  lastHeartbeatTime = millis();
+
+  for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+    xSemaphoreTake(frameMutex, portMAX_DELAY);
+    uint32_t clientId = sessions[i].clientId;
+    xSemaphoreGive(frameMutex);
+    if (clientId == 0) {
+      continue;
+    }
+
+    AsyncWebSocketClient *client = ws.client(clientId);
+    if (client == NULL || client->status() != WS_CONNECTED) {
+      continue;
+    }
+
+    /* a backed-up client would only measure its own queue */
+    if (!canQueueMessage(clientId, client)) {
+      continue;
+    }
+
+    uint8_t payload[4];
+    uint32_t now = micros();
+    memcpy(payload, &now, sizeof(now));
+    if (client->ping(payload, sizeof(payload))) {
+      xSemaphoreTake(frameMutex, portMAX_DELAY);
+      if (sessions[i].clientId == clientId) {
+        sessions[i].pingsSent++;
+      }
+      xSemaphoreGive(frameMutex);
+    }
+  }
+}
+
+/*
+ * Function that measures the round-trip time of a heartbeat when its pong is received
+ *
+ * @param client - the WebSocket client that sent the pong
+ * @param data - the payload of the pong, the send time of the ping
+ * @param len - the length of the payload
+ */
+void handlePong(AsyncWebSocketClient *client, uint8_t *data, size_t len) {
+  ClientSession *session = findSession(client->id());
+  uint32_t sentAt;
+
+  if (session == NULL || len != sizeof(sentAt)) {
+    return;
+  }
+
+  memcpy(&sentAt, data, sizeof(sentAt));
+  session->lastRtt = micros() - sentAt;
+  session->pongsReceived++;
+  linkRtt.record(session->lastRtt);
+}
+
+/*
+ * Function that handles WebSocket events such as client connection, disconnection, and data reception
+ *
+ * @param server - the WebSocket server
+ * @param client - the WebSocket client
+ * @param type - the type of WebSocket event
+ * @param arg - pointer to additional event information
+ * @param data - the data sent by the client (if applicable)
+ * @param len - the length of the data (if applicable)
+ */
+void onWebSocketEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+  ClientSession *session;
+  bool refused = false;
+
+  xSemaphoreTake(frameMutex, portMAX_DELAY);
+  switch (type) {
+    case WS_EVT_CONNECT: // handle client connection
+      logEvent<LOG_CLIENT_CONNECTED>(client->id(), client->remoteIP()[0], client->remoteIP()[1],
+                                     client->remoteIP()[2], client->remoteIP()[3]);
+
+      /* assign a free session to the client, or refuse it if there is none */
+      session = findSession(0);
+      if (session == NULL) {
+        refused = true;
+        break;
+      }
+      connectClient(*session, client->id(), (uint32_t)client->remoteIP());
+      session->framesSinceKeyframe = TELEMETRY_KEYFRAME_INTERVAL; // start with a keyframe
+      break;
+    case WS_EVT_DISCONNECT: // handle client disconnection
+      logEvent<LOG_CLIENT_DISCONNECTED>(client->id());
+
+      /* release the session of the client, the car stops if it was the driver */
+      session = findSession(client->id());
+      if (session != NULL) {
+        disconnectClient(*session);
+      }
+      break;
+    case WS_EVT_DATA: // handle incoming data from the client
+      handleWebSocketMessage(client, arg, data, len);
+      break;
+    case WS_EVT_PONG: // handle a pong response (heartbeat check)
+      handlePong(client, data, len);
+      break;
+    case WS_EVT_ERROR: // handle a WebSocket error
+      // optional: add error-handling logic if needed
+      break;
+  }
+  xSemaphoreGive(frameMutex);
+
+  /* closed outside of the mutex, in case the disconnection is reported right away */
+  if (refused) {
+    client->close();
+  }
+}
+
+/*
+ * Function that returns the signal strength of the station connected to the AP
+ *
+ * @return the RSSI in dBm, or 0 if no station is connected
+ */
+int8_t stationRssi() {
+  wifi_sta_list_t stations;
+
+  if (esp_wifi_ap_get_sta_list(&stations) != ESP_OK || stations.num == 0) {
+    return 0;
+  }
+  return stations.sta[0].rssi;
+}
+
+/*
+ * Function that takes a snapshot of the telemetry fields
+ *
+ * @param telemetry - where to store the snapshot
+ */
+void collectTelemetry(Telemetry &telemetry) {
+  int32_t state = 0;
+  DriveState drive = driveState;
+
+  uint32_t sounds = driveSounds(drive);
+
+  if (sounds & SOUND_BIT(SOUND_ACCELERATION)) {
+    state |= TELEMETRY_STATE_ACCELERATING;
+  }
+  if (sounds & SOUND_BIT(SOUND_REVERSING)) {
+    state |= TELEMETRY_STATE_REVERSING;
+  }
+  if (honking) {
+    state |= TELEMETRY_STATE_HONKING;
+  }
+  if (drive == DRIVE_AVOID) {
+    state |= TELEMETRY_STATE_AVOIDING;
+  }
+  if (avoidObstacles) {
+    state |= TELEMETRY_STATE_AVOIDANCE_ON;
+  }
+  if (headlights) {
+    state |= TELEMETRY_STATE_HEADLIGHTS;
+  }
+
+  telemetry.fields[TELEMETRY_DISTANCE] = lastDistance;
+  telemetry.fields[TELEMETRY_STATE] = state;
+  telemetry.fields[TELEMETRY_DUTY] = max(abs(motorRamps[LEFT_MOTORS].duty), abs(motorRamps[RIGHT_MOTORS].duty));
+  telemetry.fields[TELEMETRY_FREE_HEAP] = ESP.getFreeHeap();
+  telemetry.fields[TELEMETRY_TICK_TIME] = lastTickDuration;
+  telemetry.fields[TELEMETRY_RSSI] = stationRssi();
+  telemetry.fields[TELEMETRY_COMMAND_LATENCY] = commandQueue.stats.lastLatency;
+}
+
+/*
+ * Function that periodically sends the telemetry to every client
+ * Each client gets the changes since the last frame it was sent: the driver every
+ * TELEMETRY_INTERVAL, the spectators every SPECTATOR_TELEMETRY_INTERVAL. A client that can't
+ * keep up (see canQueueMessage) is skipped, and gets the accumulated changes once it catches up
+ */
+void broadcastTelemetry() {
+  if ((millis() - lastTelemetryTime) < TELEMETRY_INTERVAL) {
+    return;
+  }
+  lastTelemetryTime = millis();
+
+  uint8_t frame[MAX_TELEMETRY_FRAME_SIZE];
+  Telemetry telemetry;
+  collectTelemetry(telemetry);
+
+  for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+    xSemaphoreTake(frameMutex, portMAX_DELAY);
+    uint32_t clientId = sessions[i].clientId;
+    bool due = clientId == driverClientId || (millis() - sessions[i].lastTelemetryTime) >= SPECTATOR_TELEMETRY_INTERVAL;
+    xSemaphoreGive(frameMutex);
+    if (clientId == 0 || !due) {
+      continue;
+    }
+
+    AsyncWebSocketClient *client = ws.client(clientId);
+    if (client == NULL || client->status() != WS_CONNECTED) {
+      continue;
+    }
+    bool ready = canQueueMessage(clientId, client);
+
+    /* the frame is encoded under the mutex, against the baseline of the session, if the client
+     * still holds it */
+    size_t length = 0;
+    xSemaphoreTake(frameMutex, portMAX_DELAY);
+    ClientSession &session = sessions[i];
+    if (session.clientId == clientId && !ready) {
+      /* don't pile up frames for a client that can't keep up */
+      session.telemetryDropped++;
+      telemetryFramesSkipped++;
+    } else if (session.clientId == clientId) {
+      bool keyframe = session.framesSinceKeyframe >= TELEMETRY_KEYFRAME_INTERVAL;
+      length = encodeTelemetry(frame, telemetry, session.telemetryBaseline, keyframe);
+      if (length > 0) { // otherwise nothing changed
+        session.framesSinceKeyframe = keyframe ? 0 : session.framesSinceKeyframe + 1;
+        session.lastTelemetryTime = millis();
+      }
+    }
+    xSemaphoreGive(frameMutex);
+
+    if (length > 0) {
+      sendPooledMessage(client, frame, length);
+      telemetryFramesSent++;
+    }
+  }
+}
+
+/*
+ * Function that tells the clients who holds the driver lease and who else is connected, when
+ * either changed since they were last told (or they just connected)
+ */
+void broadcastLease() {
+  uint8_t message[MAX_LEASE_MESSAGE_SIZE(MAX_CLIENTS - 1)];
+  uint32_t clients[MAX_CLIENTS - 1];
+
+  for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+    xSemaphoreTake(frameMutex, portMAX_DELAY);
+    uint32_t clientId = sessions[i].clientId;
+    bool pending = sessions[i].leasePending;
+    xSemaphoreGive(frameMutex);
+    if (clientId == 0 || !pending) {
+      continue;
+    }
+
+    AsyncWebSocketClient *client = ws.client(clientId);
+    if (client == NULL || client->status() != WS_CONNECTED || !canQueueMessage(clientId, client)) {
+      continue; // retried on the next iteration
+    }
+
+    /* the lease and the clients change under the mutex too, so the message holds those of the
+     * moment the pending flag is cleared */
+    xSemaphoreTake(frameMutex, portMAX_DELAY);
+    size_t length = 0;
+    if (sessions[i].clientId == clientId && sessions[i].leasePending) {
+      sessions[i].leasePending = false;
+      uint8_t clientCount = listOtherClients(clientId, clients);
+      length = encodeLeaseMessage(message, clientId, driverClientId, clients, clientCount);
+    }
+    xSemaphoreGive(frameMutex);
+
+    if (length > 0) {
+      sendPooledMessage(client, message, length);
+      leaseMessagesSent++;
+    }
+  }
+}
+
+/*
+ * Function that writes a counter or gauge in the Prometheus text format
+ *
+ * @param stream - the response to write to
+ * @param name - the name of the metric
+ * @param type - the type of the metric ("counter" or "gauge")
+ * @param help - the description of the metric
+ * @param value - the value of the metric
+ */
+void writeMetric(AsyncResponseStream *stream, const char *name, const char *type, const char *help, uint32_t value) {
+  stream->printf("# HELP %s %s\n# TYPE %s %s\n%s %u\n", name, help, name, type, name, value);
+}
+
+/*
+ * Function that writes a histogram in the Prometheus text format
+ *
+ * @param stream - the response to write to
+ * @param name - the name of the metric
+ * @param help - the description of the metric
+ * @param histogram - the histogram to write
+ */
+void writeHistogram(AsyncResponseStream *stream, const char *name, const char *help, const Histogram &histogram) {
+  uint32_t cumulative = 0;
+
+  stream->printf("# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+  for (uint8_t bucket = 0; bucket < histogram.bucketCount; bucket++) {
+    cumulative += histogram.counts[bucket];
+    stream->printf("%s_bucket{le=\"%u\"} %u\n", name, histogram.bounds[bucket], cumulative);
+  }
+  stream->printf("%s_bucket{le=\"+Inf\"} %u\n", name, histogram.count);
+  stream->printf("%s_sum %llu\n%s_count %u\n", name, histogram.sum, name, histogram.count);
+}
+
+/*
+ * Function that handles HTTP GET requests on the "/metrics" URL
+ * Exports the counters and the latency histograms in the Prometheus text format
+ */
+void handleMetricsRequests() {
+  server.on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request) {
+    AsyncResponseStream *stream = request->beginResponseStream("text/plain; version=0.0.4");
+    const CommandQueueStats &stats = commandQueue.stats;
+
+    writeHistogram(stream, "car_loop_cycles", "CPU cycles spent in an iteration of loop()", loopCycles);
+    writeHistogram(stream, "car_control_tick_cycles", "CPU cycles spent in a control tick", controlTickCycles);
+    writeHistogram(stream, "car_handle_sounds_cycles", "CPU cycles spent in handleSounds()", handleSoundsCycles);
+    writeHistogram(stream, "car_audio_service_cycles", "CPU cycles spent refilling the audio output", audioServiceCycles);
+    writeHistogram(stream, "car_obstacle_detection_cycles", "CPU cycles spent in detectAndAvoidObstacles()", obstacleDetectionCycles);
+    writeHistogram(stream, "car_websocket_message_cycles", "CPU cycles spent in handleWebSocketMessage()", webSocketMessageCycles);
+    writeHistogram(stream, "car_command_latency_us", "Time from a command being received to it being applied to the pins", commandLatency);
+    writeHistogram(stream, "car_tick_jitter_us", "Deviation of the control tick from its period", tickJitter);
+    writeHistogram(stream, "car_reaction_time_us", "Time from an IR sensor reading to the motors reversing", reactionTime);
+
+    writeHistogram(stream, "car_link_rtt_us", "Round-trip time of the heartbeat pings", linkRtt);
+
+    /* the sessions and the lease are summed up under the mutex, and written out after it */
+    uint32_t pingsSent = 0;
+    uint32_t pongsReceived = 0;
+    uint32_t maxFrameGap = 0;
+    uint32_t spectatorTelemetryDropped = 0;
+    xSemaphoreTake(frameMutex, portMAX_DELAY);
+    uint32_t driver = driverClientId;
+    for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+      if (sessions[i].clientId != 0) {
+        pingsSent += sessions[i].pingsSent;
+        pongsReceived += sessions[i].pongsReceived;
+        maxFrameGap = max(maxFrameGap, sessions[i].maxFrameGap);
+        if (sessions[i].clientId != driver) {
+          spectatorTelemetryDropped += sessions[i].telemetryDropped;
+        }
+      }
+    }
+    xSemaphoreGive(frameMutex);
+
+    writeMetric(stream, "car_link_pings_sent", "gauge", "Heartbeat pings sent to the connected clients", pingsSent);
+    writeMetric(stream, "car_link_pongs_received", "gauge", "Heartbeat pongs received from the connected clients", pongsReceived);
+    writeMetric(stream, "car_link_max_frame_gap_us", "gauge", "The longest time between two frames of a connected client", maxFrameGap);
+    writeMetric(stream, "car_deadman_stops_total", "counter", "Stops caused by the link going quiet", deadmanStops);
+    writeMetric(stream, "car_driver_client", "gauge", "Id of the client holding the driver lease, 0 if none", driver);
+    writeMetric(stream, "car_lease_changes_total", "counter", "Changes of the driver lease", leaseChanges);
+    writeMetric(stream, "car_lease_messages_sent_total", "counter", "Lease messages sent to the clients", leaseMessagesSent);
+    writeMetric(stream, "car_spectator_commands_dropped_total", "counter", "Commands ignored because their client doesn't hold the lease", spectatorCommandsDropped);
+    writeMetric(stream, "car_spectator_telemetry_dropped", "gauge", "Telemetry frames not sent to the connected spectators because of backpressure", spectatorTelemetryDropped);
+
+    writeMetric(stream, "car_frames_received_total", "counter", "Frames received from the clients", framesReceived);
+    writeMetric(stream, "car_frames_per_second", "gauge", "Frames received per second, all clients together", framesPerSecond);
+    writeMetric(stream, "car_frames_per_second_max", "gauge", "The highest number of frames received in a second", maxFramesPerSecond);
+    writeMetric(stream, "car_commands_redundant_total", "counter", "Commands dropped because they repeated the previous one of their kind", redundantCommandsDropped);
+    writeMetric(stream, "car_datagrams_received_total", "counter", "Control frames received over UDP", datagramsReceived);
+    writeMetric(stream, "car_datagrams_rejected_total", "counter", "UDP datagrams dropped because they didn't come from a connected client", datagramsRejected);
+    writeMetric(stream, "car_commands_received_total", "counter", "Commands accepted by the command queue", stats.enqueued);
+    writeMetric(stream, "car_commands_applied_total", "counter", "Commands applied by the control task", stats.applied);
+    writeMetric(stream, "car_commands_coalesced_total", "counter", "Commands superseded by a newer command", stats.coalescedDrops);
+    writeMetric(stream, "car_commands_overflowed_total", "counter", "Commands dropped because the queue was full", stats.overflowDrops);
+    writeMetric(stream, "car_command_queue_max_depth", "gauge", "The highest number of commands waiting at once", stats.maxDepth);
+    writeMetric(stream, "car_avoidance_brakes_total", "counter", "Obstacle avoidances that braked to a stop", avoidanceBrakes);
+    writeMetric(stream, "car_avoidance_reversals_total", "counter", "Obstacle avoidances that reversed", avoidanceReversals);
+    writeMetric(stream, "car_avoidance_last_ttc_ms", "gauge", "Time to collision when the last avoidance started", lastAvoidancePlan.timeToCollision);
+    writeMetric(stream, "car_avoidance_last_closing_speed", "gauge", "Closing speed (cm/s) when the last avoidance started", lastAvoidancePlan.closingSpeed);
+    writeMetric(stream, "car_drive_state", "gauge", "The drive state of the car (DriveState)", driveState);
+    writeMetric(stream, "car_gpio_writes_total", "counter", "Batched writes of the output pins, made only when a pin changes", gpioWrites);
+    writeMetric(stream, "car_tick_overruns_total", "counter", "Control ticks missed", controlTickOverruns);
+    writeMetric(stream, "car_audio_underruns_total", "counter", "Audio refills later than the I2S buffer time", audioUnderruns);
+    writeMetric(stream, "car_audio_voice_steals_total", "counter", "Sounds left out because all voices were busy", audioVoiceSteals);
+    writeMetric(stream, "car_telemetry_frames_sent_total", "counter", "Telemetry frames sent", telemetryFramesSent);
+    writeMetric(stream, "car_telemetry_frames_skipped_total", "counter", "Telemetry frames skipped because of backpressure", telemetryFramesSkipped);
+    writeMetric(stream, "car_message_pool_buffers", "gauge", "WebSocket message buffers kept for the telemetry and lease messages", messagePoolCount);
+    writeMetric(stream, "car_messages_unpooled_total", "counter", "Messages sent through a buffer of their own because the pool was full", messagesUnpooled);
+    writeMetric(stream, "car_recorder_records_total", "counter", "Records added to the drive log", recorder.stats.records);
+    writeMetric(stream, "car_recorder_dropped_total", "counter", "Records dropped because both log buffers were busy", recorder.stats.droppedRecords);
+    writeMetric(stream, "car_recorder_bytes_written_total", "counter", "Bytes of drive log written to the SD card", recorder.stats.bytesWritten);
+    writeMetric(stream, "car_recorder_max_write_us", "gauge", "The longest write of a drive log buffer", recorder.stats.maxWriteTime);
+    writeMetric(stream, "car_log_messages_total", "counter", "Messages added to the log buffer", logBuffer.records.load());
+    writeMetric(stream, "car_log_dropped_total", "counter", "Log messages dropped because the log buffer was full", logBuffer.dropped.load());
+    writeMetric(stream, "car_power_idle", "gauge", "Whether the car is idle, at a lower clock and with modem sleep", powerIdle);
+    writeMetric(stream, "car_power_duty_cycle_percent", "gauge", "Share of the time the car was active", powerDutyCycle(powerGovernor));
+    writeMetric(stream, "car_power_idle_periods_total", "counter", "Times the car went idle", powerGovernor.idlePeriods);
+    writeMetric(stream, "car_power_wake_latency_us", "gauge", "Time from the activity that last woke the car up to the full clock", powerGovernor.lastWakeLatency);
+    writeMetric(stream, "car_power_max_wake_latency_us", "gauge", "The longest time from an activity to the full clock", powerGovernor.maxWakeLatency);
+    writeMetric(stream, "car_free_heap_bytes", "gauge", "Free heap", ESP.getFreeHeap());
+    writeMetric(stream, "car_min_free_heap_bytes", "gauge", "The lowest free heap since startup", ESP.getMinFreeHeap());
+    writeMetric(stream, "car_heap_largest_block_bytes", "gauge", "The largest free block of the heap", ESP.getMaxAllocHeap());
+    writeMetric(stream, "car_heap_fragmentation_percent", "gauge", "Share of the free heap outside its largest free block", heapFragmentation());
+    writeMetric(stream, "car_websocket_clients", "gauge", "Connected WebSocket clients", ws.count());
+
+    request->send(stream);
+  });
+}
+
+/*
+ * Function that initializes the WebSocket protocol
+ * Sets up the WebSocket event handler and links it to the server
+ */
+void initWebSocket() {
+  ws.onEvent(onWebSocketEvent); // attach the WebSocket event handler
+  server.addHandler(&ws);       // add the WebSocket handler to the server
+}
+
+/*
+ * Function that handles a control datagram received over UDP
+ * Runs on the AsyncUDP task, so it takes the frame mutex like the WebSocket events do
+ *
+ * @param packet - the datagram
+ */
+void handleControlDatagram(AsyncUDPPacket &packet) {
+  uint32_t receivedAt = micros();
+
+  xSemaphoreTake(frameMutex, portMAX_DELAY);
+  ClientSession *session = datagramSession(packet.data(), packet.length(), (uint32_t)packet.remoteIP());
+  if (session != NULL) {
+    receiveDatagram(*session, packet.data(), packet.length(), receivedAt);
+  }
+  xSemaphoreGive(frameMutex);
+}
+
+/*
+ * Function that starts receiving the control datagrams
+ */
+void initControlUdp() {
+  if (controlUdp.listen(CONTROL_UDP_PORT)) {
+    controlUdp.onPacket(handleControlDatagram);
+  } else {
+    Serial.println("The UDP control port couldn't be opened, control is WebSocket only");
+  }
+}
+
+/*
+ * Function that checks whether an If-None-Match header names an entity tag
+ * The header is a comma-separated list of tags, weak ones (W/"...") compare like strong ones
+ * (RFC 9110 uses the weak comparison here), and "*" matches any tag
+ *
+ * @param header - the value of the header
+ * @param etag - the entity tag, with its quotes
+ * @return whether the header names the tag
+ */
+bool ifNoneMatchMatches(const char *header, const char *etag) {
+  size_t etagLength = strlen(etag);
+
+  while (*header != '\0') {
+    /* skip the separators, then find the end of the tag */
+    while (*header == ' ' || *header == '\t' || *header == ',') {
+      header++;
+    }
+    const char *end = header;
+    while (*end != '\0' && *end != ',') {
+      end++;
+    }
+    size_t length = end - header;
+    while (length > 0 && (header[length - 1] == ' ' || header[length - 1] == '\t')) {
+      length--;
+    }
+
+    if (length == 1 && header[0] == '*') {
+      return true;
+    }
+    const char *tag = header;
+    if (length > 2 && tag[0] == 'W' && tag[1] == '/') {
+      tag += 2;
+      length -= 2;
+    }
+    if (length == etagLength && strncmp(tag, etag, length) == 0) {
+      return true;
+    }
+    header = end;
+  }
+  return false;
+}
+
+/*
+ * Function that handles HTTP GET requests on the root ("/") URL
+ * Serves the gzipped page generated at build time (see scripts/build_web.py), which browsers
+ * revalidate on every load: a cached copy is confirmed with a bodyless 304 response
+ */
+void handleRootRequests() {
+  server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
+    AsyncWebServerResponse *response;
+
+    /* the browser already has this version of the page */
+    AsyncWebHeader *ifNoneMatch = request->getHeader("If-None-Match");
+    if (ifNoneMatch != NULL && ifNoneMatchMatches(ifNoneMatch->value().c_str(), INDEX_HTML_ETAG)) {
+      response = request->beginResponse(304);
+    } else {
+      response = request->beginResponse_P(200, "text/html", indexHtmlGz, sizeof(indexHtmlGz));
+      response->addHeader("Content-Encoding", "gzip");
+    }
+
+    response->addHeader("ETag", INDEX_HTML_ETAG);
+    response->addHeader("Cache-Control", "no-cache"); // cache, but check for a new firmware first
+    request->send(response);
+  });
+}
+
+/*
+ * Function that initializes the motor control pins
+ * Configures the pins for the left and right motors as outputs and sets their initial states
+ */
+void initMotors() {
+  /* configure pins for the left motors */
+  pinMode(LEFT_MOTORS_EN, OUTPUT);   // enable pin for left motors
+  pinMode(LEFT_MOTORS_IN1, OUTPUT);  // input 1 pin for left motors
+  pinMode(LEFT_MOTORS_IN2, OUTPUT);  // input 2 pin for left motors
+
+  /* set the initial state of the left motors to stopped */
+  digitalWrite(LEFT_MOTORS_IN1, LOW);
+  digitalWrite(LEFT_MOTORS_IN2, LOW);
+
+  /* configure pins for the right motors */
+  pinMode(RIGHT_MOTORS_EN, OUTPUT);   // enable pin for right motors
+  pinMode(RIGHT_MOTORS_IN3, OUTPUT);  // input 3 pin for right motors
+  pinMode(RIGHT_MOTORS_IN4, OUTPUT);  // input 4 pin for right motors
+
+  /* set the initial state of the right motors to stopped */
+  digitalWrite(RIGHT_MOTORS_IN3, LOW);
+  digitalWrite(RIGHT_MOTORS_IN4, LOW);
+
+  /* drive the enable pins with the LEDC peripheral, starting with the motors unpowered */
+  ledcSetup(LEFT_MOTORS_PWM_CHANNEL, MOTOR_PWM_FREQUENCY, MOTOR_PWM_RESOLUTION);
+  ledcAttachPin(LEFT_MOTORS_EN, LEFT_MOTORS_PWM_CHANNEL);
+  ledcWrite(LEFT_MOTORS_PWM_CHANNEL, 0);
+  ledcSetup(RIGHT_MOTORS_PWM_CHANNEL, MOTOR_PWM_FREQUENCY, MOTOR_PWM_RESOLUTION);
+  ledcAttachPin(RIGHT_MOTORS_EN, RIGHT_MOTORS_PWM_CHANNEL);
+  ledcWrite(RIGHT_MOTORS_PWM_CHANNEL, 0);
+}
+
+
+/*
+ * Function that loads the audio files from the SD card in the sound cache
+ * The files are loaded by decreasing priority, so the horn is the first to get space;
+ * a file that doesn't fit in the remaining space is streamed from the SD card instead.
+ * The IMA-ADPCM version of a sound is preferred, at a quarter of the size of the WAV file
+ */
+void loadSoundCache() {
+  uint32_t used = 0;
+
+  for (int8_t sound = SOUND_COUNT - 1; sound >= 0; sound--) {
+    SoundAsset &asset = soundAssets[sound];
+    if (asset.patch != NULL) {
+      continue; // synthesized
+    }
+
+    if (SD.exists(asset.adpcmPath)) {
+      asset.path = asset.adpcmPath;
+      asset.adpcm = true;
+    }
+
+    File audioFile = SD.open(asset.path);
+
+    if (!audioFile) {
+      Serial.printf("Sound %s not found!\n", asset.path);
+      soundsStreamed = true; // playing it will still try to open it
+      continue;
+    }
+
+    asset.size = audioFile.size();
+    if (used + asset.size <= SOUND_CACHE_SIZE && audioFile.read(soundCache + used, asset.size) == asset.size) {
+      asset.offset = used;
+      asset.cached = true;
+      used += asset.size;
+    }
+    audioFile.close();
+    soundsStreamed |= !asset.cached;
+
+    Serial.printf("Sound %s (%u bytes) %s\n", asset.path, asset.size, asset.cached ? "cached" : "streamed from the SD card");
+  }
+
+  Serial.printf("Sound cache: %u of %u bytes used\n", used, SOUND_CACHE_SIZE);
+}
+
+/*
+ * Function that initializes the SD card and audio playback system
+ */
+void initSDAudio() {
+  /* initialize SPI for SD card communication */
+  SPI.begin(SD_SCLK, SD_MISO, SD_MOSI, SD_CS);
+  if (!SD.begin(SD_CS)) {
+    Serial.println("SD card initialization failed!");
+  }
+
+  /* initialize I2S for audio output (mono channel) */
+  out.SetGain(0.15); // set a lower gain to prevent distortion
+
+  /* set up the voices of the mixer */
+  for (uint8_t i = 0; i < MIXER_VOICES; i++) {
+    voices[i].sound = -1;
+    voices[i].decoding = false;
+    voices[i].synthesizing = false;
+  }
+
+  /* load the audio files in RAM, so that playback doesn't wait for the SD card */
+  loadSoundCache();
+}
+
+/*
+ * Function to initialize the car's headlights and taillights
+ */
+void initLights() {
+  pinMode(HEADLIGHTS, OUTPUT);
+  pinMode(TAILLIGHTS, OUTPUT);
+
+  /* turn off lights initially */
+  digitalWrite(HEADLIGHTS, LOW);
+  digitalWrite(TAILLIGHTS, LOW);
+}
+
+/*
+ * Function that returns the load the synthesized sounds follow: the mean duty applied to the
+ * motors, so the engine revs up with the speed slider and with every acceleration
+ *
+ * @return the load (0 - SYNTH_LOAD_MAX)
+ */
+int32_t engineLoad() {
+  int32_t duty = abs(motorRamps[LEFT_MOTORS].duty) + abs(motorRamps[RIGHT_MOTORS].duty);
+  return duty * SYNTH_LOAD_MAX / (2 * MOTOR_DUTY_MAX);
+}
+
+/*
+ * Function that starts playing a sound on a voice, synthesized or from the sound cache if possible
+ *
+ * @param voice - the voice to play the sound on
+ * @param sound - the sound to play
+ * @return whether the sound could be started
+ */
+bool startVoice(Voice &voice, int8_t sound) {
+  const SoundAsset &asset = soundAssets[sound];
+  AudioFileSource *source;
+
+  voice.sound = sound;
+  voice.gain = mixerGain(asset.gain);
+  if (asset.patch != NULL) {
+    synthStart(voice.synth, asset.patch, engineLoad());
+    voice.output.SetRate(SYNTH_SAMPLE_RATE);
+    voice.synthesizing = true;
+    return true;
+  }
+
+  if (asset.cached) {
+    voice.cachedFile.open(soundCache + asset.offset, asset.size);
+    source = &voice.cachedFile;
+  } else {
+    voice.file.open(asset.path);
+    source = &voice.file;
+  }
+
+  if (!asset.adpcm) {
+    return voice.generator.begin(source, &voice.output);
+  }
+
+  /* an IMA-ADPCM asset is decoded by the voice itself, starting with the header */
+  uint8_t header[ADPCM_HEADER_SIZE];
+  voice.source = source;
+  voice.decoding = source->isOpen() && source->read(header, ADPCM_HEADER_SIZE) == ADPCM_HEADER_SIZE &&
+                   readAdpcmHeader(header, ADPCM_HEADER_SIZE, voice.asset);
+  if (!voice.decoding) {
+    source->close();
+    return false;
+  }
+
+  voice.output.SetRate(voice.asset.sampleRate);
+  voice.samplesLeft = voice.asset.sampleCount;
+  voice.decodedLength = 0;
+  voice.decodedPosition = 0;
+  return true;
+}
+
+/*
+ * Function that adds the next samples of an IMA-ADPCM asset to the block of a voice
+ * The asset is decoded a whole block at a time, and the samples are copied straight to the voice's
+ * block, without the per-sample calls of the generators
+ *
+ * @param voice - the voice decoding the asset
+ * @return whether the asset has samples left
+ */
+bool decodeVoice(Voice &voice) {
+  VoiceOutput &output = voice.output;
+
+  while (output.length < MIXER_BLOCK_SIZE) {
+    if (voice.decodedPosition == voice.decodedLength) {
+      if (voice.samplesLeft == 0) {
+        return false;
+      }
+
+      int32_t length = voice.source->read(voice.block, voice.asset.blockSize);
+      uint16_t count = length > 0 ? adpcmDecodeBlock(voice.block, length, voice.decoded) : 0;
+      if (count == 0) {
+        return false; // the asset is shorter than its header says
+      }
+
+      /* the last block may be padded past the end of the sound */
+      voice.decodedLength = count < voice.samplesLeft ? count : voice.samplesLeft;
+      voice.decodedPosition = 0;
+      voice.samplesLeft -= voice.decodedLength;
+    }
+
+    uint16_t count = voice.decodedLength - voice.decodedPosition;
+    if (count > MIXER_BLOCK_SIZE - output.length) {
+      count = MIXER_BLOCK_SIZE - output.length;
+    }
+    memcpy(output.samples + output.length, voice.decoded + voice.decodedPosition, count * sizeof(int16_t));
+    output.length += count;
+    voice.decodedPosition += count;
+  }
+  return true;
+}
+
+/*
+ * Function that stops the sound played by a voice and frees it
+ *
+ * @param voice - the voice to stop
+ */
+void stopVoice(Voice &voice) {
+  if (voice.generator.isRunning()) {
+    voice.generator.stop();
+  }
+  if (voice.decoding) {
+    voice.source->close();
+    voice.decoding = false;
+  }
+  voice.synthesizing = false;
+  voice.sound = -1;
+}
+
+/*
+ * Function that assigns the voices of the mixer to the requested sounds
+ * When more sounds are requested than there are voices, the highest priority ones are played (see mixer.h)
+ *
+ * @param sounds - the mask of requested sounds
+ */
+void assignVoices(uint32_t sounds) {
+  audioVoiceSteals += assignMixerVoices(voices, MIXER_VOICES, sounds, SOUND_COUNT, stopVoice, [](Voice &voice, int8_t sound) {
+    if (startVoice(voice, sound)) {
+      voice.firstBlockPending = true;
+    } else {
+      stopVoice(voice);
+    }
+  });
+}
+
+/*
+ * Function that fills the sample block of a voice
+ *
+ * @param voice - the voice to fill
+ */
+void fillVoice(Voice &voice) {
+  bool restarted = false;
+
+  /* a synthesized sound never ends, and follows the motors from one block to the next */
+  if (voice.synthesizing) {
+    synthBlock(voice.synth, engineLoad(), SYNTH_SAMPLE_RATE, voice.output.samples, MIXER_BLOCK_SIZE);
+    voice.output.length = MIXER_BLOCK_SIZE;
+    return;
+  }
+
+  voice.output.length = 0;
+  while (voice.output.length < MIXER_BLOCK_SIZE) {
+    uint16_t length = voice.output.length;
+
+    if (voice.decoding) {
+      /* stop decoding once the asset ends */
+      if (!decodeVoice(voice)) {
+        voice.source->close();
+        voice.decoding = false;
+      }
+    } else if (voice.generator.isRunning()) {
+      /* stop the generator once the file ends */
+      if (!voice.generator.loop()) {
+        voice.generator.stop();
+      } else if (voice.output.length == length) {
+        break; // the source has no data available right now
+      }
+    }
+
+    if (!voice.decoding && !voice.generator.isRunning()) {
+      /* loop the sound at most once per block, so an empty file can't stall the task */
+      if (!soundAssets[voice.sound].looping || restarted || !startVoice(voice, voice.sound)) {
+        stopVoice(voice);
+        break;
+      }
+      restarted = true;
+    }
+  }
+
+  /* pad a partial block with silence */
+  for (uint16_t i = voice.output.length; i < MIXER_BLOCK_SIZE; i++) {
+    voice.output.samples[i] = 0;
+  }
+}
+
+/*
+ * Function that mixes the next block of the active voices in the mix buffer
+ *
+ * @return whether any voice is active
+ */
+bool mixNextBlock() {
+  const int16_t *blocks[MIXER_VOICES];
+  int16_t gains[MIXER_VOICES];
+  uint8_t count = 0;
+
+  for (uint8_t i = 0; i < MIXER_VOICES; i++) {
+    Voice &voice = voices[i];
+    if (voice.sound < 0) {
+      continue;
+    }
+
+    /* the first block of a sound starts the I2S output at the sound's sample rate */
+    if (!outputRunning) {
+      out.SetRate(voice.output.rate());
+      out.SetBitsPerSample(16);
+      out.SetChannels(2);
+      out.begin();
+      outputRunning = true;
+    }
+
+    fillVoice(voice);
+    blocks[count] = voice.output.samples;
+    gains[count] = voice.gain;
+    count++;
+
+    /* the first samples of a newly requested sound are ready for the output */
+    if (voice.firstBlockPending) {
+      voice.firstBlockPending = false;
+      lastTimeToFirstSample = micros() - soundRequestTime;
+      if (lastTimeToFirstSample > maxTimeToFirstSample) {
+        maxTimeToFirstSample = lastTimeToFirstSample;
+      }
+    }
+  }
+
+  if (count == 0) {
+    return false;
+  }
+
+  mixBlock(mixBuffer, blocks, gains, count, MIXER_BLOCK_SIZE);
+  mixPosition = 0;
+  return true;
+}
+
+/*
+ * Function that feeds the I2S output with mixed samples until its buffers are full
+ *
+ * @return whether any voice is still active
+ */
+bool serviceMixer() {
+  for (;;) {
+    /* mix a new block once the previous one has been sent */
+    if (mixPosition >= MIXER_BLOCK_SIZE && !mixNextBlock()) {
+      return false;
+    }
+
+    while (mixPosition < MIXER_BLOCK_SIZE) {
+      int16_t sample[2] = { mixBuffer[mixPosition], mixBuffer[mixPosition] };
+      if (!out.ConsumeSample(sample)) {
+        return true; // the I2S buffers are full, continue later
+      }
+      mixPosition++;
+    }
+  }
+}
+
+/*
+ * Function run by the audio task
+ * Waits for the sound requests of the control loop and keeps the I2S output fed while any sound is playing
+ *
+ * @param parameter - unused
+ */
+void audioTask(void *parameter) {
+  uint32_t sounds = 0;
+  bool playing = false;
+  unsigned long lastServiceTime = 0;
+
+  for (;;) {
+    /* sleep until the requested sounds change, but wake up in time to refill the buffers while playing */
+    TickType_t timeout = playing ? pdMS_TO_TICKS(AUDIO_SERVICE_INTERVAL) : portMAX_DELAY;
+    bool requested = xTaskNotifyWait(0, 0, &sounds, timeout) == pdTRUE;
+
+    /* streamed sounds share the SD card with the recorder */
+    if (soundsStreamed) {
+      xSemaphoreTake(sdMutex, portMAX_DELAY);
+    }
+
+    if (requested) {
+      assignVoices(sounds);
+      if (!playing) {
+        lastServiceTime = micros();
+      }
+    }
+
+    /* measure the time since the last refill to detect underruns */
+    unsigned long now = micros();
+    uint32_t gap = now - lastServiceTime;
+    lastServiceTime = now;
+    if (playing && gap > audioMaxServiceGap) {
+      audioMaxServiceGap = gap;
+    }
+    if (playing && gap > AUDIO_BUFFER_TIME) {
+      audioUnderruns++;
+    }
+
+    uint32_t start = halCycleCount();
+    playing = serviceMixer();
+    recordCycles(audioServiceCycles, start);
+
+    if (soundsStreamed) {
+      xSemaphoreGive(sdMutex);
+    }
+
+    /* silence the output once every voice is done */
+    if (!playing && outputRunning) {
+      out.stop();
+      outputRunning = false;
+      mixPosition = MIXER_BLOCK_SIZE;
+    }
+  }
+}
+
+/*
+ * Function that asks the audio task to play a set of sounds (see hal.h)
+ *
+ * @param sounds - the sounds to play
+ */
+void halRequestSounds(uint32_t sounds) {
+  xTaskNotify(audioTaskHandle, sounds, eSetValueWithOverwrite);
+}
+
+/*
+ * Function that asks the main loop to apply a power state of the governor (see hal.h)
+ * The main loop is woken up, so the clock goes back up without waiting for its next iteration.
+ * Called by the control task, which sets the period of its own timer here: POWER_IDLE_TICK_INTERVAL
+ * while idle, CONTROL_TICK_INTERVAL again from the tick that woke the car up
+ *
+ * @param idle - whether the car goes idle
+ * @param since - the time (in microseconds) of the activity waking the car up
+ */
+void halSetPowerState(bool idle, uint32_t since) {
+  timerAlarmWrite(controlTimer, idle ? POWER_IDLE_TICK_INTERVAL : CONTROL_TICK_INTERVAL, true);
+  timerWrite(controlTimer, 0); // the next tick is a full period away, whichever the counter was at
+
+  powerWakeTime = since;
+  powerIdleRequested = idle;
+  if (loopTaskHandle != NULL) {
+    xTaskNotifyGive(loopTaskHandle);
+  }
+}
+
+/*
+ * Function that applies the power state requested by the governor: the CPU clock and the modem
+ * sleep. The modem sleep only saves power on a station interface; the access point keeps its
+ * radio on to send the beacons, so while it is the only interface the savings come from the clock
+ */
+void applyPowerState() {
+  if (powerIdleRequested == powerIdle) {
+    return;
+  }
+  powerIdle = powerIdleRequested;
+
+  if (powerIdle) {
+    setCpuFrequencyMhz(POWER_IDLE_CPU_MHZ);
+    setCycleScale(POWER_IDLE_CPU_MHZ);
+    esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+  } else {
+    setCpuFrequencyMhz(POWER_ACTIVE_CPU_MHZ);
+    setCycleScale(POWER_ACTIVE_CPU_MHZ);
+    esp_wifi_set_ps(WIFI_PS_NONE);
+    powerRecordWake(powerGovernor, micros() - powerWakeTime);
+  }
+}
+
+/*
+ * Function that starts the audio task
+ */
+void initAudioTask() {
+  xTaskCreatePinnedToCore(audioTask, "audio", AUDIO_TASK_STACK_SIZE, NULL, AUDIO_TASK_PRIORITY, &audioTaskHandle, AUDIO_TASK_CORE);
+}
+
+/*
+ * Function run by the recorder task
+ * Writes the buffers of the drive log to the SD card as the control tick fills them; the control
+ * tick carries on in the other buffer meanwhile, so a slow SD card never delays it
+ *
+ * @param parameter - unused
+ */
+void recorderTask(void *parameter) {
+  for (;;) {
+    vTaskDelay(pdMS_TO_TICKS(RECORDER_POLL_INTERVAL));
+
+    size_t length;
+    const uint8_t *buffer = recorder.pending(length);
+    if (buffer == NULL) {
+      continue;
+    }
+
+    xSemaphoreTake(sdMutex, portMAX_DELAY);
+    unsigned long start = micros();
+    logFile.write(buffer, length);
+    logFile.flush(); // keep the log readable if the car is switched off
+    uint32_t writeTime = micros() - start;
+    xSemaphoreGive(sdMutex);
+
+    recorder.release(writeTime);
+  }
+}
+
+/*
+ * Function that opens a new drive log on the SD card and starts recording the session
+ * The SD card must already be initialized (see initSDAudio)
+ */
+void initRecorder() {
+  char path[20];
+  uint16_t index = 0;
+
+  /* find the first free log name */
+  do {
+    snprintf(path, sizeof(path), "/drive-%03u.bin", index);
+  } while (SD.exists(path) && ++index < RECORDER_MAX_LOGS);
+
+  if (index >= RECORDER_MAX_LOGS || !(logFile = SD.open(path, FILE_WRITE))) {
+    Serial.println("Drive log can't be created, recording disabled!");
+    return;
+  }
+
+  uint8_t header[RECORDER_HEADER_SIZE];
+  logFile.write(header, writeLogHeader(header, CONTROL_TICK_INTERVAL));
+  Serial.printf("Recording the drive session to %s\n", path);
+
+  startRecording();
+  xTaskCreatePinnedToCore(recorderTask, "recorder", RECORDER_TASK_STACK_SIZE, NULL, RECORDER_TASK_PRIORITY, &recorderTaskHandle, RECORDER_TASK_CORE);
+}
+
+/*
+ * Function run by the log task
+ * Writes the messages logged by the other tasks to the serial monitor; it is the only task
+ * waiting on the UART, at a lower priority than everything else
+ *
+ * @param parameter - unused
+ */
+void logTask(void *parameter) {
+  for (;;) {
+    drainLog();
+    vTaskDelay(pdMS_TO_TICKS(LOG_POLL_INTERVAL));
+  }
+}
+
+/*
+ * Function that starts the log task
+ */
+void initLogTask() {
+  xTaskCreatePinnedToCore(logTask, "log", LOG_TASK_STACK_SIZE, NULL, LOG_TASK_PRIORITY, &logTaskHandle, LOG_TASK_CORE);
+}
+
+/*
+ * Function called by the hardware timer at every control tick
+ * Wakes up the control task
+ */
+void IRAM_ATTR onControlTimer() {
+  BaseType_t higherPriorityTaskWoken = pdFALSE;
+  vTaskNotifyGiveFromISR(controlTaskHandle, &higherPriorityTaskWoken);
+  if (higherPriorityTaskWoken) {
+    portYIELD_FROM_ISR();
+  }
+}
+
+/*
+ * Function that wakes the control task up for a tick while the car is idle (see hal.h)
+ * Called by the network tasks, with a command or a new client
+ */
+void halWakeControlTick() {
+  if (controlTaskHandle != NULL) {
+    xTaskNotifyGive(controlTaskHandle);
+  }
+}
+
+/*
+ * Function run by the control task at every control tick
+ * Applies the received commands, samples the infrared sensor and updates the requested sounds,
+ * so that the reaction to an obstacle doesn't depend on how long the network or audio work takes
+ *
+ * @param parameter - unused
+ */
+void controlTask(void *parameter) {
+  unsigned long lastTickTime = 0;
+  bool lastTickActive = false; // whether the last tick left the timer at the full rate
+
+  for (;;) {
+    /* wait for the next tick, more than one pending notification means ticks were missed (while
+     * idle a wakeup can come on top of the slow tick, and the period isn't the control one) */
+    uint32_t pendingTicks = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (pendingTicks > 1 && lastTickActive) {
+      controlTickOverruns += pendingTicks - 1;
+    }
+
+    /* measure how far the tick is from its period */
+    uint32_t tickStart = halCycleCount();
+    unsigned long now = micros();
+    if (lastTickTime != 0 && lastTickActive) {
+      int32_t deviation = (int32_t)(now - lastTickTime) - CONTROL_TICK_INTERVAL;
+      tickJitter.record(deviation < 0 ? -deviation : deviation);
+    }
+    lastTickTime = now;
+
+    /* run the car logic */
+    runControlTick();
+    lastTickActive = powerGovernor.state == POWER_ACTIVE;
+
+    lastTickDuration = micros() - now;
+    recordCycles(controlTickCycles, tickStart);
+  }
+}
+
+/*
+ * Function that starts the control task and the hardware timer driving it
+ */
+void initControlTask() {
+  xTaskCreatePinnedToCore(controlTask, "control", CONTROL_TASK_STACK_SIZE, NULL, CONTROL_TASK_PRIORITY, &controlTaskHandle, CONTROL_TASK_CORE);
+
+  controlTimer = timerBegin(CONTROL_TIMER, CONTROL_TIMER_DIVIDER, true);
+  timerAttachInterrupt(controlTimer, onControlTimer, true);
+  timerAlarmWrite(controlTimer, CONTROL_TICK_INTERVAL, true);
+  timerAlarmEnable(controlTimer);
+}
+
+void setup() {
+  Serial.begin(115200);
+
+  /* start the Wi-Fi AP with the credentials defined */
+  WiFi.softAP(SSID, password);
+
+  /* print the IP address of the AP */
+  Serial.print("IP Address: ");
+  Serial.println(WiFi.softAPIP());
+  
+  /* initialize the WebSocket protocol, and the control datagrams next to it */
+  frameMutex = xSemaphoreCreateMutex();
+  initWebSocket();
+  initControlUdp();
+
+  /* handle requests on the root ("/") URL */
+  handleRootRequests();
+
+  /* export the metrics on the "/metrics" URL */
+  handleMetricsRequests();
+
+  /* start the server */
+  server.begin();
+
+  /* write the log messages out on a dedicated task */
+  initLogTask();
+
+  /* initialize the motors */
+  initMotors();
+
+  /* initialize the SD Card and audio playback system */
+  sdMutex = xSemaphoreCreateMutex();
+  initSDAudio();
+
+  /* record the drive session on the SD card */
+  initRecorder();
+
+  /* start playing sounds on a dedicated task */
+  initAudioTask();
+
+  /* initialize the car's headlights and taillights */
+  initLights();
+
+  /* start the fixed-rate control tick, the power governor wakes the main loop up from it */
+  loopTaskHandle = xTaskGetCurrentTaskHandle();
+  initControlTask();
+
+  /* everything the car keeps is allocated by now, the heap should stay where it is */
+  setupFreeHeap = ESP.getFreeHeap();
+  setupLargestHeapBlock = ESP.getMaxAllocHeap();
+} 
+
+void loop() {
+  uint32_t start = halCycleCount();
+
+  /* raise or lower the clock as the power governor decided */
+  applyPowerState();
+
+  /* limit the number of clients by closing the oldest client when maximum number of clients has been exceeded */
+  ws.cleanupClients(MAX_CLIENTS);
+
+  /* ping the clients to measure the link quality */
+  sendHeartbeats();
+
+  /* tell the clients who drives, then send them the telemetry */
+  broadcastLease();
+  broadcastTelemetry();
+
+  /* print the runtime statistics */
+  updateFrameRate();
+  reportStats();
+
+  recordCycles(loopCycles, start);
+
+  /* the time-critical work runs in the control task, leave the CPU to it until the next event
+   * (a change of the power state) or for longer while the car is idle */
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(powerIdle ? POWER_IDLE_LOOP_INTERVAL : LOOP_INTERVAL));
 }
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "adpcm.h"
+#include "sim.h"
+
+/*
+ * Checks of the IMA-ADPCM codec (see adpcm.h)
+ *
+ * Sounds like the car's (a two-tone horn, an engine revving up, the hiss of a recording) are
+ * synthesized, encoded in the asset format and decoded again, and the decoded samples are
+ * compared with the source PCM. Then the block decoder is timed on the host.
+ */
+
+/* the sample rate and the length of the synthesized sounds */
+#define ADPCM_CHECK_RATE 22050
+#define ADPCM_CHECK_SAMPLES (2 * ADPCM_CHECK_RATE)
+
+/* the noisiest a decoded sound may be (signal-to-noise ratio, in dB) */
+#define ADPCM_MIN_SNR 25
+#define ADPCM_MIN_NOISE_SNR 12
+
+/* the number of times the decoding benchmark decodes the engine sound */
+#define ADPCM_BENCHMARK_PASSES 200
+
+/* a synthesized sound */
+struct SourceSound {
+  const char *name;
+  std::vector<int16_t> samples;
+  int32_t minSnr;
+};
+
+/*
+ * Function that synthesizes the sounds the codec is checked with
+ *
+ * @return the sounds
+ */
+static std::vector<SourceSound> synthesizeSounds() {
+  std::vector<SourceSound> sounds = {
+    { "horn", {}, ADPCM_MIN_SNR },
+    { "engine", {}, ADPCM_MIN_SNR },
+    { "noise", {}, ADPCM_MIN_NOISE_SNR }
+  };
+  double phase = 0;
+  uint32_t seed = 1;
+
+  for (uint32_t i = 0; i < ADPCM_CHECK_SAMPLES; i++) {
+    double t = (double)i / ADPCM_CHECK_RATE;
+
+    /* two tones a major third apart */
+    sounds[0].samples.push_back((int16_t)(9000 * sin(2 * M_PI * 400 * t) + 7000 * sin(2 * M_PI * 500 * t)));
+
+    /* the first harmonics of an engine going from 30 to 120 revolutions per second */
+    phase += 2 * M_PI * (30 + 45 * t) / ADPCM_CHECK_RATE;
+    double engine = 0;
+    for (int harmonic = 1; harmonic <= 6; harmonic++) {
+      engine += sin(harmonic * phase) / harmonic;
+    }
+    sounds[1].samples.push_back((int16_t)(12000 * engine));
+
+    /* white noise, the worst case of a predictive codec */
+    seed = seed * 1664525 + 1013904223;
+    sounds[2].samples.push_back((int16_t)((int32_t)(seed >> 16) - 32768) / 4);
+  }
+  return sounds;
+}
+
+/*
+ * Function that encodes samples in the asset format
+ *
+ * @param samples - the samples
+ * @return the asset
+ */
+static std::vector<uint8_t> encodeAsset(const std::vector<int16_t> &samples) {
+  std::vector<uint8_t> asset(ADPCM_HEADER_SIZE);
+  writeAdpcmHeader(asset.data(), { ADPCM_BLOCK_SIZE, ADPCM_CHECK_RATE, (uint32_t)samples.size() });
+
+  uint8_t index = 0;
+  uint8_t block[ADPCM_BLOCK_SIZE];
+  for (size_t start = 0; start < samples.size(); start += ADPCM_BLOCK_SAMPLES(ADPCM_BLOCK_SIZE)) {
+    size_t count = samples.size() - start;
+    if (count > ADPCM_BLOCK_SAMPLES(ADPCM_BLOCK_SIZE)) {
+      count = ADPCM_BLOCK_SAMPLES(ADPCM_BLOCK_SIZE);
+    }
+    size_t length = adpcmEncodeBlock(samples.data() + start, count, index, block);
+    asset.insert(asset.end(), block, block + length);
+  }
+  return asset;
+}
+
+/*
+ * Function that decodes an asset the way a voice of the car does, a block at a time
+ *
+ * @param asset - the asset
+ * @param samples - where to store the samples
+ * @return whether the asset has a valid header
+ */
+static bool decodeAsset(const std::vector<uint8_t> &asset, std::vector<int16_t> &samples) {
+  AdpcmHeader header;
+  if (!readAdpcmHeader(asset.data(), asset.size(), header)) {
+    return false;
+  }
+
+  int16_t decoded[ADPCM_BLOCK_SAMPLES(ADPCM_MAX_BLOCK_SIZE)];
+  samples.clear();
+  for (size_t offset = ADPCM_HEADER_SIZE; offset < asset.size() && samples.size() < header.sampleCount;
+       offset += header.blockSize) {
+    size_t length = asset.size() - offset < header.blockSize ? asset.size() - offset : header.blockSize;
+    uint16_t count = adpcmDecodeBlock(asset.data() + offset, length, decoded);
+    samples.insert(samples.end(), decoded, decoded + count);
+  }
+  if (samples.size() > header.sampleCount) {
+    samples.resize(header.sampleCount);
+  }
+  return true;
+}
+
+int runAdpcmChecks() {
+  int failures = 0;
+  std::vector<SourceSound> sounds = synthesizeSounds();
+  std::vector<int16_t> decoded;
+
+  for (const SourceSound &sound : sounds) {
+    std::vector<uint8_t> asset = encodeAsset(sound.samples);
+    if (!decodeAsset(asset, decoded) || decoded.size() != sound.samples.size()) {
+      printf("adpcm %s: the asset couldn't be decoded\n", sound.name);
+      failures++;
+      continue;
+    }
+
+    double signal = 0, noise = 0;
+    int32_t largestError = 0;
+    for (size_t i = 0; i < decoded.size(); i++) {
+      int32_t error = decoded[i] - sound.samples[i];
+      signal += (double)sound.samples[i] * sound.samples[i];
+      noise += (double)error * error;
+      largestError = abs(error) > largestError ? abs(error) : largestError;
+    }
+    double snr = noise > 0 ? 10 * log10(signal / noise) : INFINITY;
+
+    char name[64];
+    snprintf(name, sizeof(name), "adpcm %s (%zu -> %zu bytes): SNR", sound.name, sound.samples.size() * sizeof(int16_t),
+             asset.size());
+    bool ok = snr >= sound.minSnr;
+    printf("%-44s %6.1f dB (limit %d dB, largest error %d) %s\n", name, snr, sound.minSnr, largestError, ok ? "ok" : "FAIL");
+    if (!ok) {
+      failures++;
+    }
+  }
+
+  /* time the block decoder alone, on the engine sound */
+  std::vector<uint8_t> asset = encodeAsset(sounds[1].samples);
+  int16_t block[ADPCM_BLOCK_SAMPLES(ADPCM_BLOCK_SIZE)];
+  uint64_t samples = 0;
+  int32_t checksum = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t pass = 0; pass < ADPCM_BENCHMARK_PASSES; pass++) {
+    for (size_t offset = ADPCM_HEADER_SIZE; offset < asset.size(); offset += ADPCM_BLOCK_SIZE) {
+      size_t length = asset.size() - offset < ADPCM_BLOCK_SIZE ? asset.size() - offset : ADPCM_BLOCK_SIZE;
+      uint16_t count = adpcmDecodeBlock(asset.data() + offset, length, block);
+      checksum += block[count - 1]; // keeps the decoding from being optimized away
+      samples += count;
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("%-44s %9.1f Msamples/s, %.0fx real time at %u Hz (checksum %d)\n", "adpcm decoding (host)", samples / seconds / 1e6,
+         samples / seconds / ADPCM_CHECK_RATE, ADPCM_CHECK_RATE, checksum);
+
+  return failures;
+}
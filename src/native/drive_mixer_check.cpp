@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include "drive_mixer.h"
+#include "sim.h"
+
+/*
+ * Checks of the arc-drive mixer (see drive_mixer.h)
+ *
+ * The mixer is run on a few joystick positions whose duty is known, then on every pair of
+ * readings a joystick can send, checking the properties the driver relies on: no side goes past
+ * the full duty, the deadzone stops the car, the curve is the mirror image when steering the
+ * other way, the inner side slows down steadily as the steer grows, and a full stick always gives
+ * the full duty to the outer side.
+ */
+
+/* the duty of a side at full throttle */
+#define DRIVE_CHECK_DUTY 1023
+
+/* a joystick position and the duty of each side it must give */
+struct DriveCase {
+  const char *name;
+  int32_t throttle;
+  int32_t steer;
+  DriveMix expected;
+};
+
+const DriveCase DRIVE_CASES[] = {
+  { "full throttle", DRIVE_AXIS_MAX, 0, { DRIVE_CHECK_DUTY, DRIVE_CHECK_DUTY } },
+  { "full reverse", -DRIVE_AXIS_MAX, 0, { -DRIVE_CHECK_DUTY, -DRIVE_CHECK_DUTY } },
+  { "pivot right", DRIVE_AXIS_MAX, DRIVE_AXIS_MAX, { DRIVE_CHECK_DUTY, 0 } },
+  { "pivot left", DRIVE_AXIS_MAX, -DRIVE_AXIS_MAX, { 0, DRIVE_CHECK_DUTY } },
+  { "spin clockwise", 0, DRIVE_AXIS_MAX, { DRIVE_CHECK_DUTY, -DRIVE_CHECK_DUTY } },
+  { "out of range", 300, -300, { 0, DRIVE_CHECK_DUTY } },
+  { "deadzone", DRIVE_AXIS_DEADZONE, -DRIVE_AXIS_DEADZONE, { 0, 0 } }
+};
+
+/* a property of the mixer, and the number of positions breaking it */
+struct DriveProperty {
+  const char *name;
+  uint32_t violations;
+};
+
+int runDriveMixerChecks() {
+  int failures = 0;
+
+  for (const DriveCase &test : DRIVE_CASES) {
+    DriveMix mix = mixArcDrive(test.throttle, test.steer, DRIVE_CHECK_DUTY);
+    bool ok = mix.left == test.expected.left && mix.right == test.expected.right;
+
+    char name[64];
+    snprintf(name, sizeof(name), "drive mixer %s (%d, %d)", test.name, test.throttle, test.steer);
+    printf("%-44s %5d %5d (expected %d %d) %s\n", name, mix.left, mix.right, test.expected.left, test.expected.right,
+           ok ? "ok" : "FAIL");
+    if (!ok) {
+      failures++;
+    }
+  }
+
+  DriveProperty properties[] = {
+    { "within the full duty", 0 },
+    { "stopped in the deadzone", 0 },
+    { "mirrored steer and throttle", 0 },
+    { "inner side slowing down with the steer", 0 },
+    { "full duty on the outer side at full stick", 0 }
+  };
+
+  /* every reading of an int8 axis */
+  for (int32_t throttle = -128; throttle <= 127; throttle++) {
+    DriveMix previous = { 0, 0 };
+    for (int32_t steer = 0; steer <= 127; steer++) {
+      DriveMix mix = mixArcDrive(throttle, steer, DRIVE_CHECK_DUTY);
+      DriveMix mirrored = mixArcDrive(throttle, -steer, DRIVE_CHECK_DUTY);
+      DriveMix reversed = mixArcDrive(-throttle, -steer, DRIVE_CHECK_DUTY);
+      int32_t left = mix.left < 0 ? -mix.left : mix.left;
+      int32_t right = mix.right < 0 ? -mix.right : mix.right;
+      bool centered = driveAxis(throttle) == 0 && driveAxis(steer) == 0;
+      bool fullStick = driveAxis(throttle) == DRIVE_AXIS_MAX || driveAxis(throttle) == -DRIVE_AXIS_MAX ||
+                       driveAxis(steer) == DRIVE_AXIS_MAX;
+
+      properties[0].violations += left > DRIVE_CHECK_DUTY || right > DRIVE_CHECK_DUTY ? 1 : 0;
+      properties[1].violations += centered && (mix.left != 0 || mix.right != 0) ? 1 : 0;
+      properties[2].violations += mirrored.left != mix.right || mirrored.right != mix.left || reversed.left != -mix.left ||
+                                  reversed.right != -mix.right ? 1 : 0;
+      properties[3].violations += steer > 0 && throttle >= 0 && (mix.right > previous.right || mix.left < previous.left) ? 1 : 0;
+      properties[4].violations += fullStick && (left > right ? left : right) != DRIVE_CHECK_DUTY ? 1 : 0;
+      previous = mix;
+    }
+  }
+
+  for (const DriveProperty &property : properties) {
+    char name[64];
+    snprintf(name, sizeof(name), "drive mixer %s", property.name);
+    printf("%-44s %6u positions breaking it %s\n", name, property.violations, property.violations == 0 ? "ok" : "FAIL");
+    if (property.violations != 0) {
+      failures++;
+    }
+  }
+
+  return failures;
+}
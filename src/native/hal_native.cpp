@@ -0,0 +1,154 @@
+#include <chrono>
+#include <new>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "car.h"
+#include "sim.h"
+
+SimState sim;
+
+void simReset() {
+  memset(&sim, 0, sizeof(sim));
+}
+
+void simAdvance(uint32_t us) {
+  sim.time += us;
+}
+
+/*
+ * The allocations are counted, so the simulation can check that the command path and the control
+ * tick never touch the heap
+ */
+void *operator new(size_t size) {
+  sim.allocations++;
+  void *memory = malloc(size);
+  if (memory == NULL) {
+    throw std::bad_alloc();
+  }
+  return memory;
+}
+
+void operator delete(void *memory) noexcept {
+  free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+  free(memory);
+}
+
+/*
+ * Function that returns the PWM channel of the motors driven by a direction pin
+ *
+ * @param pin - the pin
+ * @return the PWM channel, or -1 if the pin isn't a motor direction pin
+ */
+static int8_t motorChannel(uint8_t pin) {
+  switch (pin) {
+    case LEFT_MOTORS_IN1:
+    case LEFT_MOTORS_IN2:
+      return LEFT_MOTORS_PWM_CHANNEL;
+    case RIGHT_MOTORS_IN3:
+    case RIGHT_MOTORS_IN4:
+      return RIGHT_MOTORS_PWM_CHANNEL;
+    default:
+      return -1;
+  }
+}
+
+void halDigitalWrite(uint8_t pin, uint8_t level) {
+  if (pin >= SIM_PIN_COUNT) {
+    return;
+  }
+
+  /* the H-bridge must not start driving the motors in a new direction while they are powered */
+  int8_t channel = motorChannel(pin);
+  if (channel >= 0 && level == HIGH && sim.pins[pin] != HIGH && sim.pwm[channel] != 0) {
+    sim.directionChangesUnderLoad++;
+  }
+  sim.pins[pin] = level;
+}
+
+void halGpioWrite(uint32_t set, uint32_t clear) {
+  sim.gpioWrites++;
+  for (uint8_t pin = 0; pin < 32; pin++) {
+    if (clear & (1UL << pin)) {
+      halDigitalWrite(pin, LOW);
+    }
+  }
+  for (uint8_t pin = 0; pin < 32; pin++) {
+    if (set & (1UL << pin)) {
+      halDigitalWrite(pin, HIGH);
+    }
+  }
+}
+
+uint8_t halDigitalRead(uint8_t pin) {
+  return pin < SIM_PIN_COUNT ? sim.pins[pin] : LOW;
+}
+
+uint16_t halAnalogRead(uint8_t pin) {
+  return pin < SIM_PIN_COUNT ? sim.adc[pin] : 0;
+}
+
+void halPwmWrite(uint8_t channel, uint32_t duty) {
+  if (channel < SIM_PWM_CHANNELS) {
+    sim.pwm[channel] = duty;
+  }
+}
+
+uint32_t halMillis() {
+  return (uint32_t)(sim.time / 1000);
+}
+
+uint32_t halMicros() {
+  return (uint32_t)sim.time;
+}
+
+/*
+ * The probes measure the cost of the code on the host, converted to cycles of the ESP32's clock
+ * so that the same histogram buckets apply; like the ESP32's, the counter slows down while the
+ * car is idle
+ */
+uint32_t halCycleCount() {
+  uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+  return (uint32_t)(ns * (sim.powerIdle ? POWER_IDLE_CPU_MHZ : POWER_ACTIVE_CPU_MHZ) / 1000);
+}
+
+void halLog(const char *format, ...) {
+  if (!sim.verbose) {
+    return;
+  }
+
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+/*
+ * The power state is applied at once, so the wake latency is the time the governor took to notice
+ */
+void halSetPowerState(bool idle, uint32_t since) {
+  sim.powerIdle = idle;
+  sim.powerChanges++;
+  setCycleScale(idle ? POWER_IDLE_CPU_MHZ : POWER_ACTIVE_CPU_MHZ);
+  if (!idle) {
+    powerRecordWake(powerGovernor, halMicros() - since);
+  }
+}
+
+/*
+ * The woken tick runs at once, without the virtual clock moving (see tick() in main.cpp)
+ */
+void halWakeControlTick() {
+  sim.controlWakeups++;
+  sim.controlWakePending = true;
+}
+
+void halRequestSounds(uint32_t sounds) {
+  sim.sounds = sounds;
+  sim.soundRequests++;
+}
@@ -0,0 +1,88 @@
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include "ir_sensor.h"
+#include "sim.h"
+
+/*
+ * Checks of the infrared distance table (see ir_sensor.h)
+ *
+ * The table the compiler builds with its own logarithm and exponential is compared, for every
+ * ADC reading, with the sensor's curve computed at runtime with the C library's pow(), the way
+ * the car used to convert its readings. Then both conversions are timed on the host.
+ */
+
+/* the largest difference allowed between the table and the curve (in cm) */
+#define IR_MAX_TABLE_ERROR 1.0
+
+/* the number of times the benchmark converts every ADC reading */
+#define IR_BENCHMARK_PASSES 2000
+
+/*
+ * Function that converts an ADC reading to a distance with the sensor's curve, in floating point
+ *
+ * @param adc - the ADC reading (0 - IR_ADC_MAX)
+ * @return the distance (in cm), limited to IR_DISTANCE_MAX
+ */
+static double curveDistance(uint16_t adc) {
+  if (adc == 0) {
+    return IR_DISTANCE_MAX;
+  }
+
+  double volts = (adc * IR_ADC_VOLTAGE) / IR_ADC_MAX;
+  double distance = IR_CURVE_FACTOR * pow(volts, IR_CURVE_EXPONENT);
+  return distance > IR_DISTANCE_MAX ? IR_DISTANCE_MAX : distance;
+}
+
+int runIrChecks() {
+  int failures = 0;
+  double largestError = 0;
+  uint16_t largestErrorAdc = 0;
+  uint32_t truncationMismatches = 0;
+
+  for (uint16_t adc = 0; adc <= IR_ADC_MAX; adc++) {
+    double distance = curveDistance(adc);
+    double error = fabs(irDistance(adc) - distance);
+    if (error > largestError) {
+      largestError = error;
+      largestErrorAdc = adc;
+    }
+
+    /* the table truncates the distance, like the cast of the original conversion */
+    truncationMismatches += irDistance(adc) != (uint8_t)distance ? 1 : 0;
+  }
+
+  bool ok = largestError < IR_MAX_TABLE_ERROR;
+  printf("%-44s %6.3f cm at ADC %u (limit %.0f cm, %u readings off the truncated curve) %s\n",
+         "ir table: largest error over 0-4095", largestError, largestErrorAdc, IR_MAX_TABLE_ERROR,
+         truncationMismatches, ok ? "ok" : "FAIL");
+  if (!ok) {
+    failures++;
+  }
+
+  /* time the table lookup and the runtime curve on every reading */
+  uint32_t checksum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t pass = 0; pass < IR_BENCHMARK_PASSES; pass++) {
+    for (uint16_t adc = 0; adc <= IR_ADC_MAX; adc++) {
+      checksum += irDistance((adc + pass) & IR_ADC_MAX); // keeps the lookups from being hoisted out of the loop
+    }
+  }
+  double tableSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  double curveChecksum = 0;
+  start = std::chrono::steady_clock::now();
+  for (uint32_t pass = 0; pass < IR_BENCHMARK_PASSES; pass++) {
+    for (uint16_t adc = 0; adc <= IR_ADC_MAX; adc++) {
+      curveChecksum += curveDistance((adc + pass) & IR_ADC_MAX);
+    }
+  }
+  double curveSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  double conversions = (double)IR_BENCHMARK_PASSES * (IR_ADC_MAX + 1);
+  printf("%-44s %9.2f ns per reading, %.2f ns with pow(), %.0fx faster (checksums %u, %.0f)\n", "ir conversion (host)",
+         tableSeconds * 1e9 / conversions, curveSeconds * 1e9 / conversions, curveSeconds / tableSeconds, checksum,
+         curveChecksum);
+
+  return failures;
+}
@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "car.h"
+#include "sim.h"
+
+/*
+ * Comparison of the WebSocket and the UDP control paths over a lossy link
+ *
+ * A simulated driver changes direction at random times and sends its control state every
+ * LINK_SEND_INTERVAL, like the web interface: over the WebSocket only the controls that changed
+ * (or an empty keepalive frame), over UDP the whole state in every datagram. Each packet crosses a
+ * Wi-Fi link that delays, occasionally stalls and drops it:
+ *
+ * - a lost datagram is gone, the next one carries the same state
+ * - a lost TCP segment is sent again after a fast retransmit or the retransmission timeout, and
+ *   holds up every later segment until it arrives (head-of-line blocking)
+ *
+ * The packets are fed to the car's decoders on the virtual clock, and the time from a change of
+ * direction to the car reaching the new drive state is measured for both paths.
+ */
+
+/* the id and the address of the simulated driver */
+#define LINK_CLIENT_ID 0x10003 // wider than 16 bits, like the ids of a server that has been up for a while
+#define LINK_CLIENT_ADDRESS 0x0404A8C0 // 192.168.4.4
+
+/* the time period for the driver to send its control state (in milliseconds) */
+#define LINK_SEND_INTERVAL 50
+
+/* the virtual time driven over every path at every loss rate (in milliseconds) */
+#define LINK_RUN_TIME 120000
+
+/* the shortest and the longest time between two changes of direction (in milliseconds) */
+#define LINK_MIN_CHANGE_INTERVAL 200
+#define LINK_MAX_CHANGE_INTERVAL 1200
+
+/* the one-way delay of the link and its jitter (in microseconds) */
+#define LINK_DELAY 3000
+#define LINK_JITTER 2000
+
+/* the chance (in percent) of a packet being stalled by Wi-Fi retries, and the longest stall (in microseconds) */
+#define LINK_STALL_CHANCE 2
+#define LINK_MAX_STALL 60000
+
+/* the shortest retransmission timeout of the driver's TCP stack, doubled after every retry (in microseconds) */
+#define LINK_MIN_RTO 200000
+
+/* the number of later segments that trigger a fast retransmit of a lost one (duplicate ACKs) */
+#define LINK_DUPACK_THRESHOLD 3
+
+/* the packet loss rates compared (in percent) */
+const uint8_t LINK_LOSS_RATES[] = { 0, 1, 5, 10 };
+
+/* bucket bounds of the latency from a change of direction to the car reaching it (in milliseconds) */
+const uint32_t LINK_LATENCY_BUCKETS[] = { 10, 20, 30, 40, 50, 60, 75, 100, 150, 200, 300, 400, 600, 1000 };
+
+/* a change of direction of the driver */
+struct DirectionChange {
+  uint32_t time; // in milliseconds
+  uint8_t direction;
+};
+
+/* a packet on its way to the car */
+struct LinkPacket {
+  uint64_t deliveredAt; // the time the car's stack hands it over (in microseconds)
+  uint8_t data[MAX_DATAGRAM_SIZE];
+  size_t length;
+};
+
+/* the state of the random generator, reset for every loss rate so every run sees the same changes of direction */
+static uint32_t seed;
+
+/*
+ * Function that returns a pseudo-random number, the same sequence on every host
+ *
+ * @param range - the number of possible values
+ * @return a number between 0 and range - 1
+ */
+static uint32_t linkRandom(uint32_t range) {
+  seed = seed * 1664525 + 1013904223;
+  return (seed >> 8) % range;
+}
+
+/*
+ * Function that returns the time a packet takes to cross the link once it is sent, stalls included
+ *
+ * @return the delay (in microseconds)
+ */
+static uint32_t linkDelay() {
+  uint32_t delay = LINK_DELAY + linkRandom(LINK_JITTER);
+  if (linkRandom(100) < LINK_STALL_CHANCE) {
+    delay += linkRandom(LINK_MAX_STALL);
+  }
+  return delay;
+}
+
+/*
+ * Function that writes a frame, behind the datagram header for UDP
+ *
+ * @param packet - the packet to write it to
+ * @param udp - whether the frame is sent as a datagram
+ * @param sequence - the sequence number of the frame
+ * @param commands - the commands of the frame
+ * @param count - the number of commands
+ */
+static void writePacket(LinkPacket &packet, bool udp, uint16_t sequence, const ControlCommand *commands, uint8_t count) {
+  uint8_t *frame = packet.data;
+  if (udp) {
+    writeUint32(frame, LINK_CLIENT_ID);
+    frame += DATAGRAM_HEADER_SIZE;
+  }
+
+  frame[0] = PROTOCOL_VERSION;
+  frame[1] = count;
+  writeUint16(frame + 2, sequence);
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t *command = frame + FRAME_HEADER_SIZE + i * COMMAND_SIZE;
+    command[0] = commands[i].opcode;
+    command[1] = commands[i].arg;
+    writeUint16(command + 2, commands[i].value);
+  }
+  packet.length = (udp ? DATAGRAM_HEADER_SIZE : 0) + FRAME_HEADER_SIZE + count * COMMAND_SIZE;
+}
+
+/*
+ * Function that generates the packets the driver sends during a run, and when the car gets them
+ *
+ * @param udp - whether the driver sends datagrams or WebSocket frames
+ * @param lossRate - the chance of a packet (or a retransmission) being lost (in percent)
+ * @param changes - the changes of direction of the driver
+ * @return the packets, in the order the car gets them
+ */
+static std::vector<LinkPacket> generatePackets(bool udp, uint8_t lossRate, const std::vector<DirectionChange> &changes) {
+  std::vector<LinkPacket> packets;
+  uint8_t sentDirection = STOP_WHEELS;
+  uint64_t lastDelivery = 0;
+  uint16_t sequence = 0;
+  size_t change = 0;
+  uint8_t direction = STOP_WHEELS;
+
+  for (uint32_t time = 0; time < LINK_RUN_TIME; time += LINK_SEND_INTERVAL) {
+    while (change < changes.size() && changes[change].time <= time) {
+      direction = changes[change++].direction;
+    }
+
+    LinkPacket packet;
+    uint64_t sentAt = (uint64_t)time * 1000;
+    sequence++;
+
+    if (udp) {
+      /* the whole state, every time */
+      ControlCommand state[] = { { OP_MOVE, direction, 0 }, { OP_SPEED, 0, 255 } };
+      writePacket(packet, true, sequence, state, 2);
+      if (linkRandom(100) < lossRate) {
+        continue;
+      }
+      packet.deliveredAt = sentAt + linkDelay();
+    } else {
+      /* only what changed, or a keepalive frame */
+      ControlCommand move = { OP_MOVE, direction, 0 };
+      writePacket(packet, false, sequence, &move, direction != sentDirection ? 1 : 0);
+      sentDirection = direction;
+
+      /* every lost transmission is retried, the first time by a fast retransmit once enough later
+       * segments got through, then on the doubling retransmission timeout */
+      uint64_t transmittedAt = sentAt;
+      uint32_t timeout = LINK_MIN_RTO;
+      for (uint8_t retry = 0; linkRandom(100) < lossRate; retry++) {
+        uint32_t fastRetransmit = LINK_DUPACK_THRESHOLD * LINK_SEND_INTERVAL * 1000 + 2 * LINK_DELAY;
+        transmittedAt += retry == 0 && fastRetransmit < timeout ? fastRetransmit : timeout;
+        timeout = retry == 0 ? timeout : 2 * timeout;
+      }
+
+      /* the stream is delivered in order */
+      packet.deliveredAt = std::max(transmittedAt + linkDelay(), lastDelivery);
+      lastDelivery = packet.deliveredAt;
+    }
+    packets.push_back(packet);
+  }
+
+  std::stable_sort(packets.begin(), packets.end(),
+                   [](const LinkPacket &a, const LinkPacket &b) { return a.deliveredAt < b.deliveredAt; });
+  return packets;
+}
+
+/*
+ * Function that drives the car over one path and measures how long every change of direction
+ * takes to reach it
+ *
+ * @param name - the name of the path and loss rate, for the report
+ * @param udp - whether the driver sends datagrams or WebSocket frames
+ * @param lossRate - the packet loss rate (in percent)
+ * @param changes - the changes of direction of the driver
+ */
+static void runLink(const char *name, bool udp, uint8_t lossRate, const std::vector<DirectionChange> &changes) {
+  Histogram latency(LINK_LATENCY_BUCKETS, sizeof(LINK_LATENCY_BUCKETS) / sizeof(LINK_LATENCY_BUCKETS[0]));
+  std::vector<LinkPacket> packets = generatePackets(udp, lossRate, changes);
+
+  ClientSession *session = findSession(0);
+  connectClient(*session, LINK_CLIENT_ID, LINK_CLIENT_ADDRESS);
+  setDriver(LINK_CLIENT_ID);
+
+  uint64_t start = sim.time;
+  uint32_t startDeadmanStops = deadmanStops;
+  uint32_t startStale = session->decoder.staleFrames;
+  uint32_t superseded = 0;
+  size_t next = 0;
+  size_t change = 0;
+  bool pending = false;
+
+  for (uint64_t time = 0; time < (uint64_t)LINK_RUN_TIME * 1000; time += CONTROL_TICK_INTERVAL) {
+    /* hand the packets over at the time they arrive, between two control ticks */
+    for (; next < packets.size() && packets[next].deliveredAt <= time; next++) {
+      sim.time = start + packets[next].deliveredAt;
+      if (udp) {
+        ClientSession *sender = datagramSession(packets[next].data, packets[next].length, LINK_CLIENT_ADDRESS);
+        if (sender != NULL) {
+          receiveDatagram(*sender, packets[next].data, packets[next].length, halMicros());
+        }
+      } else {
+        receiveFrame(*session, packets[next].data, packets[next].length, halMicros());
+      }
+    }
+    sim.time = start + time;
+
+    if (change < changes.size() && (uint64_t)changes[change].time * 1000 <= time) {
+      superseded += pending ? 1 : 0;
+      pending = true;
+      change++;
+    }
+
+    runControlTick();
+    drainLog();
+
+    /* the drive states follow the order of the directions */
+    if (pending && driveState == (DriveState)changes[change - 1].direction) {
+      latency.record((uint32_t)(time / 1000) - changes[change - 1].time);
+      pending = false;
+    }
+  }
+
+  printf("%-44s p50 %4u ms, p99 %4u ms, max %4u ms, %u superseded, %u stale, %u deadman stops\n", name,
+         latency.percentile(50), latency.percentile(99), latency.max, superseded,
+         session->decoder.staleFrames - startStale, deadmanStops - startDeadmanStops);
+
+  disconnectClient(*session);
+  sim.time = start + (uint64_t)LINK_RUN_TIME * 1000;
+}
+
+void runLinkComparison() {
+  bool wasAvoiding = avoidObstacles;
+  avoidObstacles = false;
+
+  for (uint8_t loss : LINK_LOSS_RATES) {
+    /* the same session of the driver for every loss rate */
+    std::vector<DirectionChange> changes;
+    seed = 1;
+    uint8_t direction = STOP_WHEELS;
+    for (uint32_t time = LINK_MIN_CHANGE_INTERVAL; time < LINK_RUN_TIME;
+         time += LINK_MIN_CHANGE_INTERVAL + linkRandom(LINK_MAX_CHANGE_INTERVAL - LINK_MIN_CHANGE_INTERVAL)) {
+      direction = (direction + 1 + linkRandom(MOVE_BACKWARDS)) % (MOVE_BACKWARDS + 1);
+      changes.push_back({ time, direction });
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "link at %u%% loss, WebSocket", loss);
+    runLink(name, false, loss, changes);
+    snprintf(name, sizeof(name), "link at %u%% loss, UDP", loss);
+    runLink(name, true, loss, changes);
+  }
+
+  avoidObstacles = wasAvoiding;
+}
@@ -0,0 +1,631 @@
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "car.h"
+#include "mixer.h"
+#include "sim.h"
+
+/*
+ * Host simulation of the car logic ([env:native])
+ *
+ * Drives the car through a scripted session on the simulated hardware, one control tick at a
+ * time on the virtual clock, and reports how long each reaction takes in virtual time. Then it
+ * measures the throughput of the command path (decoding, queueing and the control tick) and the
+ * cost of the audio mixing kernel on the host, compares the WebSocket and the UDP control paths
+ * over a lossy link, and runs the checks of the portable modules:
+ *
+ * - the frame decoder (protocol_check.cpp)
+ * - the infrared distance table (ir_check.cpp)
+ * - the IMA-ADPCM sound decoder (adpcm_check.cpp)
+ * - the sound synthesizer and the mixer's voices (synth_check.cpp)
+ * - the arc-drive mixer (drive_mixer_check.cpp)
+ *
+ * The process exits with a non-zero status if a reaction is slower than it should be or a check
+ * fails.
+ *
+ * Usage: program [-v] [-r log]   run the session, printing the car's log messages (-v) and
+ *                                recording the session to a drive log (-r)
+ *        program replay log      replay a drive log recorded by the car or by -r
+ */
+
+/* the ids of the simulated clients: the driver and a spectator */
+#define SIM_CLIENT_ID 1
+#define SIM_SPECTATOR_ID 2
+
+/* the ids of two more clients, wider than 16 bits and with the same low 16 bits */
+#define SIM_WIDE_CLIENT_ID 0x20005
+#define SIM_TWIN_CLIENT_ID 0x30005
+
+/* the IPv4 addresses the simulated clients are connected from */
+#define SIM_CLIENT_ADDRESS 0x0204A8C0    // 192.168.4.2
+#define SIM_SPECTATOR_ADDRESS 0x0304A8C0 // 192.168.4.3
+
+/* the time period for the simulated client to send a keepalive frame */
+#define SIM_KEEPALIVE_INTERVAL 150
+
+/* the longest a scenario may run (in control ticks) before it is considered stuck */
+#define SIM_MAX_TICKS 1000
+
+/* the distance a wall is put at in front of the car, and the closest it may get to it (in cm) */
+#define SIM_WALL_DISTANCE 100
+#define SIM_WALL_MIN_DISTANCE 10
+
+/* the distance the car is put at in front of a wall to turn and back away from it, and the one it backs away to (in cm) */
+#define SIM_NEAR_WALL_DISTANCE 18
+#define SIM_CLEAR_WALL_DISTANCE 40
+
+/* the number of frames sent by the throughput benchmark */
+#define BENCHMARK_FRAMES 200000
+
+/* the number of blocks mixed by the mixer benchmark for every voice count, and the most voices it mixes */
+#define MIXER_BENCHMARK_BLOCKS 50000
+#define MIXER_BENCHMARK_VOICES 8
+
+/* the sessions of the simulated clients */
+ClientSession *client;
+ClientSession *spectator;
+
+/* the sequence number of the last frame sent */
+uint16_t sequence = 0;
+
+/* timestamp of the last frame sent (in milliseconds) */
+uint32_t lastSendTime = 0;
+
+/* whether the client keeps the link alive with keepalive frames */
+bool keepalive = true;
+
+/* the number of failed checks */
+int failures = 0;
+
+/* the drive log being recorded, NULL if the session isn't recorded */
+FILE *logFile = NULL;
+
+/* the distance to the wall in front of the car, and the closest the car got to it (in cm), 0 if there is no wall */
+double wallDistance = 0;
+double closestWallDistance = 0;
+
+/*
+ * Function that sends a frame from a simulated client, as if it came from the WebSocket
+ *
+ * @param commands - the commands of the frame
+ * @param count - the number of commands
+ * @param from - the session of the client sending it
+ */
+void sendFrame(const ControlCommand *commands, uint8_t count, ClientSession *from = client) {
+  uint8_t frame[MAX_FRAME_SIZE];
+
+  sequence++;
+  frame[0] = PROTOCOL_VERSION;
+  frame[1] = count;
+  writeUint16(frame + 2, sequence);
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t *command = frame + FRAME_HEADER_SIZE + i * COMMAND_SIZE;
+    command[0] = commands[i].opcode;
+    command[1] = commands[i].arg;
+    writeUint16(command + 2, commands[i].value);
+  }
+
+  receiveFrame(*from, frame, FRAME_HEADER_SIZE + count * COMMAND_SIZE, halMicros());
+  lastSendTime = halMillis();
+}
+
+/*
+ * Function that sends a single command from a simulated client
+ */
+void sendCommand(uint8_t opcode, uint8_t arg, uint16_t value, ClientSession *from = client) {
+  ControlCommand command = { opcode, arg, value };
+  sendFrame(&command, 1, from);
+}
+
+/*
+ * Function that writes the buffer handed over by the recorder to the drive log, the way the
+ * recorder task does on the car
+ */
+void writeLog() {
+  size_t length;
+  const uint8_t *buffer = recorder.pending(length);
+
+  if (logFile != NULL && buffer != NULL) {
+    fwrite(buffer, 1, length, logFile);
+    recorder.release(0);
+  }
+}
+
+/*
+ * Function that returns the ADC reading of the infrared sensor for an obstacle at a distance
+ *
+ * @param distance - the distance (in cm)
+ */
+uint16_t adcForDistance(uint8_t distance) {
+  for (uint16_t adc = IR_ADC_MAX; adc > 0; adc--) {
+    if (irDistance(adc) >= distance) {
+      return adc;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Function that moves the car towards the wall, if there is one, at the speed its motors drive it
+ * and updates the reading of the infrared sensor
+ */
+void moveTowardsWall() {
+  if (wallDistance <= 0) {
+    return;
+  }
+
+  double duty = (motorRamps[LEFT_MOTORS].duty + motorRamps[RIGHT_MOTORS].duty) / 2.0;
+  wallDistance -= duty / MOTOR_DUTY_MAX * CAR_MAX_SPEED * CONTROL_TICK_INTERVAL / 1e6;
+  if (wallDistance < closestWallDistance) {
+    closestWallDistance = wallDistance;
+  }
+  sim.adc[IR_SENSOR] = adcForDistance(wallDistance > IR_DISTANCE_MAX ? IR_DISTANCE_MAX : (uint8_t)wallDistance);
+}
+
+/*
+ * Function that runs one control tick on the virtual clock, a control period after the last one
+ * (or the idle period while the car is idle), or right away when the idle car was woken up
+ */
+void tick() {
+  if (sim.controlWakePending) {
+    sim.controlWakePending = false;
+  } else {
+    simAdvance(sim.powerIdle ? POWER_IDLE_TICK_INTERVAL : CONTROL_TICK_INTERVAL);
+  }
+  moveTowardsWall();
+  if (keepalive && halMillis() - lastSendTime >= SIM_KEEPALIVE_INTERVAL) {
+    sendFrame(NULL, 0);
+  }
+  runControlTick();
+  writeLog();
+  drainLog();
+}
+
+/*
+ * Function that runs control ticks until a condition holds
+ *
+ * @param done - the condition
+ * @return the virtual time it took (in milliseconds), or -1 if it never held
+ */
+template<typename Condition>
+int32_t tickUntil(Condition done) {
+  uint32_t start = halMillis();
+
+  for (uint16_t ticks = 0; ticks < SIM_MAX_TICKS; ticks++) {
+    if (done()) {
+      return halMillis() - start;
+    }
+    tick();
+  }
+  return -1;
+}
+
+/*
+ * Function that reports a measurement and checks it against its limit
+ *
+ * @param name - the name of the measurement
+ * @param value - the measured value (in milliseconds), -1 if it never happened
+ * @param limit - the largest acceptable value (in milliseconds)
+ */
+void check(const char *name, int32_t value, int32_t limit) {
+  bool ok = value >= 0 && value <= limit;
+
+  printf("%-44s %6d ms (limit %d ms) %s\n", name, value, limit, ok ? "ok" : "FAIL");
+  if (!ok) {
+    failures++;
+  }
+}
+
+/*
+ * Function that drives the car at a wall with the obstacle avoidance on, until it has avoided it,
+ * and checks how close it got
+ *
+ * @param speed - the speed the car drives at (127-255)
+ */
+void approachWall(uint8_t speed) {
+  char name[64];
+
+  wallDistance = SIM_WALL_DISTANCE;
+  closestWallDistance = SIM_WALL_DISTANCE;
+  sendCommand(OP_SPEED, 0, speed);
+  sendCommand(OP_MOVE, MOVE_FORWARD, 0);
+  tickUntil([] { return driveState == DRIVE_AVOID; });
+  tickUntil([] { return driveState != DRIVE_AVOID; });
+
+  bool ok = closestWallDistance >= SIM_WALL_MIN_DISTANCE;
+  snprintf(name, sizeof(name), "wall at speed %u (%s): closest", speed,
+           lastAvoidancePlan.action == AVOID_REVERSE ? "reversed" : "braked");
+  printf("%-44s %6.1f cm (limit %d cm) %s\n", name, closestWallDistance, SIM_WALL_MIN_DISTANCE, ok ? "ok" : "FAIL");
+  if (!ok) {
+    failures++;
+  }
+
+  sendCommand(OP_MOVE, STOP_WHEELS, 0);
+  wallDistance = 0;
+  sim.adc[IR_SENSOR] = adcForDistance(60);
+  tickUntil([] { return motorRamps[LEFT_MOTORS].duty == 0; });
+}
+
+/*
+ * Function that puts the car still in front of a wall with the obstacle avoidance on, closer than
+ * AVOID_BRAKE_DISTANCE but not than AVOID_DISTANCE_MIN, and checks that it can turn and back away
+ * from it without an avoidance getting in the way
+ */
+void backAwayFromWall() {
+  const int32_t tickTime = CONTROL_TICK_INTERVAL / 1000;
+  uint32_t avoidances = avoidanceBrakes + avoidanceReversals;
+
+  wallDistance = SIM_NEAR_WALL_DISTANCE;
+  closestWallDistance = SIM_NEAR_WALL_DISTANCE;
+  sim.adc[IR_SENSOR] = adcForDistance(SIM_NEAR_WALL_DISTANCE);
+
+  /* turn the avoidance off and on, so the jump from the last reading isn't taken for a closing speed */
+  sendCommand(OP_TOGGLE, TOGGLE_OBSTACLE_AVOIDANCE, 0);
+  sendCommand(OP_TOGGLE, TOGGLE_OBSTACLE_AVOIDANCE, 0);
+
+  /* turning in place keeps the car at the same distance */
+  sendCommand(OP_MOVE, MOVE_LEFT, 0);
+  tickUntil([] { return motorRamps[RIGHT_MOTORS].duty == MOTOR_DUTY_MAX; });
+  for (uint8_t i = 0; i < 2 * IR_SENSOR_READ_TICKS * AVOID_HISTORY_SIZE; i++) {
+    tick();
+  }
+
+  sendCommand(OP_MOVE, MOVE_BACKWARDS, 0);
+  check("wall at 18 cm: reverse away to 40 cm", tickUntil([] { return wallDistance >= SIM_CLEAR_WALL_DISTANCE; }),
+        (SIM_CLEAR_WALL_DISTANCE - SIM_NEAR_WALL_DISTANCE) * 1000 / CAR_MAX_SPEED + MOTOR_DECELERATION_TIME +
+        MOTOR_ACCELERATION_TIME + tickTime);
+  if (avoidanceBrakes + avoidanceReversals != avoidances) {
+    printf("wall at 18 cm: %u avoidances kept the car from turning or backing away\n",
+           avoidanceBrakes + avoidanceReversals - avoidances);
+    failures++;
+  }
+
+  sendCommand(OP_MOVE, STOP_WHEELS, 0);
+  wallDistance = 0;
+  sim.adc[IR_SENSOR] = adcForDistance(60);
+  tickUntil([] { return motorRamps[LEFT_MOTORS].duty == 0; });
+}
+
+/*
+ * Function that drives the car through the scripted session
+ */
+void runScenarios() {
+  const int32_t tickTime = CONTROL_TICK_INTERVAL / 1000;
+
+  /* accelerate from stopped to full speed */
+  sendCommand(OP_MOVE, MOVE_FORWARD, 0);
+  check("forward: stopped to full duty", tickUntil([] {
+    return sim.pwm[LEFT_MOTORS_PWM_CHANNEL] == MOTOR_DUTY_MAX && sim.pwm[RIGHT_MOTORS_PWM_CHANNEL] == MOTOR_DUTY_MAX;
+  }), MOTOR_ACCELERATION_TIME + tickTime);
+  if (sim.pins[LEFT_MOTORS_IN2] != HIGH || sim.pins[RIGHT_MOTORS_IN4] != HIGH) {
+    printf("forward: the direction pins weren't set\n");
+    failures++;
+  }
+
+  /* reverse, ramping through zero */
+  sendCommand(OP_MOVE, MOVE_BACKWARDS, 0);
+  check("reverse: full forward to full backwards", tickUntil([] {
+    return motorRamps[LEFT_MOTORS].duty == -MOTOR_DUTY_MAX && motorRamps[RIGHT_MOTORS].duty == -MOTOR_DUTY_MAX;
+  }), MOTOR_DECELERATION_TIME + MOTOR_ACCELERATION_TIME + 2 * tickTime);
+
+  /* drive towards an obstacle with the obstacle avoidance on */
+  sim.adc[IR_SENSOR] = adcForDistance(60);
+  sendCommand(OP_TOGGLE, TOGGLE_OBSTACLE_AVOIDANCE, 0);
+  sendCommand(OP_MOVE, MOVE_FORWARD, 0);
+  tickUntil([] { return motorRamps[LEFT_MOTORS].duty == MOTOR_DUTY_MAX; });
+  sim.adc[IR_SENSOR] = adcForDistance(AVOID_DISTANCE_MIN / 2);
+  check("obstacle: detected to reversing", tickUntil([] {
+    return motorRamps[LEFT_MOTORS].target < 0;
+  }), 2 * IR_SENSOR_READ_INTERVAL);
+  sendCommand(OP_MOVE, MOVE_FORWARD, 0); // a client repeating its state doesn't cancel the avoidance
+  tick();
+  if (driveState != DRIVE_AVOID) {
+    printf("obstacle: a repeated command cancelled the avoidance\n");
+    failures++;
+  }
+  sim.adc[IR_SENSOR] = adcForDistance(60); // the car backs away from the obstacle
+  check("obstacle: reversing to stopped", tickUntil([] {
+    return driveState != DRIVE_AVOID && sim.pwm[LEFT_MOTORS_PWM_CHANNEL] == 0;
+  }), REVERSING_TIME + MOTOR_DECELERATION_TIME + IR_SENSOR_READ_INTERVAL + 2 * tickTime); // a second reading may extend it
+
+  /* drive at a wall: the car must stop short of it at any speed, with a reaction matching the speed */
+  approachWall(127);
+  approachWall(191);
+  approachWall(255);
+  backAwayFromWall();
+  sendCommand(OP_TOGGLE, TOGGLE_OBSTACLE_AVOIDANCE, 0);
+
+  /* lose the link while driving */
+  sendCommand(OP_MOVE, MOVE_FORWARD, 0);
+  tickUntil([] { return motorRamps[LEFT_MOTORS].duty == MOTOR_DUTY_MAX; });
+  keepalive = false;
+  uint32_t lastFrame = lastSendTime;
+  tickUntil([] { return motorRamps[LEFT_MOTORS].target == 0; });
+  check("deadman: last frame to stop", halMillis() - lastFrame, DEADMAN_TIMEOUT + tickTime);
+  keepalive = true;
+
+  /* curve with the joystick at full speed: the inner side slows down, without stopping to turn */
+  sendCommand(OP_MOVE, MOVE_FORWARD, 0);
+  tickUntil([] { return motorRamps[LEFT_MOTORS].duty == MOTOR_DUTY_MAX; });
+  int32_t slowestInner = MOTOR_DUTY_MAX;
+  sendCommand(OP_DRIVE, DRIVE_AXIS_MAX / 2, DRIVE_AXIS_MAX);
+  check("arc: straight to curve", tickUntil([&slowestInner] {
+    slowestInner = motorRamps[RIGHT_MOTORS].duty < slowestInner ? motorRamps[RIGHT_MOTORS].duty : slowestInner;
+    return driveState == DRIVE_ARC && motorRamps[RIGHT_MOTORS].duty == motorRamps[RIGHT_MOTORS].target;
+  }), MOTOR_DECELERATION_TIME + tickTime);
+  if (driveState != DRIVE_ARC || motorRamps[LEFT_MOTORS].duty != MOTOR_DUTY_MAX || slowestInner < motorRamps[RIGHT_MOTORS].target ||
+      motorRamps[RIGHT_MOTORS].target <= 0) {
+    printf("arc: the car didn't curve smoothly (outer %d, inner %d, slowest inner %d)\n", motorRamps[LEFT_MOTORS].duty,
+           motorRamps[RIGHT_MOTORS].duty, slowestInner);
+    failures++;
+  }
+  sendCommand(OP_DRIVE, 0, (uint16_t)-DRIVE_AXIS_MAX); // backwards with the joystick beeps like reversing
+  tick();
+  if (!(sim.sounds & SOUND_BIT(SOUND_REVERSING))) {
+    printf("arc: the reversing sound wasn't requested\n");
+    failures++;
+  }
+  sendCommand(OP_DRIVE, 0, 0); // releasing the joystick stops the car
+  check("arc: joystick released to stopped", tickUntil([] {
+    return motorRamps[LEFT_MOTORS].duty == 0 && motorRamps[RIGHT_MOTORS].duty == 0;
+  }), MOTOR_DECELERATION_TIME + tickTime);
+
+  /* the horn is requested from the audio task */
+  uint32_t soundRequests = sim.soundRequests;
+  sendCommand(OP_ACTIVATE, ACTIVATE_HORN, 0);
+  tick();
+  check("horn: command to sound request", (sim.sounds & SOUND_BIT(SOUND_HORN)) && sim.soundRequests > soundRequests ? tickTime : -1, tickTime);
+  sendCommand(OP_ACTIVATE, 0, 0);
+  tickUntil([] { return motorRamps[LEFT_MOTORS].duty == 0; });
+
+  /* a command lost to a full queue is taken when the client sends it again */
+  uint32_t overflows = commandQueue.stats.overflowDrops;
+  for (uint8_t i = 0; i < COMMAND_QUEUE_SIZE; i++) {
+    sendCommand(OP_SPEED, 0, i % 2 ? 255 : 254);
+  }
+  sendCommand(OP_MOVE, MOVE_FORWARD, 0);
+  tick();
+  bool overflowed = commandQueue.stats.overflowDrops > overflows && motorRamps[LEFT_MOTORS].target == 0;
+  sendCommand(OP_MOVE, MOVE_FORWARD, 0);
+  sendCommand(OP_SPEED, 0, 255);
+  tick();
+  if (!overflowed || motorRamps[LEFT_MOTORS].target != MOTOR_DUTY_MAX) {
+    printf("queue: a command resent after an overflow was dropped as redundant\n");
+    failures++;
+  }
+  sendCommand(OP_MOVE, STOP_WHEELS, 0);
+  tickUntil([] { return motorRamps[LEFT_MOTORS].duty == 0; });
+
+  /* a spectator can't drive the car, nor take the lease from a live driver */
+  uint32_t dropped = spectatorCommandsDropped;
+  sendCommand(OP_MOVE, MOVE_FORWARD, 0, spectator);
+  sendCommand(OP_LEASE, LEASE_ACQUIRE, 0, spectator);
+  tick();
+  if (motorRamps[LEFT_MOTORS].target != 0 || spectatorCommandsDropped != dropped + 1 || driverClientId != SIM_CLIENT_ID) {
+    printf("lease: the spectator's commands weren't ignored\n");
+    failures++;
+  }
+
+  /* the driver hands the lease over while driving: the car stops for the new driver */
+  sendCommand(OP_MOVE, MOVE_FORWARD, 0);
+  tickUntil([] { return motorRamps[LEFT_MOTORS].duty == MOTOR_DUTY_MAX; });
+  sendCommand(OP_LEASE, LEASE_HANDOFF, SIM_SPECTATOR_ID);
+  check("lease: handoff to stopped", tickUntil([] {
+    return sim.pwm[LEFT_MOTORS_PWM_CHANNEL] == 0;
+  }), MOTOR_DECELERATION_TIME + 2 * tickTime);
+  if (driverClientId != SIM_SPECTATOR_ID || !client->leasePending || !spectator->leasePending) {
+    printf("lease: the handoff wasn't applied or announced\n");
+    failures++;
+  }
+
+  /* the lease is released, and the first client takes it back */
+  sendCommand(OP_LEASE, LEASE_RELEASE, 0, spectator);
+  sendCommand(OP_LEASE, LEASE_ACQUIRE, 0);
+  if (driverClientId != SIM_CLIENT_ID) {
+    printf("lease: the released lease couldn't be acquired\n");
+    failures++;
+  }
+
+  /* a client whose id is wider than 16 bits is handed the lease by the low 16 bits of its id, and
+   * told its whole id and the other clients; once another client shares them, a handoff by them
+   * is refused */
+  ClientSession *wide = findSession(0);
+  connectClient(*wide, SIM_WIDE_CLIENT_ID, SIM_CLIENT_ADDRESS);
+  sendCommand(OP_LEASE, LEASE_HANDOFF, (uint16_t)SIM_WIDE_CLIENT_ID);
+  uint8_t message[MAX_LEASE_MESSAGE_SIZE(MAX_CLIENTS - 1)];
+  uint32_t clients[MAX_CLIENTS - 1];
+  uint8_t clientCount = listOtherClients(wide->clientId, clients);
+  size_t length = encodeLeaseMessage(message, wide->clientId, driverClientId, clients, clientCount);
+  bool listed = false;
+  for (uint8_t i = 0; i < message[10]; i++) {
+    listed = listed || readUint32(message + LEASE_MESSAGE_SIZE + i * LEASE_CLIENT_SIZE) == SIM_CLIENT_ID;
+  }
+  bool handedOff = driverClientId == SIM_WIDE_CLIENT_ID && message[1] == ROLE_DRIVER &&
+                   readUint32(message + 2) == SIM_WIDE_CLIENT_ID && readUint32(message + 6) == SIM_WIDE_CLIENT_ID &&
+                   length == (size_t)MAX_LEASE_MESSAGE_SIZE(clientCount) && listed;
+  sendCommand(OP_LEASE, LEASE_RELEASE, 0, wide);
+  sendCommand(OP_LEASE, LEASE_ACQUIRE, 0);
+  ClientSession *twin = findSession(0);
+  connectClient(*twin, SIM_TWIN_CLIENT_ID, SIM_CLIENT_ADDRESS);
+  sendCommand(OP_LEASE, LEASE_HANDOFF, (uint16_t)SIM_WIDE_CLIENT_ID);
+  if (!handedOff || driverClientId != SIM_CLIENT_ID) {
+    printf("lease: the handoff to a wide client id wasn't applied, or an ambiguous one was (driver %#x)\n", driverClientId);
+    failures++;
+  }
+  disconnectClient(*twin);
+  disconnectClient(*wide);
+
+  /* the car goes idle once the driver stops sending commands, and wakes up on the next one */
+  while (!sim.powerIdle && halMillis() - lastActivityTime <= 2 * POWER_IDLE_TIMEOUT) {
+    tick();
+  }
+  check("power: last command to idle", sim.powerIdle ? halMillis() - lastActivityTime : -1,
+        POWER_IDLE_TIMEOUT + POWER_IDLE_DELAY + tickTime);
+
+  /* a probe taking 100 us at the idle clock is recorded as 100 us of the full clock */
+  Histogram probe(CYCLE_BUCKETS, CYCLE_BUCKET_COUNT);
+  recordCycles(probe, halCycleCount() - 100 * POWER_IDLE_CPU_MHZ);
+  bool scaled = probe.max >= US_TO_CYCLES(100) && probe.max < US_TO_CYCLES(110);
+  printf("%-44s %6u cycles at %u MHz (expected %u) %s\n", "power: 100 us probe while idle", probe.max, POWER_IDLE_CPU_MHZ,
+         US_TO_CYCLES(100), scaled ? "ok" : "FAIL");
+  failures += !scaled;
+
+  /* the idle car ticks at the idle period, not at the control one */
+  uint32_t idleTicks = controlTicks;
+  uint32_t idleStart = halMillis();
+  while (halMillis() - idleStart < 1000) {
+    tick();
+  }
+  idleTicks = controlTicks - idleTicks;
+  bool slowed = sim.powerIdle && idleTicks <= 1000000 / POWER_IDLE_TICK_INTERVAL;
+  printf("%-44s %6u ticks in 1 s (limit %u) %s\n", "power: control ticks while idle", idleTicks,
+         1000000 / POWER_IDLE_TICK_INTERVAL, slowed ? "ok" : "FAIL");
+  failures += !slowed;
+
+  /* a command runs a tick right away, which brings the control period back */
+  uint32_t wakeups = sim.controlWakeups;
+  sendCommand(OP_MOVE, MOVE_FORWARD, 0);
+  check("power: command to active", tickUntil([] { return !sim.powerIdle; }), 0);
+  uint32_t wokenAt = halMicros();
+  tick();
+  bool restored = sim.controlWakeups == wakeups + 1 && halMicros() - wokenAt == CONTROL_TICK_INTERVAL;
+  printf("%-44s %6u us after the wakeup (expected %u) %s\n", "power: control period restored", halMicros() - wokenAt,
+         CONTROL_TICK_INTERVAL, restored ? "ok" : "FAIL");
+  failures += !restored;
+  sendCommand(OP_MOVE, STOP_WHEELS, 0);
+  tickUntil([] { return motorRamps[LEFT_MOTORS].duty == 0; });
+  printf("%-44s %6u%% of the time, %u idle periods, wake latency max %u us\n", "power: active", powerDutyCycle(powerGovernor),
+         powerGovernor.idlePeriods, powerGovernor.maxWakeLatency);
+
+  printf("%-44s %6u %s\n", "direction changes while powered", sim.directionChangesUnderLoad,
+         sim.directionChangesUnderLoad == 0 ? "ok" : "FAIL");
+  if (sim.directionChangesUnderLoad != 0) {
+    failures++;
+  }
+  printf("%-44s %6u in %u ticks\n", "output pin writes (batched, on change only)", sim.gpioWrites, controlTicks);
+}
+
+/*
+ * Function that measures the throughput of the command path on the host: every frame carries a
+ * full batch of commands, followed by a control tick
+ */
+void runBenchmark() {
+  ControlCommand commands[MAX_COMMANDS_PER_FRAME];
+  for (uint8_t i = 0; i < MAX_COMMANDS_PER_FRAME; i++) {
+    commands[i] = (i % 2) ? ControlCommand { OP_SPEED, 0, (uint16_t)(127 + i * 16) }
+                          : ControlCommand { OP_MOVE, (uint8_t)(i % 4 ? MOVE_FORWARD : MOVE_LEFT), 0 };
+  }
+
+  uint64_t allocations = sim.allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t frame = 0; frame < BENCHMARK_FRAMES; frame++) {
+    sendFrame(commands, MAX_COMMANDS_PER_FRAME);
+    tick();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  allocations = sim.allocations - allocations;
+
+  printf("%-44s %9.0f frames/s, %.0f commands/s, %.0f ns per frame and tick\n", "throughput (host)",
+         BENCHMARK_FRAMES / seconds, BENCHMARK_FRAMES * MAX_COMMANDS_PER_FRAME / seconds,
+         seconds * 1e9 / BENCHMARK_FRAMES);
+  printf("%-44s %9u applied, %u coalesced, %u overflowed, %u redundant\n", "commands", commandQueue.stats.applied,
+         commandQueue.stats.coalescedDrops, commandQueue.stats.overflowDrops, redundantCommandsDropped);
+  printf("%-44s %9u messages, %u written, %u dropped\n", "log (drained every tick)", logBuffer.records.load(),
+         logBuffer.written, logBuffer.dropped.load());
+  printf("%-44s %9llu %s\n", "heap allocations on the command path", (unsigned long long)allocations,
+         allocations == 0 ? "ok" : "FAIL");
+  if (allocations != 0) {
+    failures++;
+  }
+}
+
+/*
+ * Function that measures the cost of the block mixing kernel (see mixer.h) on the host, for 1 to
+ * MIXER_BENCHMARK_VOICES voices, so the cost of every added voice shows
+ */
+void runMixerBenchmark() {
+  static int16_t voices[MIXER_BENCHMARK_VOICES][MIXER_BLOCK_SIZE];
+  const int16_t *blocks[MIXER_BENCHMARK_VOICES];
+  int16_t gains[MIXER_BENCHMARK_VOICES];
+  int16_t output[MIXER_BLOCK_SIZE];
+
+  /* loud voices, so the sum keeps saturating */
+  for (uint8_t voice = 0; voice < MIXER_BENCHMARK_VOICES; voice++) {
+    for (uint16_t i = 0; i < MIXER_BLOCK_SIZE; i++) {
+      voices[voice][i] = (int16_t)((i * (voice + 1) * 997) & 0xFFFF);
+    }
+    blocks[voice] = voices[voice];
+    gains[voice] = mixerGain(0.5f + voice * 0.0625f);
+  }
+
+  for (uint8_t count = 1; count <= MIXER_BENCHMARK_VOICES; count *= 2) {
+    uint32_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t block = 0; block < MIXER_BENCHMARK_BLOCKS; block++) {
+      voices[0][0] = (int16_t)block; // keeps the blocks from being mixed once out of the loop
+      mixBlock(output, blocks, gains, count, MIXER_BLOCK_SIZE);
+      checksum += (uint16_t)output[block % MIXER_BLOCK_SIZE];
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double samples = (double)MIXER_BENCHMARK_BLOCKS * MIXER_BLOCK_SIZE;
+
+    char name[64];
+    snprintf(name, sizeof(name), "mixer: %u voices (host)", count);
+    printf("%-44s %9.2f ns per sample, %.2f ns per voice (checksum %u)\n", name, seconds * 1e9 / samples,
+           seconds * 1e9 / samples / count, checksum);
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc == 3 && strcmp(argv[1], "replay") == 0) {
+    return replayLog(argv[2]);
+  }
+
+  simReset();
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-v") == 0) {
+      sim.verbose = true;
+    } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      logFile = fopen(argv[++i], "wb");
+      if (logFile == NULL) {
+        fprintf(stderr, "%s can't be created\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  if (logFile != NULL) {
+    uint8_t header[RECORDER_HEADER_SIZE];
+    fwrite(header, 1, writeLogHeader(header, CONTROL_TICK_INTERVAL), logFile);
+    startRecording();
+  }
+
+  /* connect the simulated clients, the first one gets the lease */
+  client = findSession(0);
+  connectClient(*client, SIM_CLIENT_ID, SIM_CLIENT_ADDRESS);
+  spectator = findSession(0);
+  connectClient(*spectator, SIM_SPECTATOR_ID, SIM_SPECTATOR_ADDRESS);
+
+  runScenarios();
+
+  /* the benchmark isn't recorded */
+  if (logFile != NULL) {
+    recorder.handOver();
+    writeLog();
+    recorder.enabled = false;
+    fclose(logFile);
+    logFile = NULL;
+  }
+
+  runBenchmark();
+  runMixerBenchmark();
+  failures += runProtocolChecks();
+  failures += runIrChecks();
+  runLinkComparison();
+  failures += runAdpcmChecks();
+  failures += runSynthChecks();
+  failures += runDriveMixerChecks();
+
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
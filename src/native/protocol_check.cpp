@@ -0,0 +1,170 @@
+#include <chrono>
+#include <stdio.h>
+#include <vector>
+#include "car.h"
+#include "sim.h"
+
+/*
+ * Checks of the binary frame decoder (see protocol.h)
+ *
+ * A series of frames is fed to one decoder, the way a client's connection does: well-formed
+ * frames, duplicated and reordered ones, sequence numbers wrapping around, frames cut short or
+ * running long, a wrong version and an unknown opcode. Each must give the expected result and
+ * commands, and a rejected frame must leave the decoder as it was. Then the decoder is timed on
+ * the host.
+ */
+
+/* the number of frames the decoding benchmark decodes */
+#define PROTOCOL_BENCHMARK_FRAMES 2000000
+
+/* an opcode the car doesn't know */
+#define PROTOCOL_UNKNOWN_OPCODE 0xEE
+
+/* the names of the decode results, in the order of DecodeResult */
+static const char *DECODE_RESULT_NAMES[] = { "ok", "bad length", "bad version", "stale" };
+
+/*
+ * Function that writes a frame
+ *
+ * @param sequence - the sequence number of the frame
+ * @param commands - the commands of the frame
+ * @param count - the number of commands
+ * @return the frame
+ */
+static std::vector<uint8_t> makeFrame(uint16_t sequence, const ControlCommand *commands, uint8_t count) {
+  std::vector<uint8_t> frame(FRAME_HEADER_SIZE + count * COMMAND_SIZE);
+  frame[0] = PROTOCOL_VERSION;
+  frame[1] = count;
+  writeUint16(&frame[2], sequence);
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t *command = &frame[FRAME_HEADER_SIZE + i * COMMAND_SIZE];
+    command[0] = commands[i].opcode;
+    command[1] = commands[i].arg;
+    writeUint16(command + 2, commands[i].value);
+  }
+  return frame;
+}
+
+/*
+ * Function that decodes a frame and checks the result, the commands passed to the handler and,
+ * for a rejected frame, that the decoder is left as it was
+ *
+ * @param name - the name of the check
+ * @param decoder - the decoder
+ * @param frame - the frame
+ * @param expected - the result the frame must give
+ * @param commands - the commands it must decode to, for an accepted frame
+ * @param count - the number of commands
+ * @return whether the check passed
+ */
+static bool checkDecode(const char *name, FrameDecoder &decoder, const std::vector<uint8_t> &frame, DecodeResult expected,
+                        const ControlCommand *commands = NULL, uint8_t count = 0) {
+  FrameDecoder before = decoder;
+  std::vector<ControlCommand> decoded;
+  DecodeResult result = decodeFrame(decoder, frame.data(), frame.size(),
+                                    [&decoded](const ControlCommand &command) { decoded.push_back(command); });
+
+  bool ok = result == expected;
+  if (result == DECODE_OK) {
+    ok = ok && decoded.size() == count && decoder.lastSequence == readUint16(&frame[2]);
+    for (uint8_t i = 0; ok && i < count; i++) {
+      ok = decoded[i].opcode == commands[i].opcode && decoded[i].arg == commands[i].arg &&
+           decoded[i].value == commands[i].value;
+    }
+  } else {
+    ok = ok && decoded.empty() && decoder.lastSequence == before.lastSequence && decoder.synced == before.synced;
+  }
+
+  char label[64];
+  snprintf(label, sizeof(label), "protocol %s", name);
+  printf("%-44s %11s (expected %s) %s\n", label, DECODE_RESULT_NAMES[result], DECODE_RESULT_NAMES[expected], ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int runProtocolChecks() {
+  int failures = 0;
+  FrameDecoder decoder;
+  resetFrameDecoder(decoder);
+
+  const ControlCommand commands[] = { { OP_MOVE, MOVE_FORWARD, 0 }, { OP_SPEED, 0, 200 },
+                                      { PROTOCOL_UNKNOWN_OPCODE, 7, 0xBEEF } };
+  const ControlCommand full[MAX_COMMANDS_PER_FRAME + 1] = {};
+
+  /* whatever the first sequence number, then only newer ones */
+  failures += !checkDecode("first frame", decoder, makeFrame(0x1234, commands, 2), DECODE_OK, commands, 2);
+  failures += !checkDecode("keepalive", decoder, makeFrame(0x1235, NULL, 0), DECODE_OK);
+  failures += !checkDecode("duplicated sequence", decoder, makeFrame(0x1235, commands, 1), DECODE_STALE);
+  failures += !checkDecode("reordered sequence", decoder, makeFrame(0x1230, commands, 1), DECODE_STALE);
+  failures += !checkDecode("sequence half the range ahead", decoder, makeFrame(0x1235 + 0x8000, commands, 1), DECODE_STALE);
+  failures += !checkDecode("sequence skipping ahead", decoder, makeFrame(0x1300, commands, 1), DECODE_OK, commands, 1);
+  failures += !checkDecode("sequence far ahead", decoder, makeFrame(0x9000, commands, 1), DECODE_OK, commands, 1);
+
+  /* the 16-bit sequence wraps around */
+  failures += !checkDecode("sequence before the wrap-around", decoder, makeFrame(0xFFFF, commands, 1), DECODE_OK, commands, 1);
+  failures += !checkDecode("sequence wrapping around", decoder, makeFrame(0x0000, commands, 1), DECODE_OK, commands, 1);
+  failures += !checkDecode("sequence from before the wrap-around", decoder, makeFrame(0xFFFE, commands, 1), DECODE_STALE);
+  failures += !checkDecode("sequence after the wrap-around", decoder, makeFrame(0x0005, commands, 2), DECODE_OK, commands, 2);
+
+  /* malformed frames, all with a newer sequence number that must not be taken */
+  std::vector<uint8_t> frame = makeFrame(0x0010, commands, 2);
+  frame.resize(FRAME_HEADER_SIZE - 1);
+  failures += !checkDecode("truncated header", decoder, frame, DECODE_BAD_LENGTH);
+  frame = makeFrame(0x0010, commands, 2);
+  frame.pop_back();
+  failures += !checkDecode("truncated command", decoder, frame, DECODE_BAD_LENGTH);
+  frame = makeFrame(0x0010, commands, 2);
+  frame[1] = 3;
+  failures += !checkDecode("more commands announced than sent", decoder, frame, DECODE_BAD_LENGTH);
+  frame = makeFrame(0x0010, commands, 2);
+  frame.push_back(0);
+  failures += !checkDecode("trailing byte", decoder, frame, DECODE_BAD_LENGTH);
+  frame = makeFrame(0x0010, commands, 2);
+  frame[1] = 1;
+  failures += !checkDecode("fewer commands announced than sent", decoder, frame, DECODE_BAD_LENGTH);
+  failures += !checkDecode("too many commands", decoder, makeFrame(0x0010, full, MAX_COMMANDS_PER_FRAME + 1), DECODE_BAD_LENGTH);
+  frame = makeFrame(0x0010, commands, 2);
+  frame[0] = PROTOCOL_VERSION + 1;
+  failures += !checkDecode("wrong version", decoder, frame, DECODE_BAD_VERSION);
+  failures += !checkDecode("full frame", decoder, makeFrame(0x0010, full, MAX_COMMANDS_PER_FRAME), DECODE_OK, full,
+                           MAX_COMMANDS_PER_FRAME);
+
+  /* an unknown opcode is decoded as it is, and the car ignores it */
+  failures += !checkDecode("unknown opcode", decoder, makeFrame(0x0011, commands, 3), DECODE_OK, commands, 3);
+  DriveState state = driveState;
+  int32_t leftTarget = motorRamps[LEFT_MOTORS].target;
+  applyCommand(commands[2]);
+  bool ignored = driveState == state && motorRamps[LEFT_MOTORS].target == leftTarget;
+  printf("%-44s %11s %s\n", "protocol unknown opcode applied", ignored ? "ignored" : "applied", ignored ? "ok" : "FAIL");
+  failures += !ignored;
+
+  bool counted = decoder.acceptedFrames == 9 && decoder.staleFrames == 4 && decoder.malformedFrames == 7;
+  printf("%-44s %4u accepted, %u stale, %u malformed %s\n", "protocol decoder counters", decoder.acceptedFrames,
+         decoder.staleFrames, decoder.malformedFrames, counted ? "ok" : "FAIL");
+  failures += !counted;
+
+  /* time the decoder alone, on full frames */
+  ControlCommand batch[MAX_COMMANDS_PER_FRAME];
+  for (uint8_t i = 0; i < MAX_COMMANDS_PER_FRAME; i++) {
+    batch[i] = { OP_MOVE, (uint8_t)(i % (MOVE_BACKWARDS + 1)), (uint16_t)(i * 31) };
+  }
+  frame = makeFrame(0, batch, MAX_COMMANDS_PER_FRAME);
+  resetFrameDecoder(decoder);
+  uint32_t checksum = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < PROTOCOL_BENCHMARK_FRAMES; i++) {
+    writeUint16(&frame[2], (uint16_t)i);
+    decodeFrame(decoder, frame.data(), frame.size(),
+                [&checksum](const ControlCommand &command) { checksum += command.arg + command.value; });
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("%-44s %9.0f frames/s, %.1f ns per frame (checksum %u)\n", "protocol decoding (host)",
+         PROTOCOL_BENCHMARK_FRAMES / seconds, seconds * 1e9 / PROTOCOL_BENCHMARK_FRAMES, checksum);
+  if (decoder.acceptedFrames != PROTOCOL_BENCHMARK_FRAMES) {
+    printf("protocol decoding: %u of %u frames accepted\n", decoder.acceptedFrames, PROTOCOL_BENCHMARK_FRAMES);
+    failures++;
+  }
+
+  return failures;
+}
@@ -0,0 +1,212 @@
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "car.h"
+#include "sim.h"
+
+/*
+ * Replay of a drive log recorded by the car (see recorder.h)
+ *
+ * The recorded inputs (commands, infrared samples, link activity) are fed back through the
+ * control logic one tick at a time on the virtual clock, and the outputs it produces are
+ * compared with the recorded ones. The obstacle avoidances and the deadman stops are listed with
+ * the readings that caused them, and the control ticks are timed on the host.
+ */
+
+/* the number of divergences printed before they are only counted */
+#define REPLAY_MAX_DIVERGENCES_PRINTED 10
+
+/* bucket bounds (in nanoseconds) of the host time of a replayed control tick */
+const uint32_t REPLAY_TICK_BUCKETS[] = { 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000 };
+
+/* a decoded record */
+struct ReplayRecord {
+  uint8_t type;
+  uint32_t tick;
+  int32_t values[4];
+};
+
+/*
+ * Function that returns the number of values in the payload of a record
+ *
+ * @param type - the type of the record
+ * @return the number of values, or -1 if the type is unknown
+ */
+static int8_t recordValueCount(uint8_t type) {
+  switch (type) {
+    case RECORD_START:
+      return 2;
+    case RECORD_COMMAND:
+      return 4;
+    case RECORD_IR_SAMPLE:
+      return 1;
+    case RECORD_MOTORS:
+      return 2;
+    case RECORD_LIGHTS:
+      return 2;
+    case RECORD_LINK:
+      return 1;
+    default:
+      return -1;
+  }
+}
+
+/*
+ * Function that decodes the records of a log
+ *
+ * @param data - the records, after the header
+ * @param length - the length of the records
+ * @param records - where to store the records
+ * @return whether the whole log could be decoded (a log cut short by a power loss can't)
+ */
+static bool decodeRecords(const uint8_t *data, size_t length, std::vector<ReplayRecord> &records) {
+  size_t offset = 0;
+  uint32_t tick = 0;
+
+  while (offset < length) {
+    ReplayRecord record = {};
+    int32_t delta;
+    int8_t count = recordValueCount(data[offset]);
+    record.type = data[offset++];
+
+    size_t read = count < 0 ? 0 : readVarint(data + offset, length - offset, delta);
+    if (read == 0) {
+      return false;
+    }
+    offset += read;
+    tick += (uint32_t)delta;
+    record.tick = tick;
+
+    for (int8_t i = 0; i < count; i++) {
+      read = readVarint(data + offset, length - offset, record.values[i]);
+      if (read == 0) {
+        return false;
+      }
+      offset += read;
+    }
+    records.push_back(record);
+  }
+  return true;
+}
+
+int replayLog(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "%s can't be opened\n", path);
+    return EXIT_FAILURE;
+  }
+
+  std::vector<uint8_t> log;
+  uint8_t chunk[4096];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    log.insert(log.end(), chunk, chunk + read);
+  }
+  fclose(file);
+
+  int32_t tickInterval;
+  size_t headerSize = readLogHeader(log.data(), log.size(), tickInterval);
+  if (headerSize == 0) {
+    fprintf(stderr, "%s isn't a drive log\n", path);
+    return EXIT_FAILURE;
+  }
+
+  std::vector<ReplayRecord> records;
+  if (!decodeRecords(log.data() + headerSize, log.size() - headerSize, records)) {
+    printf("the log ends with a truncated record, replaying the %zu complete ones\n", records.size());
+  }
+  if (records.empty() || records[0].type != RECORD_START) {
+    fprintf(stderr, "%s doesn't start with a start record\n", path);
+    return EXIT_FAILURE;
+  }
+
+  /* start from the state the car had when the recording started */
+  uint32_t startTick = records[0].values[0];
+  uint64_t startTime = (uint64_t)(uint32_t)records[0].values[1] * 1000;
+  simReset();
+  controlTicks = startTick;
+
+  Histogram tickTime(REPLAY_TICK_BUCKETS, sizeof(REPLAY_TICK_BUCKETS) / sizeof(REPLAY_TICK_BUCKETS[0]));
+  int32_t expectedDuty[2] = { 0, 0 };
+  int32_t expectedLights = 0;
+  uint32_t divergences = 0;
+  uint32_t commands = 0;
+  uint32_t avoidances = 0;
+  uint16_t lastSample = 0;
+  size_t next = 1;
+
+  while (next < records.size()) {
+    uint32_t tick = controlTicks;
+    sim.time = startTime + (uint64_t)(tick - startTick) * tickInterval;
+
+    /* feed the inputs recorded during this tick, and note the outputs it produced */
+    for (; next < records.size() && records[next].tick == tick; next++) {
+      const ReplayRecord &record = records[next];
+      switch (record.type) {
+        case RECORD_LINK:
+          lastFrameTime = halMillis() - record.values[0];
+          break;
+        case RECORD_COMMAND:
+          commandQueue.push({ (uint8_t)record.values[0], (uint8_t)record.values[1], (uint16_t)record.values[2] },
+                            halMicros() - record.values[3]);
+          commands++;
+          break;
+        case RECORD_IR_SAMPLE:
+          lastSample = record.values[0];
+          sim.adc[IR_SENSOR] = lastSample;
+          break;
+        case RECORD_MOTORS:
+          expectedDuty[record.values[0] & 1] = record.values[1];
+          break;
+        case RECORD_LIGHTS:
+          expectedLights = (record.values[0] << 1) | record.values[1];
+          break;
+        default:
+          break;
+      }
+    }
+
+    bool wasAvoiding = driveState == DRIVE_AVOID;
+    uint32_t previousDeadmanStops = deadmanStops;
+    auto start = std::chrono::steady_clock::now();
+    runControlTick();
+    tickTime.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    drainLog();
+
+    uint32_t time = (uint32_t)((sim.time - startTime) / 1000);
+    if (driveState == DRIVE_AVOID && !wasAvoiding) {
+      avoidances++;
+      printf("%8u ms  tick %u: obstacle avoidance (%s), filtered distance %u cm, raw reading %u (%u cm), closing at %d cm/s\n",
+             time, tick, lastAvoidancePlan.action == AVOID_REVERSE ? "reversing" : "braking", lastDistance, lastSample,
+             irDistance(lastSample), lastAvoidancePlan.closingSpeed);
+    }
+    if (deadmanStops != previousDeadmanStops) {
+      printf("%8u ms  tick %u: deadman stop, last frame %u ms earlier\n", time, tick, halMillis() - lastFrameTime);
+    }
+
+    /* the replayed outputs must match the recorded ones */
+    int32_t lights = (halDigitalRead(HEADLIGHTS) << 1) | halDigitalRead(TAILLIGHTS);
+    if (motorRamps[LEFT_MOTORS].duty != expectedDuty[LEFT_MOTORS] || motorRamps[RIGHT_MOTORS].duty != expectedDuty[RIGHT_MOTORS] ||
+        lights != expectedLights) {
+      if (divergences < REPLAY_MAX_DIVERGENCES_PRINTED) {
+        printf("%8u ms  tick %u: diverged, duty %d/%d (recorded %d/%d), lights %d (recorded %d)\n", time, tick,
+               motorRamps[LEFT_MOTORS].duty, motorRamps[RIGHT_MOTORS].duty, expectedDuty[LEFT_MOTORS], expectedDuty[RIGHT_MOTORS],
+               lights, expectedLights);
+      }
+      divergences++;
+
+      /* carry on from the recorded state */
+      motorRamps[LEFT_MOTORS].duty = expectedDuty[LEFT_MOTORS];
+      motorRamps[RIGHT_MOTORS].duty = expectedDuty[RIGHT_MOTORS];
+    }
+  }
+
+  printf("replayed %u ticks (%.1f s), %zu records, %u commands, %u obstacle avoidances, %u deadman stops\n",
+         controlTicks - startTick, (controlTicks - startTick) * tickInterval / 1e6, records.size(), commands, avoidances,
+         deadmanStops);
+  printf("control tick on the host: avg %u ns, p99 %u ns, max %u ns\n", tickTime.mean(), tickTime.percentile(99), tickTime.max);
+  printf("%u ticks diverged from the recording\n", divergences);
+
+  return divergences == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,103 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+/*
+ * Simulated hardware behind the HAL in the native build
+ *
+ * Time only moves when the simulation advances it, so a run is deterministic: the same inputs
+ * give the same pin writes at the same virtual times, whatever the speed of the host.
+ */
+
+/* the number of GPIO pins and PWM channels of the ESP32 */
+#define SIM_PIN_COUNT 40
+#define SIM_PWM_CHANNELS 16
+
+/* the state of the simulated hardware */
+struct SimState {
+  uint64_t time;                          // the virtual time (in microseconds)
+  uint8_t pins[SIM_PIN_COUNT];            // the level of every pin
+  uint16_t adc[SIM_PIN_COUNT];            // the reading returned by every analog pin
+  uint32_t pwm[SIM_PWM_CHANNELS];         // the duty of every PWM channel
+  uint32_t sounds;                        // the sounds last requested
+  uint32_t soundRequests;                 // the number of sound requests
+  uint32_t directionChangesUnderLoad;     // H-bridge direction changes while the PWM duty wasn't 0
+  uint32_t gpioWrites;                    // batched writes of the output pins (halGpioWrite)
+  uint64_t allocations;                   // heap allocations made through operator new
+  bool powerIdle;                         // the power state last requested by the governor
+  uint32_t powerChanges;                  // the number of power state requests
+  uint32_t controlWakeups;                // the number of control ticks run early while idle
+  bool controlWakePending;                // whether the next control tick runs right away
+  bool verbose;                           // whether the log messages are printed
+};
+
+extern SimState sim;
+
+/*
+ * Function that resets the simulated hardware
+ */
+void simReset();
+
+/*
+ * Function that advances the virtual clock
+ *
+ * @param us - the time to advance by (in microseconds)
+ */
+void simAdvance(uint32_t us);
+
+/*
+ * Function that replays a drive log through the control logic (see replay.cpp)
+ *
+ * @param path - the path of the log
+ * @return the exit status of the program
+ */
+int replayLog(const char *path);
+
+/*
+ * Function that checks the infrared distance table against the sensor's curve over every ADC
+ * reading, and times it (see ir_check.cpp)
+ *
+ * @return the number of failed checks
+ */
+int runIrChecks();
+
+/*
+ * Function that checks the assignment of the mixer's voices and the envelope and clipping of the
+ * synthesized sounds (see synth_check.cpp)
+ *
+ * @return the number of failed checks
+ */
+int runSynthChecks();
+
+/*
+ * Function that checks the frame decoder on valid, stale, wrapped-around and malformed frames,
+ * and times it (see protocol_check.cpp)
+ *
+ * @return the number of failed checks
+ */
+int runProtocolChecks();
+
+/*
+ * Function that checks the IMA-ADPCM codec against synthesized sounds and times the decoder
+ * (see adpcm_check.cpp)
+ *
+ * @return the number of failed checks
+ */
+int runAdpcmChecks();
+
+/*
+ * Function that checks the arc-drive mixer on known joystick positions and on every position a
+ * joystick can send (see drive_mixer_check.cpp)
+ *
+ * @return the number of failed checks
+ */
+int runDriveMixerChecks();
+
+/*
+ * Function that compares the latency of the WebSocket and the UDP control paths over a lossy
+ * link (see link_sim.cpp)
+ */
+void runLinkComparison();
+
+#endif
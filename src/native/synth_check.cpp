@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <vector>
+#include "mixer.h"
+#include "synth.h"
+#include "sim.h"
+
+/*
+ * Checks of the sound synthesizer and of the mixer's voices (see synth.h and mixer.h)
+ *
+ * The voices are assigned to a series of requested sounds, with fewer voices than sounds, and
+ * must play the highest priority ones without restarting those already playing. Then a gated
+ * beeper like the car's must fade in when it starts, fade out to silence once its gate closes and
+ * stay silent until it opens again, and a patch louder than full scale, or voices summing past it,
+ * must clip instead of wrapping around.
+ */
+
+/* the sample rate of the checked sounds (in hertz) */
+#define SYNTH_CHECK_RATE 22050
+
+/* the number of voices and of sounds of the voice checks */
+#define SYNTH_CHECK_VOICES 2
+#define SYNTH_CHECK_SOUNDS 3
+
+/* a full-scale sample through the full envelope */
+#define SYNTH_CHECK_FULL_SCALE ((INT16_MAX * MIXER_UNITY_GAIN) >> 15)
+
+/* the samples a fade takes at the checked sample rate */
+#define SYNTH_CHECK_FADE_SAMPLES (SYNTH_FADE_TIME * SYNTH_CHECK_RATE / 1000 + 1)
+
+/* a voice as the voice checks see it */
+struct CheckedVoice {
+  int8_t sound;
+};
+
+/* a series of requested sounds and the sound each voice must then play */
+struct VoiceCase {
+  const char *name;
+  uint32_t requested;
+  int8_t expected[SYNTH_CHECK_VOICES];
+  uint8_t leftOut;
+  uint32_t starts; // the number of sounds that must be started
+  int8_t failing;  // a sound that fails to start, -1 for none
+};
+
+const VoiceCase VOICE_CASES[] = {
+  { "one sound", 0b001, { 0, -1 }, 0, 1, -1 },
+  { "two sounds", 0b011, { 0, 1 }, 0, 1, -1 },
+  { "higher priority steals a voice", 0b111, { 2, 1 }, 1, 1, -1 },
+  { "same request keeps the voices", 0b111, { 2, 1 }, 1, 0, -1 },
+  { "stolen sound comes back", 0b101, { 2, 0 }, 0, 1, -1 },
+  { "failed start frees the voice", 0b110, { 2, -1 }, 0, 1, 1 },
+  { "nothing requested", 0b000, { -1, -1 }, 0, 0, -1 }
+};
+
+/* a patch whose harmonics add up to three times the full scale */
+const SynthPatch LOUD_PATCH = { 200 * 256, 200 * 256, { 32767, 32767, 32767 }, { 0, 0, 0 }, 0, 0 };
+
+/* a beeper like the car's reversing one */
+const SynthPatch GATED_PATCH = { 1000 * 256, 1000 * 256, { 20000, 0, 6000 }, { 0, 0, 0 }, 0, 800 };
+
+/*
+ * Function that reports a check
+ *
+ * @param name - the name of the check
+ * @param result - what the check found
+ * @param ok - whether the check passed
+ * @return 1 if the check failed, 0 otherwise
+ */
+static int report(const char *name, const char *result, bool ok) {
+  char label[64];
+  snprintf(label, sizeof(label), "synth %s", name);
+  printf("%-44s %s %s\n", label, result, ok ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+/*
+ * Function that synthesizes a sound for a number of samples, one block at a time
+ *
+ * @param synth - the state of the sound
+ * @param count - the number of samples
+ * @return the samples
+ */
+static std::vector<int16_t> synthesize(Synth &synth, uint32_t count) {
+  std::vector<int16_t> samples(count);
+  for (uint32_t i = 0; i < count; i += MIXER_BLOCK_SIZE) {
+    uint16_t length = count - i < MIXER_BLOCK_SIZE ? count - i : MIXER_BLOCK_SIZE;
+    synthBlock(synth, 0, SYNTH_CHECK_RATE, &samples[i], length);
+  }
+  return samples;
+}
+
+/*
+ * Function that returns the largest magnitude of a range of samples
+ *
+ * @param samples - the samples
+ * @param start - the first sample of the range
+ * @param end - the end of the range
+ */
+static int32_t peak(const std::vector<int16_t> &samples, uint32_t start, uint32_t end) {
+  int32_t largest = 0;
+  for (uint32_t i = start; i < end; i++) {
+    int32_t magnitude = samples[i] < 0 ? -samples[i] : samples[i];
+    largest = magnitude > largest ? magnitude : largest;
+  }
+  return largest;
+}
+
+int runSynthChecks() {
+  int failures = 0;
+  char result[96];
+
+  /* voice assignment, the voices keep their state from one case to the next */
+  CheckedVoice voices[SYNTH_CHECK_VOICES] = { { -1 }, { -1 } };
+  for (const VoiceCase &test : VOICE_CASES) {
+    uint32_t starts = 0;
+    uint8_t leftOut = assignMixerVoices(voices, SYNTH_CHECK_VOICES, test.requested, SYNTH_CHECK_SOUNDS,
+                                        [](CheckedVoice &voice) { voice.sound = -1; },
+                                        [&starts, &test](CheckedVoice &voice, int8_t sound) {
+                                          starts++;
+                                          voice.sound = sound == test.failing ? -1 : sound;
+                                        });
+
+    bool ok = leftOut == test.leftOut && starts == test.starts;
+    for (uint8_t i = 0; i < SYNTH_CHECK_VOICES; i++) {
+      ok = ok && voices[i].sound == test.expected[i];
+    }
+    snprintf(result, sizeof(result), "%2d %2d, %u left out, %u started", voices[0].sound, voices[1].sound, leftOut, starts);
+    failures += report(test.name, result, ok);
+  }
+
+  /* the beeper fades in, then out once its gate closes, and is silent until it opens again */
+  Synth synth;
+  synthStart(synth, &GATED_PATCH, 0);
+  uint32_t gateLength = GATED_PATCH.gatePeriod * SYNTH_CHECK_RATE / 1000;
+  std::vector<int16_t> samples = synthesize(synth, gateLength + gateLength / 4);
+
+  int32_t firstSample = samples[1] < 0 ? -samples[1] : samples[1];
+  int32_t faded = peak(samples, SYNTH_CHECK_FADE_SAMPLES, gateLength / 2);
+  snprintf(result, sizeof(result), "%5d at the 2nd sample, %d once faded in", firstSample, faded);
+  failures += report("gate fading in", result, firstSample < faded / 16 && faded >= GATED_PATCH.harmonics[0] / 2);
+
+  int32_t fadingOut = peak(samples, gateLength / 2, gateLength / 2 + SYNTH_CHECK_FADE_SAMPLES);
+  int32_t closed = peak(samples, gateLength / 2 + SYNTH_CHECK_FADE_SAMPLES, gateLength);
+  snprintf(result, sizeof(result), "%5d while fading out, %d once closed", fadingOut, closed);
+  failures += report("gate closed to silence", result, fadingOut > 0 && fadingOut <= faded && closed == 0);
+
+  int32_t reopened = peak(samples, gateLength + SYNTH_CHECK_FADE_SAMPLES, gateLength + gateLength / 4);
+  snprintf(result, sizeof(result), "%5d", reopened);
+  failures += report("gate reopened", result, reopened >= faded - faded / 16);
+
+  /* three full-scale harmonics clip at full scale instead of wrapping around */
+  synthStart(synth, &LOUD_PATCH, 0);
+  samples = synthesize(synth, SYNTH_CHECK_RATE / 10);
+  uint32_t clipped = 0;
+  uint32_t wrapped = 0;
+  for (uint32_t i = SYNTH_CHECK_FADE_SAMPLES; i < samples.size(); i++) {
+    clipped += samples[i] >= SYNTH_CHECK_FULL_SCALE || samples[i] <= -SYNTH_CHECK_FULL_SCALE ? 1 : 0;
+    /* between two samples the 200 Hz fundamental moves far less than half the range */
+    int32_t step = samples[i] - samples[i - 1];
+    wrapped += step > 32767 || step < -32767 ? 1 : 0;
+  }
+  snprintf(result, sizeof(result), "%5u clipped samples, %u wrapped around", clipped, wrapped);
+  failures += report("loud patch", result, clipped > 0 && wrapped == 0);
+
+  /* two voices at full scale saturate in the mix */
+  int16_t high[MIXER_BLOCK_SIZE];
+  int16_t low[MIXER_BLOCK_SIZE];
+  for (uint16_t i = 0; i < MIXER_BLOCK_SIZE; i++) {
+    high[i] = INT16_MAX;
+    low[i] = INT16_MIN;
+  }
+  const int16_t *blocks[] = { high, high, low, low };
+  const int16_t gains[] = { MIXER_UNITY_GAIN, MIXER_UNITY_GAIN, MIXER_UNITY_GAIN, MIXER_UNITY_GAIN };
+  int16_t mixed[MIXER_BLOCK_SIZE];
+  mixBlock(mixed, blocks, gains, 2, MIXER_BLOCK_SIZE);
+  int16_t mixedHigh = mixed[0];
+  mixBlock(mixed, blocks + 2, gains + 2, 2, MIXER_BLOCK_SIZE);
+  int16_t mixedLow = mixed[0];
+  snprintf(result, sizeof(result), "%6d %6d", mixedHigh, mixedLow);
+  failures += report("full-scale voices mixed", result, mixedHigh == INT16_MAX && mixedLow == INT16_MIN);
+
+  return failures;
+}